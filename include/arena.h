@@ -0,0 +1,64 @@
+
+#ifndef __MYOS__ARENA_H
+#define __MYOS__ARENA_H
+
+#include <common/types.h>
+#include <memorymanagement.h>
+
+// An Arena is scratch memory for one operation, like sending one packet or
+// drawing one frame. It takes one block from the MemoryManager when it is
+// created and then only moves a pointer forward:
+//
+//   +-------------+-------------+----------------------------+
+//   |   buffer 1  |   buffer 2  |          free              |
+//   +-------------+-------------+----------------------------+
+//   ^                           ^                            ^
+//  start                       top                    start + capacity
+//
+// There is no free for a single buffer. Instead the operation remembers top
+// when it starts (Mark) and puts it back when it is done (Release), which
+// frees everything that it allocated in between at once.
+//
+// An Arena has no lock. Tasks on other processors and the receive tasklet
+// send at the same time, and a Release in the middle of somebody else's
+// operation would free their buffers too, so only one operation at a time
+// may use it. The owner keeps a Spinlock for that and holds it from the Mark
+// to the Release (so it must not wait for anything in between):
+//
+//   uint32_t eflags = sendLock.LockSave();
+//   size_t mark = sendArena.Mark();
+//   uint8_t* buffer = (uint8_t*)sendArena.Allocate(size);
+//   ...
+//   sendArena.Release(mark);
+//   sendLock.UnlockRestore(eflags);
+//
+// Then the arena only has to be as large as one operation needs.
+
+namespace myos {
+
+  class Arena {
+    protected:
+      common::uint8_t* start;
+      common::size_t capacity;
+      common::size_t top;
+
+    public:
+      Arena(common::size_t capacity, MemoryTag tag = MemoryTagUntagged);
+      ~Arena();
+
+      // 0 if the arena is full, it never falls back to the heap
+      void* Allocate(common::size_t size, common::size_t align = 16);
+
+      common::size_t Mark();
+      void Release(common::size_t mark);
+
+      // everything at once
+      void Reset();
+
+      common::size_t Used();
+      common::size_t Capacity();
+  };
+
+}
+
+#endif
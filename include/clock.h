@@ -0,0 +1,66 @@
+#ifndef __MYOS__CLOCK_H
+#define __MYOS__CLOCK_H
+
+#include <common/types.h>
+
+// The timestamp counter (TSC) of the processor counts every clock cycle and
+// rdtsc reads it in a few cycles, so it is the best clock we have. But we
+// don't know how fast it counts. The PIT does know its frequency (1193182 Hz),
+// so we let the PIT count down for 50 ms and look how far the TSC got:
+//
+//   TSC:  |----------------- delta cycles -----------------|
+//   PIT:  |------------ 59659 counts = 50 ms --------------|
+//
+// From then on a difference of two rdtsc is a time:
+//
+//   nanoseconds = cycles * 50 ms / delta
+//
+// We can't divide 64 bit numbers in the kernel (no libgcc), so we keep
+// 50 ms / delta as a fixed point number with 24 bits after the point
+// and only multiply and shift.
+
+namespace myos {
+
+  namespace drivers {
+    class ProgrammableIntervalTimer;
+  }
+
+  // the cycle counter, for measuring short things
+  inline common::uint64_t rdtsc() {
+    common::uint32_t low, high;
+    asm volatile("rdtsc" : "=a" (low), "=d" (high));
+    return ((common::uint64_t)high << 32) | low;
+  }
+
+  class Clock {
+    protected:
+      bool hasTimestampCounter;
+
+      // the TSC when we were calibrated, time 0
+      common::uint64_t start;
+
+      // nanoseconds per cycle << 24
+      common::uint32_t nanosecondsPerCycle;
+      common::uint32_t cyclesPerMillisecond;
+
+    public:
+      static Clock* activeClock;
+
+      // calibrates the TSC with channel 2 of the PIT, takes 50 ms
+      Clock(drivers::ProgrammableIntervalTimer* timer);
+      ~Clock();
+
+      // monotonic, since the Clock was created
+      // without a TSC it only moves with the timer interrupt
+      common::uint64_t Nanoseconds();
+
+      common::uint64_t CyclesToNanoseconds(common::uint64_t cycles);
+      common::uint32_t CyclesPerMillisecond();
+  };
+
+  // Clock::activeClock->Nanoseconds(), 0 if there is no clock
+  common::uint64_t now_ns();
+
+}
+
+#endif
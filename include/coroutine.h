@@ -0,0 +1,213 @@
+#ifndef __MYOS__COROUTINE_H
+#define __MYOS__COROUTINE_H
+
+#include <common/types.h>
+#include <multitasking.h>
+#include <timerwheel.h>
+#include <hardwarecommunication/interrupts.h>
+
+// A Task costs a stack of at least 4 KiB, 528 bytes for the FPU registers
+// and an interrupt for every switch. That is too much for something like an
+// ARP request that only sends a packet and waits for the answer, if there
+// are hundreds of them at the same time.
+//
+// A Coroutine has no stack of its own. Its Resume is a state machine: it
+// runs until it has to wait, remembers where it was (resumePoint) and
+// returns. The next Resume jumps right back there. The macros write the
+// state machine for us, so the code still reads from top to bottom:
+//
+//   class Ping : public Coroutine {
+//       int i;                      // everything that lives across a wait
+//     protected:                    // is a member, locals are gone after
+//       CoroutineStatus Resume() {  // every return of Resume
+//         CO_BEGIN;
+//         for (i = 0; i < 3; i++) {
+//           send();
+//           CO_WAIT_UNTIL(&answered, gotAnswer(), 1000);
+//           if (TimedOut()) ...
+//         }
+//         CO_END;
+//       }
+//   };
+//
+// CO_BEGIN is a switch over resumePoint and every wait is a case with its
+// own line number (so only one macro per line), the same trick as Duff's
+// device. A switch in Resume must not have a wait inside of it.
+//
+// The CoroutineExecutor runs them one after another in a single task, a
+// switch from one coroutine to the next is one virtual call. Nothing
+// preempts them, they run until they wait or CO_YIELD, so a coroutine must
+// not compute for long and must not block the task (WaitQueue::Wait returns
+// false in there, like in an interrupt handler). They wait for a
+// CoroutineEvent instead, which interrupt handlers and tasks can signal.
+
+namespace myos {
+
+  class Coroutine;
+  class CoroutineExecutor;
+
+  enum CoroutineStatus {
+    CoroutineYielded,  // wants to go on later, at the end of the ready list
+    CoroutineWaiting,  // parked on an event or a timer
+    CoroutineDone
+  };
+
+  enum CoroutineState {
+    CoroutineNew,
+    CoroutineReady,    // in the ready list of its executor, or running
+    CoroutineBlocked,
+    CoroutineFinished
+  };
+
+  // what coroutines wait for, like a WaitQueue for tasks
+  class CoroutineEvent {
+    friend class Coroutine;
+    friend class CoroutineExecutor;
+
+    protected:
+      Coroutine* head;
+
+      void Append(Coroutine* coroutine);
+      void Remove(Coroutine* coroutine);
+
+    public:
+      CoroutineEvent();
+      ~CoroutineEvent();
+
+      // safe in interrupt handlers, the coroutines look at their condition again
+      void SignalOne();
+      void SignalAll();
+  };
+
+  class Coroutine {
+    friend class CoroutineEvent;
+    friend class CoroutineExecutor;
+
+    protected:
+      // the __LINE__ of the wait that Resume goes on after, 0 at the start
+      common::uint32_t resumePoint;
+      // of the SaveInterrupts in CO_WAIT_UNTIL, between the check and the Park
+      common::uint32_t eflags;
+
+      CoroutineState state;
+      CoroutineExecutor* executor;
+      bool deleteWhenDone;
+
+      // in the ready list of the executor or the list of the event
+      Coroutine* next;
+      CoroutineEvent* event;
+
+      // the timeout of a wait, or the end of a sleep
+      Timer timer;
+      bool timedOut;
+
+      // signals everybody who waits for the end of this one
+      CoroutineEvent finished;
+
+      // wait for the event (0: only for the timeout) if wait is true,
+      // with the interrupts off, restores them
+      bool Park(CoroutineEvent* event, bool wait, common::uint32_t timeoutMilliseconds);
+      static void Timeout(void* coroutine);
+
+      // one step, until the next wait, see the macros
+      // (without an override there is nothing to do)
+      virtual CoroutineStatus Resume();
+
+    public:
+      static const common::uint32_t WaitForever = 0;
+
+      Coroutine();
+      virtual ~Coroutine();
+
+      CoroutineState State();
+      bool Done();
+      // the last wait ended because its time was over
+      bool TimedOut();
+      CoroutineEvent* Finished();
+  };
+
+  class CoroutineExecutor {
+    friend class Coroutine;
+    friend class CoroutineEvent;
+
+    protected:
+      Coroutine* head;
+      Coroutine* tail;
+
+      // the task waits here while no coroutine is ready
+      WaitQueue work;
+
+      TaskManager* taskManager;
+      common::uint32_t task;
+
+      common::uint32_t running;
+      common::uint32_t numStarted;
+      common::uint32_t numDone;
+      common::uint32_t numResumes;
+
+      // into the ready list, with the interrupts off
+      void Append(Coroutine* coroutine);
+      // a blocked coroutine is ready again (its event or its timer)
+      void Wake(Coroutine* coroutine, bool timedOut);
+
+      static void Run(void* executor);
+
+    public:
+      static CoroutineExecutor* activeCoroutineExecutor;
+
+      // spawns the task that runs the coroutines
+      CoroutineExecutor(TaskManager* taskManager, common::uint8_t priority = TaskPriorityNetwork);
+      ~CoroutineExecutor();
+
+      // the coroutine runs from the start, false if it runs already;
+      // with deleteWhenDone it is deleted at its CO_END, then nobody may wait for Finished
+      bool Start(Coroutine* coroutine, bool deleteWhenDone = false);
+
+      // how many have started and are not done
+      common::uint32_t Running();
+      void PrintStatistics();
+  };
+
+  // CoroutineExecutor::activeCoroutineExecutor->Start, false if there is none
+  bool coroutine_start(Coroutine* coroutine, bool deleteWhenDone = false);
+
+}
+
+#define CO_BEGIN switch (resumePoint) { case 0:
+
+// go on after the other ready coroutines have had their turn
+#define CO_YIELD() \
+  do { \
+    resumePoint = __LINE__; \
+    return myos::CoroutineYielded; \
+    case __LINE__:; \
+  } while (0)
+
+// go on when the condition is true or the time is over (TimedOut), the
+// condition is checked with the interrupts off, so a Signal between the
+// check and the wait is not lost
+#define CO_WAIT_UNTIL(waitEvent, condition, timeoutMilliseconds) \
+  do { \
+    timedOut = false; \
+    resumePoint = __LINE__; \
+    case __LINE__: \
+    eflags = myos::hardwarecommunication::SaveInterrupts(); \
+    if (Park((waitEvent), !timedOut && !(condition), (timeoutMilliseconds))) { \
+      return myos::CoroutineWaiting; \
+    } \
+  } while (0)
+
+#define CO_SLEEP(milliseconds) \
+  do { \
+    timedOut = false; \
+    resumePoint = __LINE__; \
+    case __LINE__: \
+    eflags = myos::hardwarecommunication::SaveInterrupts(); \
+    if (Park(0, !timedOut, (milliseconds))) { \
+      return myos::CoroutineWaiting; \
+    } \
+  } while (0)
+
+#define CO_END } resumePoint = 0; return myos::CoroutineDone
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __MYOS__CPU_H
+#define __MYOS__CPU_H
+
+#include <common/types.h>
+
+// Everything that every processor has for itself. The processors are
+// numbered in the order in which they have started: 0 is the bootstrap
+// processor that runs kernelMain, the others are the application processors
+// that the ProcessorManager starts (see smp.h). The local APIC ID is the
+// number that the hardware gives them, it has holes.
+//
+// Every processor has its own GlobalDescriptorTable, and in there the GS
+// segment starts at its CPU (see gdt.h). So gs:0 is always the CPU of the
+// processor that we run on, and a field of it is one load relative to gs:
+//
+//   mov %gs:0, %eax     CPU::Current()
+//   mov %gs:8, %eax     CPU::CurrentTask()
+//
+// without asking the local APIC who we are and looking that up in a table.
+
+namespace myos {
+
+  class Task;
+
+  class CPU {
+    public:
+      static const common::uint32_t MaxCPUs = 8;
+
+      // points to itself, so gs:0 is a pointer to the CPU
+      CPU* self;
+      common::uint32_t index;
+
+      // the task that runs on this processor, 0 while its idle loop runs
+      Task* currentTask;
+
+      common::uint8_t apicId;
+      volatile bool online;
+
+      // how many hardware interrupt handlers are running right now on this
+      // processor (more than one if an interrupt handler gets interrupted)
+      volatile common::uint32_t interruptDepth;
+
+      // counters, only this processor writes its own
+      common::uint32_t interrupts;
+      common::uint32_t taskSwitches;
+
+      CPU();
+
+      static CPU cpus[MaxCPUs];
+
+      // the processors 0 to numOnline - 1 are running
+      static volatile common::uint32_t numOnline;
+
+      // the processor that we run on, its GDT must be loaded
+      static CPU* Current();
+      static common::uint32_t CurrentIndex();
+      static Task* CurrentTask();
+      static void SetCurrentTask(Task* task);
+
+      static void CountInterrupt();
+      static void CountTaskSwitch();
+
+      // the local APIC ID of processor index, before it starts
+      static void Register(common::uint32_t index, common::uint8_t apicId);
+
+      // one line with the counters of every processor that runs
+      static void PrintStatistics();
+  };
+
+  inline CPU* CPU::Current() {
+    CPU* cpu;
+    asm volatile("mov %%gs:%c1, %0" : "=r" (cpu) : "i" (__builtin_offsetof(CPU, self)));
+    return cpu;
+  }
+
+  inline common::uint32_t CPU::CurrentIndex() {
+    common::uint32_t index;
+    asm volatile("mov %%gs:%c1, %0" : "=r" (index) : "i" (__builtin_offsetof(CPU, index)));
+    return index;
+  }
+
+  inline Task* CPU::CurrentTask() {
+    Task* task;
+    asm volatile("mov %%gs:%c1, %0" : "=r" (task) : "i" (__builtin_offsetof(CPU, currentTask)));
+    return task;
+  }
+
+  inline void CPU::SetCurrentTask(Task* task) {
+    asm volatile("mov %0, %%gs:%c1" : : "r" (task), "i" (__builtin_offsetof(CPU, currentTask)) : "memory");
+  }
+
+  inline void CPU::CountInterrupt() {
+    asm volatile("incl %%gs:%c0" : : "i" (__builtin_offsetof(CPU, interrupts)) : "memory");
+  }
+
+  inline void CPU::CountTaskSwitch() {
+    asm volatile("incl %%gs:%c0" : : "i" (__builtin_offsetof(CPU, taskSwitches)) : "memory");
+  }
+
+}
+
+#endif
@@ -0,0 +1,61 @@
+
+#ifndef __MYOS__DMAPOOL_H
+#define __MYOS__DMAPOOL_H
+
+#include <common/types.h>
+#include <physicalmemory.h>
+#include <memorymanagement.h>
+
+// Devices like the am79c973 read and write memory on their own (DMA,
+// direct memory access). They don't know anything about our page tables,
+// so we have to give them physical addresses, and a buffer must be
+// physically contiguous because the device just counts up from its start.
+//
+// The DirectMemoryAccessPool is a heap of its own that only gets blocks of
+// frames from the PhysicalMemoryManager (a buddy block is contiguous) and
+// only frames below the limit of the devices it serves:
+//
+//   legacy ISA DMA controller      below 16 MiB
+//   32 bit PCI bus masters         below 4 GiB
+//
+// x86 keeps the caches coherent with DMA, so the buffers can stay cached.
+
+namespace myos {
+
+  class DirectMemoryAccessPool {
+    public:
+      static const common::uint32_t IsaLimit = 16 * 1024 * 1024;
+      static const common::uint32_t PciLimit = 0xFFFFFFFF;
+
+      // rings of descriptors want at least a cache line
+      static const common::size_t CacheLineSize = 64;
+
+    protected:
+      PhysicalMemoryManager* frames;
+      common::uint32_t limit;
+
+      // the chunk lists and bins of the pool, it never grows by itself
+      MemoryManager heap;
+
+      bool Grow(common::size_t size, common::size_t align);
+
+    public:
+      static DirectMemoryAccessPool* activeDirectMemoryAccessPool;
+
+      DirectMemoryAccessPool(PhysicalMemoryManager* frames, common::uint32_t limit);
+      ~DirectMemoryAccessPool();
+
+      // Allocate and Free turn the interrupts off, so they are safe on every processor
+      //
+      // a contiguous block aligned to align (a power of two)
+      // if physicalAddress is not 0 it gets the address for the device
+      void* Allocate(common::size_t size, common::size_t align, common::uint32_t* physicalAddress);
+      void Free(void* ptr);
+
+      // the address a device has to use for a pointer from Allocate
+      static common::uint32_t PhysicalAddress(void* ptr);
+  };
+
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <hardwarecommunication/pci.h>
 #include <hardwarecommunication/interrupts.h>
 #include <hardwarecommunication/port.h>
+#include <reservepool.h>
+#include <workqueue.h>
 
 // https://wiki.osdev.org/AMD_PCNET
 
@@ -60,20 +62,36 @@ namespace myos {
 
         // the main purpose of the initialization block is to hold a pointer to
         // the array of BufferDescriptors, which hold the pointers to the buffers
-        InitializationBlock initBlock;
+        //
+        // the card reads all of them with DMA, so they come from the DirectMemoryAccessPool
+        // and the addresses that we give to the card are physical addresses
+        InitializationBlock* initBlock;
+
+        static const common::uint32_t NumBuffers = 8;
+        static const common::uint32_t BufferSize = 2048;
 
         BufferDescriptor* sendBufferDescr;
-        common::uint8_t sendBufferDescrMemory[2048+15];
-        common::uint8_t sendBuffers[2*1024+15][8];
+        common::uint8_t* sendBuffers;
         common::uint8_t currentSendBuffer;
 
         BufferDescriptor* recvBufferDescr;
-        common::uint8_t recvBufferDescrMemory[2048+15];
-        common::uint8_t recvBuffers[2*1024+15][8];
+        common::uint8_t* recvBuffers;
         common::uint8_t currentRecvBuffer;
 
+        // Receive copies every frame into one of these buffers, so the
+        // card gets its ring buffer back before the handlers are done
+        ReservePool receivePool;
+
+        // the interrupt handler only acknowledges the card, the frames and
+        // everything above Ethernet run in this tasklet with the interrupts on
+        WorkItem receiveWork;
+        static void ReceiveWork(void* nic);
+
         RawDataHandler* handler;
 
+        // gives the rings and buffers back to the DirectMemoryAccessPool
+        void FreeRings();
+
       public:
         amd_am79c973(hardwarecommunication::PeripheralComponentInterconnectDeviceDescriptor *dev,
             hardwarecommunication::InterruptManager* interrupts);
@@ -4,6 +4,7 @@
 #include <common/types.h>
 #include <hardwarecommunication/interrupts.h>
 #include <hardwarecommunication/port.h>
+#include <multitasking.h>
 
 // PCI settings for hard disk driver:
 // - class ID: 0x01
@@ -103,7 +104,7 @@ namespace myos {
 
   namespace drivers {
 
-    class AdvancedTechnologyAttachment {
+    class AdvancedTechnologyAttachment : public hardwarecommunication::InterruptHandler {
       protected:
         // you can also read the information how many bytes are in a sector
         // but I'm not going to this. Just set this number to 512 that's it.
@@ -139,6 +140,21 @@ namespace myos {
         // control port which is also used for status messages
         hardwarecommunication::Port8Bit controlPort;
 
+        // 0 for the primary bus, 1 for the secondary bus
+        common::uint8_t channel;
+
+        // the tasks that wait for the interrupt of the drive, one queue for every bus
+        // because master and slave share the interrupt
+        static WaitQueue completions[2];
+
+        // if the interrupt gets lost we look at the status again after this
+        static const common::uint32_t BusyTimeout = 100; // ms
+
+        // instead of asking the drive again and again if it is still busy,
+        // the task sleeps until the interrupt of the drive comes
+        // returns the status
+        common::uint8_t WaitWhileBusy();
+
       public:
         // hard code the port number
         // we do have multiple of the ATA buses
@@ -149,9 +165,12 @@ namespace myos {
         // which are two hard drives on the same bus
         // actually the words master and slave don't mean anything
         // it's just a random words to describe to distinguish one of the hard drives and the other one
-        AdvancedTechnologyAttachment(bool master, common::uint16_t portBase);
+        AdvancedTechnologyAttachment(hardwarecommunication::InterruptManager* interruptManager, bool master, common::uint16_t portBase);
         ~AdvancedTechnologyAttachment();
 
+        // the drive is done with a command
+        common::uint32_t HandleInterrupt(common::uint32_t esp);
+
         // the operations that we really wnat to implement
         // the Identify operation through which we talked to the hardware
         // and ask are you there and what kind of hard drive are you install
@@ -0,0 +1,48 @@
+#ifndef __MYOS__DRIVERS__SERIAL_H
+#define __MYOS__DRIVERS__SERIAL_H
+
+#include <common/types.h>
+#include <drivers/driver.h>
+#include <hardwarecommunication/port.h>
+
+// https://wiki.osdev.org/Serial_Ports
+//
+// The 16550 UART of the COM ports. We only send, and we poll the line status
+// register instead of waiting for an interrupt, so it works everywhere,
+// even with the interrupts switched off.
+//
+// VirtualBox and qemu can write what comes out of COM1 into a file
+// (qemu: -serial file:trace.bin), that is how we get data out of the kernel.
+
+namespace myos {
+
+  namespace drivers {
+
+    class SerialPort : public Driver {
+      public:
+        static const common::uint16_t COM1 = 0x3F8;
+
+      protected:
+        hardwarecommunication::Port8Bit dataPort;           // +0, the divisor low byte if DLAB is set
+        hardwarecommunication::Port8Bit interruptEnablePort; // +1, the divisor high byte if DLAB is set
+        hardwarecommunication::Port8Bit fifoControlPort;     // +2
+        hardwarecommunication::Port8Bit lineControlPort;     // +3
+        hardwarecommunication::Port8Bit modemControlPort;    // +4
+        hardwarecommunication::Port8Bit lineStatusPort;      // +5
+
+      public:
+        SerialPort(common::uint16_t portBase = COM1);
+        ~SerialPort();
+
+        // 115200 baud, 8 data bits, no parity, one stop bit
+        void Activate();
+
+        void Write(common::uint8_t data);
+        void Write(common::uint8_t* buffer, common::uint32_t size);
+    };
+
+  }
+
+}
+
+#endif
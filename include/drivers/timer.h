@@ -0,0 +1,82 @@
+#ifndef __MYOS__DRIVERS__TIMER_H
+#define __MYOS__DRIVERS__TIMER_H
+
+#include <common/types.h>
+#include <drivers/driver.h>
+#include <hardwarecommunication/port.h>
+
+// https://wiki.osdev.org/Programmable_Interval_Timer
+//
+// The Programmable Interval Timer (PIT, Intel 8253/8254) counts down from a
+// value that we give it with 1193182 Hz. Its channel 0 is connected to IRQ 0,
+// the timer interrupt that drives the scheduler.
+//
+//   periodic (mode 2)   when the counter reaches 0 there is an interrupt and
+//                       it starts again with the same value, so we get
+//                       1193182 / value interrupts per second
+//   one shot (mode 0)   one interrupt when the counter reaches 0, then nothing
+//
+// Without programming it the BIOS leaves it periodic with the largest value
+// 65536, that is 18.2 interrupts per second.
+
+namespace myos {
+
+  namespace drivers {
+
+    class ProgrammableIntervalTimer : public Driver {
+      public:
+        static const common::uint32_t BaseFrequency = 1193182;
+        static const common::uint32_t MaxCount = 0xFFFF;
+
+      protected:
+        hardwarecommunication::Port8Bit channel0Port;
+        hardwarecommunication::Port8Bit channel2Port;
+        hardwarecommunication::Port8Bit commandPort;
+
+        // bit 0 is the gate of channel 2, bit 1 connects it to the speaker,
+        // bit 5 is the output of channel 2
+        hardwarecommunication::Port8Bit channel2GatePort;
+
+        common::uint32_t frequency;
+        // the value that channel 0 counts down for one tick
+        common::uint32_t countsPerTick;
+
+        // the value of the one shot, 0 if we are periodic
+        common::uint32_t oneShotCount;
+
+        void Load(common::uint8_t mode, common::uint32_t count);
+
+      public:
+        ProgrammableIntervalTimer(common::uint32_t frequency = 100);
+        ~ProgrammableIntervalTimer();
+
+        // periodic with the frequency of the constructor
+        void Activate();
+
+        void SetFrequency(common::uint32_t frequency);
+        common::uint32_t Frequency();
+        common::uint32_t TickMicroseconds();
+
+        // one interrupt after this many ticks and no more ticks until Periodic,
+        // at most MaxOneShotTicks
+        void OneShot(common::uint32_t ticks);
+        common::uint32_t MaxOneShotTicks();
+
+        // back to periodic, and how many whole ticks of the one shot have passed
+        // (only right if the interrupt of the one shot hasn't come yet)
+        common::uint32_t Periodic();
+
+        // where channel 0 is in its countdown right now
+        common::uint16_t ReadCount();
+
+        // busy wait until channel 2 has counted this far (at most MaxCount),
+        // channel 0 and its interrupt keep on running, so this also works
+        // before the interrupts are activated
+        void Wait(common::uint16_t counts);
+    };
+
+  }
+
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __MYOS__FPU_H
+#define __MYOS__FPU_H
+
+#include <common/types.h>
+#include <hardwarecommunication/interrupts.h>
+#include <cpu.h>
+
+// https://wiki.osdev.org/FPU
+// https://wiki.osdev.org/SSE
+//
+// The FPU and the SSE unit have their own registers (st0-st7, xmm0-xmm7,
+// their control words), 512 bytes for fxsave. CPUState and the interrupt
+// stubs only save the normal registers, so if two tasks use SSE they would
+// overwrite each other's xmm registers.
+//
+// Saving 512 bytes on every task switch would cost all tasks, and most of
+// them never touch the FPU. So we do it lazily: on a task switch we only set
+// the TS bit (task switched) in CR0. The next FPU or SSE instruction then
+// traps with exception 7 (#NM, device not available), and only then we save
+// the registers for the task that used the FPU last and load the ones of the
+// current task:
+//
+//   task A  fpu ... fpu |           |               |
+//   task B              | int int   | fpu #NM ...   |   save A, load B
+//   task A              |           |               | int ...  (A doesn't touch
+//                                                      the FPU, nothing to do)
+//
+// Interrupt handlers must not use the FPU or SSE, the registers that they
+// would overwrite belong to the task below them.
+//
+// Every processor has its own registers. With more than one processor a task
+// that was switched away can go on on another one, which must find its
+// registers in its area. So there the registers are saved right at the switch
+// (if the task used the FPU since it got the processor), only loading them
+// stays lazy.
+
+namespace myos {
+
+  class Task;
+
+  class FloatingPointUnit : public hardwarecommunication::InterruptHandler {
+    public:
+      // fxsave needs 512 bytes at an address that is a multiple of 16
+      static const common::uint32_t StateSize = 512;
+      static const common::uint32_t StateAlignment = 16;
+
+    protected:
+      bool hasFxsr;
+      bool hasSSE;
+
+      // the registers of each processor belong to this one right now, 0 if to nobody
+      common::uint8_t* owner[CPU::MaxCPUs];
+
+      // for the idle loops (kernelMain on the first processor), which are no tasks
+      common::uint8_t idleArea[CPU::MaxCPUs][StateSize + StateAlignment];
+      bool idleUsed[CPU::MaxCPUs];
+
+      // after fninit, every task starts with this
+      common::uint8_t initialArea[StateSize + StateAlignment];
+
+      void Save(common::uint8_t* area);
+      void Restore(common::uint8_t* area);
+
+    public:
+      static FloatingPointUnit* activeFloatingPointUnit;
+
+      FloatingPointUnit(hardwarecommunication::InterruptManager* interruptManager);
+      ~FloatingPointUnit();
+
+      // switch the FPU (and SSE if there is one) on, before the first task runs
+      void Activate();
+
+      bool HasSSE();
+
+      // the TaskManager has switched to this task (0 for the idle loop)
+      void TaskSwitched(Task* task);
+      // the task is gone, its registers don't need to be saved anymore
+      void Release(Task* task);
+
+      // #NM
+      virtual common::uint32_t HandleInterrupt(common::uint32_t esp);
+  };
+
+}
+
+#endif
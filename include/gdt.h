@@ -27,9 +27,58 @@
 #define __MYOS__GDT_H
 
 #include <common/types.h>
+#include <cpu.h>
 
 namespace myos {
 
+  /*
+   * Task State Segment (TSS)
+   *
+   * The processor was made to switch tasks with it, we do that ourselves
+   * (see TaskManager). What it still needs the TSS for is the stack of the
+   * kernel (ss0:esp0) when an interrupt comes from user mode, and every
+   * processor needs its own because every one has its own stack.
+   *
+   * ltr loads its selector into the task register, once per processor.
+   */
+  struct TaskStateSegment {
+    common::uint32_t previous;
+    common::uint32_t esp0;
+    common::uint32_t ss0;
+    common::uint32_t esp1;
+    common::uint32_t ss1;
+    common::uint32_t esp2;
+    common::uint32_t ss2;
+    common::uint32_t cr3;
+    common::uint32_t eip;
+    common::uint32_t eflags;
+    common::uint32_t eax;
+    common::uint32_t ecx;
+    common::uint32_t edx;
+    common::uint32_t ebx;
+    common::uint32_t esp;
+    common::uint32_t ebp;
+    common::uint32_t esi;
+    common::uint32_t edi;
+    common::uint32_t es;
+    common::uint32_t cs;
+    common::uint32_t ss;
+    common::uint32_t ds;
+    common::uint32_t fs;
+    common::uint32_t gs;
+    common::uint32_t ldt;
+    common::uint16_t trap;
+    common::uint16_t ioMapBase; // behind the end, so there is no IO permission bitmap
+  } __attribute__((packed));
+
+  // Every processor has its own table, they only differ in the last two:
+  //
+  //   0x00  null
+  //   0x08  unused
+  //   0x10  code, 4 GiB
+  //   0x18  data, 4 GiB
+  //   0x20  CPU, GS points to the CPU of the processor (see cpu.h)
+  //   0x28  TSS of the processor
   class GlobalDescriptorTable {
     public:
       class SegmentDescriptor {
@@ -63,13 +112,28 @@ namespace myos {
       SegmentDescriptor codeSegmentSelector;
       SegmentDescriptor dataSegmentSelector;
 
+      SegmentDescriptor cpuSegmentSelector;
+      SegmentDescriptor taskStateSegmentSelector;
+
+      TaskStateSegment taskStateSegment;
+
+      // lgdt and the segment registers
+      void Load();
+
     public:
-      GlobalDescriptorTable();
+      // the processor that runs the constructor loads the table, and then
+      // it is the one of cpu: every processor creates its own
+      GlobalDescriptorTable(CPU* cpu);
       ~GlobalDescriptorTable();
 
       // This code is supposed to be give us the `offset` of the code segment descriptor and one for data segment descriptor
       common::uint16_t CodeSegmentSelector();
       common::uint16_t DataSegmentSelector();
+      common::uint16_t CPUSegmentSelector();
+      common::uint16_t TaskStateSegmentSelector();
+
+      // the stack for interrupts from user mode
+      void SetKernelStack(common::uint32_t esp0);
   };
 
 }
@@ -4,6 +4,7 @@
 #include <common/types.h>
 #include <common/graphicscontext.h>
 #include <drivers/keyboard.h>
+#include <hardwarecommunication/interrupts.h>
 
 namespace myos {
 
@@ -47,6 +48,7 @@ namespace myos {
     class CompositeWidget : public Widget {
       private:
         Widget* children[100];
+        // only AddChild changes them, Draw and the mouse events read them without a lock
         int numChildren;
 
         Widget* focussedChild;
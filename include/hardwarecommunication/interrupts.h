@@ -12,6 +12,87 @@ namespace myos {
 
     class InterruptManager;
 
+    // With more than one processor, switching the interrupts off only keeps
+    // out the interrupts of our own processor, the others go on as before.
+    // So from the moment the second processor starts, whoever has the
+    // interrupts off also holds this lock (the big kernel lock of the first
+    // SMP Linux):
+    //
+    //   SaveInterrupts     they were on  -> cli, then take the lock
+    //   RestoreInterrupts  on again      -> give it back, then sti
+    //   interrupt          from code with the interrupts on  -> take it
+    //   iret               into code with the interrupts on  -> give it back
+    //
+    // Everything that was safe with the interrupts off stays safe, and the
+    // processors only run in parallel while the interrupts are on, in the
+    // tasks. A task that blocks with the interrupts off takes the lock with
+    // it, and it gets it back from the processor that switches to it.
+    //
+    // That includes Spinlock::LockSave, so the heap, the scheduler, the work
+    // queues and the send paths of the network run on one processor at a time
+    // and their spinlocks never spin. They can't leave this lock out: whatever
+    // they call with the interrupts off (the buddy allocator, the driver)
+    // relies on it, and a nested SaveInterrupts doesn't take it again.
+    //
+    // A ticket lock like Spinlock, which can't be used here because it needs
+    // SaveInterrupts itself.
+    class KernelLock {
+      public:
+        static inline volatile myos::common::uint32_t next = 0;
+        static inline volatile myos::common::uint32_t serving = 0;
+
+        // only once there is a second processor, before that cli is enough
+        static inline volatile bool enabled = false;
+
+        static void Lock() {
+          myos::common::uint32_t ticket = __sync_fetch_and_add(&next, 1);
+          while (serving != ticket) {
+            asm volatile("pause");
+          }
+        }
+
+        static void Unlock() {
+          __sync_synchronize();
+          serving = serving + 1;
+        }
+    };
+
+    // switch the interrupts off and remember if they were on before,
+    // so it also works when they are already off, like in an interrupt handler
+    //
+    //   uint32_t eflags = SaveInterrupts();
+    //   ... nobody can interrupt us here ...
+    //   RestoreInterrupts(eflags);
+    inline myos::common::uint32_t SaveInterrupts() {
+      myos::common::uint32_t eflags;
+      asm volatile("pushf\n pop %0\n cli" : "=r" (eflags) : : "memory");
+      if ((eflags & 0x200) != 0 && KernelLock::enabled) {
+        KernelLock::Lock();
+      }
+      return eflags;
+    }
+
+    inline void RestoreInterrupts(myos::common::uint32_t eflags) {
+      if ((eflags & 0x200) != 0 && KernelLock::enabled) {
+        KernelLock::Unlock();
+      }
+      asm volatile("push %0\n popf" : : "r" (eflags) : "memory", "cc");
+    }
+
+    // halt until the next interrupt, with the interrupts off before and after
+    //
+    // sti only takes effect after the next instruction, so no interrupt can
+    // sneak in between and we sleep through its Wake
+    inline void WaitForInterrupt() {
+      if (KernelLock::enabled) {
+        KernelLock::Unlock();
+      }
+      asm volatile("sti\n hlt\n cli" : : : "memory");
+      if (KernelLock::enabled) {
+        KernelLock::Lock();
+      }
+    }
+
     class InterruptHandler {
       protected:
         myos::common::uint8_t InterruptNumber;
@@ -37,6 +118,19 @@ namespace myos {
         // put a current interrupt manager here to ensure we only have one active interrupte mananger
         static InterruptManager* ActiveInterruptManager;
 
+      public:
+        // a task that waits calls this software interrupt to give the processor
+        // to the next task right away (like the timer interrupt, just earlier)
+        static const myos::common::uint8_t YieldInterrupt = 0x81;
+
+        // the timer of the local APIC, it drives the scheduler on the other
+        // processors (the PIT only interrupts the first one)
+        static const myos::common::uint8_t LocalTimerInterrupt = 0x40;
+        // a processor has put a task into our run queue
+        static const myos::common::uint8_t RescheduleInterrupt = 0x41;
+
+      protected:
+
         InterruptHandler* handlers[256];
 
         TaskManager *taskManager;
@@ -190,8 +284,11 @@ namespace myos {
         static void HandleInterruptRequest0x0E();
         static void HandleInterruptRequest0x0F();
         static void HandleInterruptRequest0x31();
+        static void HandleInterruptRequest0x20(); // local APIC timer
+        static void HandleInterruptRequest0x21(); // reschedule
 
         static void HandleInterruptRequest0x80(); // syscall
+        static void HandleInterruptRequest0x81(); // yield
 
         static void HandleException0x00();
         static void HandleException0x01();
@@ -217,6 +314,8 @@ namespace myos {
         static common::uint32_t HandleInterrupt(common::uint8_t interrupt, common::uint32_t esp);
         // call the non-static function to handle interrupt ActiveInterruptManager
         common::uint32_t DoHandleInterrupt(common::uint8_t interrupt, common::uint32_t esp);
+        // after the switch to the stack of the next task, see KernelLock
+        static void LeaveInterrupt(common::uint32_t esp);
 
         Port8BitSlow programmableInterruptControllerMasterCommandPort;
         Port8BitSlow programmableInterruptControllerMasterDataPort;
@@ -230,6 +329,17 @@ namespace myos {
 
         myos::common::uint16_t HardwareInterruptOffset();
 
+        // every processor has its own IDTR, the constructor loads it on the
+        // first one and the others load the same table when they start
+        static void LoadInterruptDescriptorTable();
+
+        // true while this processor handles a hardware interrupt (IRQ context),
+        // in there we must not wait for anything or touch the MemoryManager
+        static bool InInterrupt();
+
+        // false until Activate, before that no interrupt handler runs
+        static bool Activated();
+
         void Activate();
         void Deactivate();
     };
@@ -0,0 +1,84 @@
+#ifndef __MYOS__HARDWARECOMMUNICATION__LOCALAPIC_H
+#define __MYOS__HARDWARECOMMUNICATION__LOCALAPIC_H
+
+#include <common/types.h>
+
+// https://wiki.osdev.org/APIC
+//
+// Every processor has its own local APIC. It gets the interrupts for its
+// processor, it has a timer, and through it the processors send each other
+// interrupts (inter-processor interrupts, IPI). Its registers are memory
+// mapped, every processor sees its own local APIC at the same address
+// (0xFEE00000 unless the ACPI tables say otherwise), so one object is enough.
+//
+// The PIC stays as it is: the BIOS leaves it connected to LINT0 of the first
+// processor (virtual wire mode), so the keyboard, the mouse and the PIT still
+// only interrupt the first processor.
+
+namespace myos {
+
+  namespace drivers {
+    class ProgrammableIntervalTimer;
+  }
+
+  namespace hardwarecommunication {
+
+    class LocalAPIC {
+      public:
+        static const common::uint32_t DefaultBase = 0xFEE00000;
+
+        // interrupts that nobody can acknowledge land here, and the
+        // InterruptManager ignores them
+        static const common::uint8_t SpuriousInterrupt = 0xFF;
+
+      protected:
+        volatile common::uint32_t* registers;
+
+        // the timer counts down this much in one scheduler tick
+        common::uint32_t timerCountsPerTick;
+
+        common::uint32_t Read(common::uint32_t offset);
+        void Write(common::uint32_t offset, common::uint32_t value);
+
+        // write the interrupt command register and wait until it is sent
+        void Send(common::uint8_t apicId, common::uint32_t command);
+
+      public:
+        static LocalAPIC* activeLocalAPIC;
+
+        // the registers must be mapped already
+        LocalAPIC(common::uint32_t base = DefaultBase);
+        ~LocalAPIC();
+
+        // cpuid: does this processor have one at all
+        static bool Present();
+
+        // the local APIC ID of the processor that we run on
+        common::uint8_t Id();
+
+        // switch the local APIC of this processor on (each one does that itself)
+        void Activate();
+
+        void EndOfInterrupt();
+
+        // start another processor, see ProcessorManager::Start
+        void SendInit(common::uint8_t apicId);
+        void SendStartup(common::uint8_t apicId, common::uint32_t trampoline);
+
+        void SendInterrupt(common::uint8_t apicId, common::uint8_t interrupt);
+
+        // how fast the timer counts, the PIT knows its frequency,
+        // takes 10 ms and runs once for all of them
+        void CalibrateTimer(drivers::ProgrammableIntervalTimer* timer, common::uint32_t tickMicroseconds);
+        // periodic, one interrupt every tick on this processor
+        void StartTimer(common::uint8_t interrupt);
+        // one interrupt after ticks (or as many as the counter holds), then it stops,
+        // StartTimer makes it periodic again
+        void OneShotTimer(common::uint8_t interrupt, common::uint32_t ticks);
+    };
+
+  }
+
+}
+
+#endif
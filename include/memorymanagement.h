@@ -3,30 +3,186 @@
 #define __MYOS__MEMORYMANAGEMENT_H
 
 #include <common/types.h>
+#include <physicalmemory.h>
+#include <memorytrace.h>
 
 namespace myos {
 
+  class Spinlock;
+
+  // who an allocation belongs to, so we can see which subsystem uses the heap
+  enum MemoryTag {
+    MemoryTagUntagged,
+    MemoryTagKernel,
+    MemoryTagNet,
+    MemoryTagGui,
+    MemoryTagDrivers,
+    NumMemoryTags
+  };
+
   // double link list
   struct MemoryChunk {
     MemoryChunk *next;
     MemoryChunk *prev;
     bool allocated;
+    common::uint8_t tag;     // a MemoryTag, it fits into the padding behind allocated
+    common::uint16_t region; // index into MemoryManager::regions, also in the padding
+    common::size_t size;
+  };
+
+  // the beginning of every region of the heap, the chunks follow right behind it
+  struct MemoryRegion {
+    MemoryChunk* first;
+    common::size_t start;
     common::size_t size;
+
+    // no free chunk of the region is larger than this
+    // it is exact after a walk over the chunks, and in between it can only be too large,
+    // then the next walk that doesn't find anything makes it exact again
+    common::size_t largestFree;
+  };
+
+  // counters of one size class bin
+  // hits / (hits + misses) is the rate of allocations served in O(1)
+  struct MemoryBinStatistics {
+    common::uint32_t hits;     // malloc served from the free list of the bin
+    common::uint32_t misses;   // malloc had to carve a new chunk from the chunk list
+    common::uint32_t releases; // free parked the chunk in the bin
+  };
+
+  // counters that are always on, they cost a few additions per malloc and free
+  struct MemoryStatistics {
+    common::uint32_t bytesInUse;      // payload bytes handed out (after rounding up)
+    common::uint32_t peakBytesInUse;  // high water mark of bytesInUse
+    common::uint32_t allocations;
+    common::uint32_t frees;
+    common::uint32_t failedAllocations;
+    common::uint32_t largestFreeBlock; // filled by GetStatistics with a walk over the chunks
+    common::uint32_t tagBytesInUse[NumMemoryTags];
   };
 
+  // how the free memory looks like, this needs a walk over all the chunks
+  // bucket i counts the free chunks with 16 << i <= size < 32 << i
+  // (the first bucket also has the smaller ones, the last one also the larger ones)
+  struct MemoryFragmentation {
+    static const common::uint32_t NumBuckets = 16;
+
+    common::uint32_t freeChunks[NumBuckets];
+    common::uint32_t freeBytes;
+    common::uint32_t largestFreeBlock;
+    // the largest free chunk of every region added up, a request never
+    // spans two regions, so that is the most the heap has in one piece per region
+    common::uint32_t largestFreeBlocks;
+
+    // chunks that are parked in the bins, free but not merged
+    common::uint32_t binnedChunks;
+    common::uint32_t binnedBytes;
+
+    common::uint32_t regions;
+  };
+
+  // how the MemoryManager looks for memory, the flags can be combined
+  //   MemoryPolicyBins     small sizes go through the size class bins
+  //   MemoryPolicyBestFit  take the smallest free chunk that fits instead of the first one
+  // the kernel uses MemoryPolicyBins, tools/allocreplay compares them
+  const common::uint32_t MemoryPolicyBins    = 1 << 0;
+  const common::uint32_t MemoryPolicyBestFit = 1 << 1;
+
   class MemoryManager {
+    public:
+      // small requests are rounded up to a power of two size class
+      // 16, 32, 64, ..., 2048 bytes and every class has its own free list
+      static const common::uint32_t NumBins = 8;
+      static const common::size_t MinBinSize = 16;
+      static const common::size_t MaxBinSize = MinBinSize << (NumBins - 1);
+
+      // the heap grows by at least 2^GrowOrder frames (64 KiB) at once
+      static const common::uint32_t GrowOrder = 4;
+
+      static const common::uint32_t MaxRegions = 1024;
+
     protected:
-      MemoryChunk* first;
+      // every region has its own chunk list, so the chunks of two regions never
+      // merge, even if there is a hole or somebody else's memory in between
+      MemoryRegion* regions[MaxRegions];
+      common::uint32_t numRegions;
+
+      // where the heap gets more memory from when it is full, can be 0
+      PhysicalMemoryManager* frames;
+
+      // the freed chunks of every size class
+      // a chunk in a bin stays marked as allocated in the chunk list
+      // so that its neighbours don't swallow it, and the link to the
+      // next chunk in the bin is stored in its (unused) payload
+      MemoryChunk* bins[NumBins];
+
+      // bit i is set if bins[i] is not empty
+      common::uint32_t binBitmap;
+
+      MemoryBinStatistics binStatistics[NumBins];
+
+      MemoryStatistics statistics;
+
+      common::uint32_t policy;
+
+      // records every malloc and free if it is not 0
+      MemoryTrace* trace;
+
+      // malloc and free hold it if it is not 0, so tasks can share the heap
+      Spinlock* lock;
+
+      static common::uint32_t BinIndex(common::size_t size);
+
+      void Initialize(PhysicalMemoryManager* frames);
+      bool Grow(common::size_t size);
+
+      MemoryChunk* FirstFit(MemoryRegion* region, common::size_t size);
+      MemoryChunk* BestFit(MemoryRegion* region, common::size_t size);
+      MemoryChunk* Fit(common::size_t size);
+      MemoryChunk* Find(common::size_t size);
+      MemoryChunk* Split(MemoryChunk* chunk, common::size_t size);
+      void Release(MemoryChunk* chunk);
+      bool FlushBins();
+
+      void* Allocate(common::size_t size, MemoryTag tag);
+      void* AllocateAligned(common::size_t size, common::size_t align, MemoryTag tag);
+
+      void CountAllocation(MemoryChunk* chunk, MemoryTag tag);
+      void CountFree(MemoryChunk* chunk);
 
     public:
       // we want to call the allocation later from static functions
       static MemoryManager *activeMemoryManager;
 
       MemoryManager(common::size_t first, common::size_t size);
+      MemoryManager(PhysicalMemoryManager* frames);
       ~MemoryManager();
 
-      void* malloc(common::size_t size);
+      // not for interrupt handlers: nothing protects the chunk lists against
+      // an interrupt in the middle of a malloc, they take a ReservePool instead
+      void* malloc(common::size_t size, MemoryTag tag = MemoryTagUntagged);
       void free(void* ptr);
+
+      // a block whose address is a multiple of align (a power of two)
+      // it is freed with free like every other block
+      void* malloc_aligned(common::size_t size, common::size_t align, MemoryTag tag = MemoryTagUntagged);
+
+      // give the heap another piece of memory, at any time
+      // false if it is too small or there are already MaxRegions regions
+      bool AddRegion(common::size_t start, common::size_t size);
+
+      void SetPolicy(common::uint32_t policy);
+      void SetTrace(MemoryTrace* trace);
+      // the kernel sets it once the tasks can preempt each other,
+      // the tools run without one
+      void SetLock(Spinlock* lock);
+
+      MemoryBinStatistics GetBinStatistics(common::uint32_t bin);
+      void PrintBinStatistics();
+
+      MemoryStatistics GetStatistics();
+      void GetFragmentation(MemoryFragmentation* fragmentation);
+      void PrintStatistics();
   };
 
 }
@@ -35,6 +191,11 @@ namespace myos {
 void* operator new(unsigned size);
 void* operator new[](unsigned size);
 
+// new (myos::MemoryTagNet) Foo() puts the object on the account of a subsystem
+// (throw(): it returns 0 without a MemoryManager, so the constructor must not run)
+void* operator new(unsigned size, myos::MemoryTag tag) throw();
+void* operator new[](unsigned size, myos::MemoryTag tag) throw();
+
 // placement new operator
 // when you want to call a constructor explicitly on REM
 // that you have already allocated in any way
@@ -43,6 +204,7 @@ void* operator new[](unsigned size, void* ptr);
 
 void operator delete(void* ptr);
 void operator delete[](void* ptr);
+void operator delete(void* ptr, unsigned size);
+void operator delete[](void* ptr, unsigned size);
 
 #endif
-
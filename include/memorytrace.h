@@ -0,0 +1,92 @@
+
+#ifndef __MYOS__MEMORYTRACE_H
+#define __MYOS__MEMORYTRACE_H
+
+#include <common/types.h>
+#include <drivers/serial.h>
+#include <clock.h>
+
+// The MemoryTrace records every malloc and free of a MemoryManager into a ring
+// in memory, and Flush sends the records that are new since the last Flush
+// over the serial port. On the host tools/allocreplay reads the captured
+// stream and replays it against different allocator policies.
+//
+// Recording is cheap (rdtsc and a few stores), sending is slow, so Flush is
+// called from the main loop and not from malloc. If malloc is faster than the
+// serial port the oldest records are overwritten, the sequence numbers in the
+// stream show the gap.
+//
+//   head                      records that are in the ring
+//   tail                      the next record that Flush sends
+//   head - tail > RingSize    records were lost
+
+namespace myos {
+
+  enum MemoryTraceOperation {
+    MemoryTraceMalloc,
+    MemoryTraceMallocAligned,
+    MemoryTraceFree
+  };
+
+  // 32 bytes on the wire, little endian like in memory
+  struct MemoryTraceRecord {
+    common::uint16_t magic;     // MemoryTrace::Magic, to find the start of a record in the stream
+    common::uint8_t operation;  // MemoryTraceOperation
+    common::uint8_t tag;        // MemoryTag of the allocation
+    common::uint32_t sequence;
+    common::uint32_t size;      // requested size, for free the size of the chunk
+    common::uint32_t align;     // for malloc_aligned, otherwise 0
+    common::uint32_t address;   // the returned pointer (0 if malloc failed) or the freed pointer
+    common::uint32_t caller;    // return address of malloc / free
+    common::uint64_t timestamp; // rdtsc
+  } __attribute__((packed));
+
+  class MemoryTrace {
+    public:
+      // a power of two, then sequence % RingSize is just a mask
+      static const common::uint32_t RingSize = 4096;
+      static const common::uint16_t Magic = 0x544D; // "MT"
+
+    protected:
+      MemoryTraceRecord* ring;
+
+      // sequence numbers, they only grow
+      volatile common::uint32_t head;
+      common::uint32_t tail;
+
+      common::uint32_t dropped;
+
+    public:
+      MemoryTrace();
+      ~MemoryTrace();
+
+      // this is inline, so everything that links memorymanagement.o
+      // doesn't need the serial driver as well
+      void Record(MemoryTraceOperation operation, common::uint8_t tag,
+          common::size_t size, common::size_t align, void* address, void* caller) {
+        // an interrupt handler can malloc in the middle of a malloc
+        // so we take our slot with one atomic instruction
+        common::uint32_t sequence = __sync_fetch_and_add(&head, 1);
+        MemoryTraceRecord* record = &ring[sequence & (RingSize - 1)];
+
+        record->magic = Magic;
+        record->operation = operation;
+        record->tag = tag;
+        record->sequence = sequence;
+        record->size = size;
+        record->align = align;
+        record->address = (common::uint32_t)address;
+        record->caller = (common::uint32_t)caller;
+        record->timestamp = rdtsc();
+      }
+
+      // send the new records, returns how many
+      common::uint32_t Flush(drivers::SerialPort* serial);
+
+      // records that were overwritten before Flush could send them
+      common::uint32_t Dropped();
+  };
+
+}
+
+#endif
@@ -0,0 +1,54 @@
+
+#ifndef __MYOS__MULTIBOOT_H
+#define __MYOS__MULTIBOOT_H
+
+#include <common/types.h>
+
+// The boot loader (grub) leaves a pointer to this structure in ebx
+// and loader.s passes it on to kernelMain
+//
+// https://www.gnu.org/software/grub/manual/multiboot/multiboot.html
+//
+// The flags say which of the fields are valid:
+//   bit 0: memLower and memUpper
+//   bit 6: mmapLength and mmapAddress
+
+namespace myos {
+
+  struct MultibootInformation {
+    common::uint32_t flags;
+
+    // KiB of memory below 1 MiB and above 1 MiB (up to the first hole)
+    common::uint32_t memLower;
+    common::uint32_t memUpper;
+
+    common::uint32_t bootDevice;
+    common::uint32_t commandLine;
+    common::uint32_t modsCount;
+    common::uint32_t modsAddress;
+    common::uint32_t syms[4];
+
+    // the memory map, a list of MultibootMemoryMapEntry
+    common::uint32_t mmapLength;
+    common::uint32_t mmapAddress;
+  } __attribute__((packed));
+
+  // one entry of the memory map
+  //
+  // size is the size of the entry without the size field itself
+  // so the next entry is at (uint8_t*)entry + entry->size + 4
+  struct MultibootMemoryMapEntry {
+    common::uint32_t size;
+    common::uint64_t baseAddress;
+    common::uint64_t length;
+    common::uint32_t type; // 1: available RAM, everything else is reserved
+  } __attribute__((packed));
+
+  const common::uint32_t MultibootFlagMemory = 1 << 0;
+  const common::uint32_t MultibootFlagMemoryMap = 1 << 6;
+
+  const common::uint32_t MultibootMemoryAvailable = 1;
+
+}
+
+#endif
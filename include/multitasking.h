@@ -3,9 +3,17 @@
 
 #include <common/types.h>
 #include <gdt.h>
+#include <cpu.h>
+#include <timerwheel.h>
 
 namespace myos {
 
+  namespace drivers {
+    class ProgrammableIntervalTimer;
+  }
+
+  class FloatingPointUnit;
+
   struct CPUState {
     common::uint32_t eax; // accumulator register
     common::uint32_t ebx; // base register
@@ -22,6 +30,9 @@ namespace myos {
     // common::uint32_t es;
     // common::uint32_t ds;
 
+    // the number of the interrupt, the stubs push it (see interruptstubs.s)
+    common::uint32_t interrupt;
+
     // one integer for an error code
     // go into what that is for
     common::uint32_t error; // error code
@@ -35,13 +46,132 @@ namespace myos {
     common::uint32_t ss; // stack segment
   } __attribute__((packed));
 
+  // priority 0 is the most important one and runs first,
+  // the larger the number the longer a task has to wait for the processor
+  const common::uint8_t NumTaskPriorities = 32;
+
+  const common::uint8_t TaskPrioritySoftInterrupt = 1; // the tasklets, the rest of the interrupt handlers (see workqueue.h)
+  const common::uint8_t TaskPriorityTimer         = 2; // the callbacks of the TimerWheel
+  const common::uint8_t TaskPriorityInput         = 4; // keyboard, mouse
+  const common::uint8_t TaskPriorityNetwork       = 8;
+  const common::uint8_t TaskPriorityNormal        = 16;
+  const common::uint8_t TaskPriorityBatch         = 24; // long computations that nobody waits for
+  const common::uint8_t TaskPriorityIdle          = NumTaskPriorities - 1;
+
+  // a task is in exactly one of these states
+  //   TaskRunnable  running or in the run queue of its priority
+  //   TaskBlocked   in a WaitQueue until somebody wakes it up (or its timeout is over)
+  //   TaskSleeping  not in any list, only its timer in the TimerWheel wakes it up
+  //   TaskExited    its function has returned or it called Exit, it waits for
+  //                 Join (or the reaper if it is detached) to free it
+  enum TaskState {
+    TaskRunnable,
+    TaskBlocked,
+    TaskSleeping,
+    TaskExited
+  };
+
+  class Task;
+
+  // what a task has used of the processor, see TaskManager::GetTaskStatistics
+  struct TaskStatistics {
+    common::uint64_t runNanoseconds;     // on a processor, up to its last switch
+    common::uint32_t switches;           // how often it got a processor
+    common::uint32_t wakeups;            // how often it became ready (Wake, or added)
+    common::uint64_t maxWakeNanoseconds; // the longest time from ready to running
+  };
+
+  // How long the tasks wait from ready (Wake, or AddTask) until they run.
+  // Bucket i counts the waits with 2^i <= nanoseconds < 2^(i+1), the first
+  // bucket also has the shorter ones and the last one also the longer ones:
+  //
+  //   >= 0x00000400 ns (1 us)    ###
+  //   >= 0x00000800 ns           ##########
+  //   >= 0x00001000 ns           #####
+  //   ...
+  //   >= 0x00800000 ns (8 ms)    #        <- somebody had to wait for a tick
+  //
+  // so one bucket is one bsr, and a regression shows up as a shift to the right
+  struct LatencyHistogram {
+    static const common::uint32_t NumBuckets = 32;
+
+    common::uint32_t buckets[NumBuckets];
+    common::uint32_t count;
+    common::uint64_t totalNanoseconds;
+    common::uint64_t maxNanoseconds;
+  };
+
+  // all of them, and one for every priority
+  struct SchedulerStatistics {
+    LatencyHistogram wakeLatency;
+    LatencyHistogram priorityWakeLatency[NumTaskPriorities];
+  };
+
+  // A WaitQueue is a list of tasks that wait for the same thing, like the
+  // answer to an ARP request or a hard drive that is done. Instead of asking
+  // again and again in a loop, the task blocks and the scheduler doesn't give
+  // it any time until the interrupt handler calls Wake.
+  //
+  // Between checking the condition and Wait an interrupt could come and do the
+  // Wake, then we would wait for something that has already happened. So the
+  // check and the Wait must run with the interrupts off:
+  //
+  //   uint32_t eflags = SaveInterrupts();
+  //   while (!condition) {
+  //     if (!queue.Wait(timeout)) { ... }
+  //   }
+  //   RestoreInterrupts(eflags);
+  //
+  // Wait gives no guarantee that the condition is true afterwards, so it is
+  // always checked in a loop.
+  class WaitQueue {
+    friend class TaskManager;
+
+    protected:
+      Task* head;
+      Task* tail;
+
+      // counts the Wake calls, for the kernelMain loop which is no task
+      // and can't be put into the queue
+      volatile common::uint32_t wakeups;
+
+      void Append(Task* task);
+      void Remove(Task* task);
+
+    public:
+      static const common::uint32_t WaitForever = 0;
+
+      WaitQueue();
+      ~WaitQueue();
+
+      // false if the timeout (in milliseconds) was over before a Wake,
+      // or if we can't wait at all because we are in an interrupt handler
+      // (or a non blocking task) or the interrupts are not activated yet
+      bool Wait(common::uint32_t timeoutMilliseconds = WaitForever);
+
+      // interrupt handlers can wake up tasks
+      void WakeOne();
+      void WakeAll();
+  };
+
   class Task {
     // the TaskManager might have to work inside the values of the Task
     // so make TaskManager a friend
     friend class TaskManager;
+    friend class WaitQueue;
+    friend class FloatingPointUnit;
+
+    public:
+      // 4 KiB, enough for a task that doesn't put big arrays on its stack
+      static const common::uint32_t DefaultStackSize = 4096;
 
     private:
-      common::uint8_t stack[4096]; // 4 KiB
+      // from the StackPool, it goes back there when the task is gone
+      common::uint8_t* stack;
+      common::uint32_t stackSize;
+
+      // the TaskManager gives every task an ID when it is added, see FindTask
+      common::uint32_t id;
 
       // I will have a pointer to the head after to the top element of the task stack
       // but I would put a data structure over the task stack areas
@@ -52,46 +182,361 @@ namespace myos {
       // because the data that you find there is the state of the CPU
       CPUState* cpustate;
 
+      common::uint8_t priority;
+
+      // the processor whose run queue it is in, or that runs it
+      common::uint8_t cpu;
+
+      // timer ticks left until the next task with the same priority gets its turn
+      common::uint32_t timeslice;
+
+      TaskStatistics statistics;
+      // now_ns when it became ready (0 while it doesn't wait for a processor after
+      // a wake up) and when it got the processor that it runs on
+      common::uint64_t readySince;
+      common::uint64_t runningSince;
+
+      TaskState state;
+
+      // the run queue of the priority or the WaitQueue is a list through the tasks
+      Task* next;
+      WaitQueue* waitQueue;
+
+      // wakes up a sleeping task, or a blocked one whose timeout is over
+      Timer wakeTimer;
+      bool timedOut;
+
+      // the FPU and SSE registers while another task has them,
+      // fxsave wants them at a multiple of 16 (see FloatingPointUnit)
+      common::uint8_t fpuArea[512 + 16];
+      bool fpuUsed;
+
+      int exitCode;
+      // Join waits here until the task has exited
+      WaitQueue exited;
+      bool joining;
+      // nobody joins, the TaskManager frees it by itself after it has exited
+      bool detached;
+      // Spawn made it with new, so the TaskManager deletes it
+      bool spawned;
+      // WaitQueue::Wait doesn't block it, like in an interrupt handler
+      bool nonBlocking;
+
+      void Setup(GlobalDescriptorTable* gdt, common::uint32_t entrypoint, void* argument,
+                 common::uint8_t priority, common::uint32_t stackSize);
+
     public:
       // in the constructor the task will have to talk to the GlobalDescriptorTable
       // and it needs a function pointer to the function that is supposed to be executed
-      Task(GlobalDescriptorTable* gdt, void entrypoint());
+      //
+      // when the function returns the task exits (with exit code 0)
+      Task(GlobalDescriptorTable* gdt, void entrypoint(), common::uint8_t priority = TaskPriorityNormal,
+           common::uint32_t stackSize = DefaultStackSize);
+      // the same, but the function gets the argument
+      Task(GlobalDescriptorTable* gdt, void entrypoint(void*), void* argument,
+           common::uint8_t priority = TaskPriorityNormal, common::uint32_t stackSize = DefaultStackSize);
       ~Task();
 
+      common::uint32_t Id();
+      common::uint8_t Priority();
+      TaskState State();
+      // the stack really has this size, 0 if there was no stack left for the task
+      common::uint32_t StackSize();
+
+      // for a task that others wait for, like the worker of the tasklets: if it
+      // waited for something that only it can do (an ARP answer that it has to
+      // receive itself) it would wait forever, so Wait returns false right away
+      void SetNonBlocking(bool nonBlocking);
+  };
+
+  // the part of the scheduler that every processor has for itself
+  // (the task that runs on the processor is CPU::currentTask, one load relative to GS)
+  struct RunQueue {
+    // the CPUState of the idle loop (kernelMain on the first processor), while a task runs
+    CPUState* idle;
+
+    Task* head[NumTaskPriorities];
+    Task* tail[NumTaskPriorities];
+    common::uint32_t readyBitmap;
 
+    // the tasks in all the queues, for the work stealing
+    common::uint32_t numReady;
 
+    // the local APIC timer of an application processor is in a one shot, see Idle
+    bool timerOneShot;
   };
 
+  // Every priority has its own run queue of the tasks that are ready to run,
+  // and bit n of readyBitmap is set if the queue of priority n is not empty:
+  //
+  //   readyBitmap  0 0 0 0 1 0 0 0 1 ...
+  //                        |       |
+  //   priority 4:  [mouse] |       |
+  //   priority 8:  [eth0] -> [arp] |
+  //   priority 16:  ...
+  //
+  // so the most important task that is ready is the head of the queue of the
+  // lowest bit that is set, which is one bsf instruction no matter how many
+  // tasks there are. Inside of one priority the tasks take turns (round-robin),
+  // every one for the timeslice of its priority.
+  //
+  // The running task is not in a run queue. If no task is ready, we go back
+  // to where we were before the first task started: the main loop of kernelMain.
+  // That is our idle task, it does the work that can wait and then calls Idle,
+  // which halts the processor until the next interrupt.
+  //
+  // In tickless mode Idle also stops the periodic timer interrupt. Nobody
+  // needs the processor before the next timer of the TimerWheel, so the timer
+  // only fires once at that time (or as late as it can) instead of every tick:
+  //
+  //   periodic:  |  |  |  |  |  |  |  |  |  |    an interrupt every tick
+  //   tickless:  |              |                one interrupt, counts 5 ticks
+  //              ^ Idle         ^ next wake up
+  //
+  // When the processor leaves Idle (the one shot is over or another interrupt
+  // made a task ready) we count the ticks that have passed and go back to periodic.
+  //
+  // With more than one processor (see smp.h) every processor has its own
+  // RunQueue, so it only has to look at its own queues to find the next task,
+  // and a task stays on the processor whose caches know it. The ticks, the
+  // TimerWheel and the tickless mode stay with the first processor (the PIT
+  // only interrupts that one), the others get their ticks from the timer of
+  // their local APIC. In tickless mode an idle one switches that timer to a
+  // one shot of ApplicationProcessorIdleTicks, a reschedule IPI wakes it up
+  // earlier, and Schedule or Preempt make it periodic again. Two things keep
+  // the processors busy:
+  //
+  //   wake up   a task that becomes ready goes to its processor, or if that
+  //             one is busy to one that runs its idle loop, and a reschedule
+  //             IPI tells the other processor about it
+  //   steal     a processor that has nothing left in its own queues takes the
+  //             most important task of the processor with the most ready tasks
+  //
+  // Everything in here runs with the interrupts off, so the KernelLock
+  // (see interrupts.h) protects the run queues of all processors.
   class TaskManager {
+    friend class WaitQueue;
+
+    public:
+      static const int MaxTasks = 256;
+
+      // the PIT runs at 1193182 Hz / 65536 = 18.2 Hz if nobody programs it,
+      // that is 54925 microseconds per timer interrupt
+      static const common::uint32_t DefaultTickMicroseconds = 54925;
+
     private:
       // the TaskManager will basically have an array of these tasks
-      Task* tasks[256];
+      // a slot is 0 again when its task is gone
+      Task* tasks[MaxTasks];
 
       // the number of tasks in this array
       int numTasks;
 
-      // and the index of the currently active task
-      //
-      // we push this ESP and the pointer to the task stack is overwritten after the handle interrupt is finished
-      // so we need to store that somewhere because otherwise we couldn't go back to executing that task ever
-      int currentTask;
+      RunQueue runQueues[CPU::MaxCPUs];
+
+      // in timer ticks
+      common::uint32_t timeslices[NumTaskPriorities];
+
+      // timer interrupts since the start
+      volatile common::uint64_t ticks;
+      common::uint32_t tickMicroseconds;
+
+      // the timeouts of the tasks and everybody else who needs a timer
+      TimerWheel timers;
+      // the timer task waits here for expired timers
+      WaitQueue timerWork;
+
+      drivers::ProgrammableIntervalTimer* timer;
+      bool tickless;
+      // the timer is in a one shot of this many ticks, or 0
+      common::uint32_t idleTicks;
+
+      // an idle application processor still looks for work to steal this often
+      static const common::uint32_t ApplicationProcessorIdleTicks = 100;
+
+      FloatingPointUnit* fpu;
+
+      // for the code segment of the tasks from Spawn
+      GlobalDescriptorTable* gdt;
+
+      // the part of the next task ID above the slot in tasks
+      common::uint32_t nextId;
+
+      SchedulerStatistics statistics;
+
+      // detached tasks that have exited, ReapZombies frees them
+      Task* zombies;
+
+    protected:
+      // the RunQueue of the processor that we run on
+      RunQueue* Local();
+
+      // at the end of the run queue of its priority (on its processor), or at the
+      // front if it was interrupted by a more important task and still has time left
+      void Enqueue(Task* task, bool front = false);
+      // the most important ready task, out of its run queue, or 0
+      Task* Dequeue(RunQueue* queue);
+
+      // a task of the processor with the most ready tasks for this one, or 0
+      Task* Steal(RunQueue* queue);
+      // is there anything for this processor, in its own queues or to steal
+      bool HasWork(RunQueue* queue);
+
+      // the task is ready: into the run queue of a processor that has time for it
+      void Ready(Task* task);
+      // tell the other processor that there is something new in its run queue
+      void Reschedule(common::uint32_t cpu);
+
+      // the next task to run, or the idle loop if there is none
+      CPUState* Switch(RunQueue* queue);
+      // the run time of the task that leaves the processor and the wait of the one that gets it
+      void Account(Task* previous, Task* next);
+      static void CountLatency(LatencyHistogram* histogram, common::uint64_t nanoseconds);
+      static void PrintHistogram(LatencyHistogram* histogram);
+
+      // the first processor might be in a long one shot, then a timer that
+      // another processor has added must wake it up
+      void TimerAdded();
+
+      // wake up the task after this many ticks
+      void AddSleeper(Task* task, common::uint32_t ticks);
+      void RemoveSleeper(Task* task);
+      // the callback of the wakeTimer of a task
+      static void WakeTimeout(void* task);
+
+      // make a blocked or sleeping task ready to run again
+      void Wake(Task* task);
+
+      // the TimerWheel counts the ticks up to now, and the timer task
+      // wakes up if there is something for it to do
+      void AdvanceTimers();
+
+      // count the ticks of a one shot and go back to periodic
+      void LeaveTickless(bool timerInterrupt);
+      // the same for the local APIC timer of an application processor
+      void LeaveLocalTickless(RunQueue* queue);
+
+      // the current task leaves the processor until Wake,
+      // with the interrupts already off
+      bool Block(WaitQueue* queue, common::uint32_t timeoutMilliseconds);
+
+      // the task has exited, out of tasks and its stack back to the StackPool
+      void Reap(Task* task);
 
     public:
-      TaskManager();
+      static TaskManager* activeTaskManager;
+
+      TaskManager(GlobalDescriptorTable* gdt = 0);
       ~TaskManager();
 
+      // the task gets an ID and is ready to run, false if it has no stack
+      // or all MaxTasks slots are taken
       bool AddTask(Task* task);
 
+      // Task IDs: the slot in tasks in the low 8 bits, and a number that
+      // counts up above it. So FindTask is one look into the array, and the
+      // ID of a task that is gone doesn't find the next task in its slot.
+      //
+      //   uint32_t id = taskManager->Spawn(worker, &job);
+      //   ...
+      //   int code;
+      //   taskManager->Join(id, &code);
+      //
+      // a new task with its own stack from the StackPool, its ID or 0
+      common::uint32_t Spawn(void entrypoint(void*), void* argument = 0,
+                             common::uint8_t priority = TaskPriorityNormal,
+                             common::uint32_t stackSize = Task::DefaultStackSize);
+
+      // the current task is done, this doesn't return
+      // (returning from the function of the task is the same as Exit(0))
+      void Exit(int exitCode);
+
+      // wait until the task has exited and free it, false if there is no
+      // such task, it is detached or somebody else joins it already
+      bool Join(common::uint32_t id, int* exitCode = 0);
+
+      // nobody will Join the task, it is freed right after it has exited
+      bool Detach(common::uint32_t id);
+
+      // 0 if there is no task with this ID (anymore)
+      Task* FindTask(common::uint32_t id);
+      int NumTasks();
+
+      // free the detached tasks that have exited, a task can't do that itself
+      // because it still runs on its stack, Spawn and the idle loop call this
+      void ReapZombies();
+
+      // the task on this processor, 0 while its idle loop (kernelMain) runs
+      Task* CurrentTask();
+
+      // Every task switch reads the clock (now_ns, the TSC) once, so we know
+      // which task uses the processor and how long the ready tasks wait for it.
+      // The run time of a task is only added when it leaves the processor.
+      //
+      // false if there is no task with this ID
+      bool GetTaskStatistics(common::uint32_t id, TaskStatistics* taskStatistics);
+      void GetSchedulerStatistics(SchedulerStatistics* schedulerStatistics);
+      // the tasks, the histograms that have something in them and the processors
+      void PrintStatistics();
+
+      // the current task gives the processor to the next one
+      void Yield();
+
+      // the current task doesn't run for at least this long
+      void Sleep(common::uint32_t milliseconds);
+
+      // the idle task (kernelMain, or the idle loop of another processor)
+      // has nothing to do, halt until the next interrupt
+      void Idle();
+
+      TimerWheel* Timers();
+      // the timer expires after this many milliseconds, see add_timer
+      void AddTimer(Timer* timer, common::uint32_t milliseconds);
+
+      // the timer task: calls the callbacks of the expired timers, forever
+      // (they can't run in the timer interrupt, see TimerWheel)
+      void RunTimers();
+
+      common::uint64_t Ticks();
+      // rounded up, but at least one tick
+      common::uint32_t MillisecondsToTicks(common::uint32_t milliseconds);
+      void SetTickMicroseconds(common::uint32_t microseconds);
+      common::uint32_t TickMicroseconds();
+
+      // the timer that drives Schedule, we take its tick length
+      // and we need it to reprogram it for tickless mode
+      void SetTimer(drivers::ProgrammableIntervalTimer* timer);
+      void SetTickless(bool tickless);
+
+      // every task switch tells the FPU, so it can switch its registers lazily
+      void SetFloatingPointUnit(FloatingPointUnit* fpu);
+
+      // a short timeslice for the tasks that must react fast,
+      // a long one for batch work so it isn't switched away all the time
+      void SetTimeslice(common::uint8_t priority, common::uint32_t ticks);
+      common::uint32_t Timeslice(common::uint8_t priority);
+
       // Here we will have a method which does the scheduling
-      // we will just use round-robin scheduling
-      // so just have a linear array of task pointers
-      // and then every time one task is executing
-      // and we go into this timer interrupt
-      // and we will go to the next task... and start over at the beginning
+      // on every timer interrupt the current task uses up one tick of its timeslice
+      // and we switch to another task if the timeslice is over
+      // or if a task with a more important priority is ready
       CPUState* Schedule(CPUState* cpustate);
 
+      // the yield interrupt: the current task is done for now (or blocked)
+      CPUState* Yield(CPUState* cpustate);
+
+      // after the other hardware interrupts: only switch if an interrupt
+      // handler has woken up a task that is more important than the current one
+      CPUState* Preempt(CPUState* cpustate);
   };
 
+  // TaskManager::activeTaskManager->Sleep, for everyone who doesn't know the TaskManager
+  void sleep(common::uint32_t milliseconds);
+
+  // the timer expires after this many milliseconds, its callback runs in the
+  // timer task, false if there is no TaskManager
+  bool add_timer(Timer* timer, common::uint32_t milliseconds);
+
 }
 
 #endif
@@ -3,6 +3,8 @@
 
 #include <common/types.h>
 #include <net/etherframe.h>
+#include <multitasking.h>
+#include <coroutine.h>
 
 namespace myos {
 
@@ -25,12 +27,33 @@ namespace myos {
     } __attribute__((packed));
 
     class AddressResolutionProtocol : public EtherFrameHandler {
+      friend class ResolveRequest;
+
       private:
 
         common::uint32_t IPcache[128];
         common::uint64_t MACcache[128];
+        // minutes since the last answer for the entry
+        common::uint8_t cacheAge[128];
         int numCacheEntries;
 
+        // Another machine can get the IP address and then we would send
+        // to the wrong MAC forever, so the entries expire and Resolve asks again.
+        // Every minute the timer makes all entries one minute older.
+        Timer ageTimer;
+        static const common::uint32_t AgeInterval = 60000; // ms
+        static const common::uint8_t MaxCacheAge = 20; // minutes
+
+        static void Age(void* arp);
+
+        // the tasks in Resolve that wait for an answer
+        WaitQueue resolved;
+        // and the ResolveRequests
+        CoroutineEvent answered;
+
+        static const int ResolveAttempts = 3;
+        static const common::uint32_t ResolveTimeout = 1000; // ms
+
       public:
         AddressResolutionProtocol(EtherFrameProvider* backend);
         ~AddressResolutionProtocol();
@@ -50,6 +73,32 @@ namespace myos {
         common::uint64_t Resolve(common::uint32_t IP_BE);
     };
 
+    // The same as Resolve, without a task that waits: a coroutine (see
+    // coroutine.h) of less than 100 bytes, so there can be many of them
+    // in flight at the same time.
+    //
+    //   ResolveRequest* request = new ResolveRequest(&arp, ip_be);
+    //   coroutine_start(request);
+    //   ...
+    //   CO_WAIT_UNTIL(request->Finished(), request->Done(), Coroutine::WaitForever);
+    //   request->MACAddress();
+    class ResolveRequest : public Coroutine {
+      protected:
+        AddressResolutionProtocol* arp;
+        common::uint32_t IP_BE;
+        common::uint64_t MAC;
+        int attempt;
+
+        CoroutineStatus Resume();
+
+      public:
+        ResolveRequest(AddressResolutionProtocol* arp, common::uint32_t IP_BE);
+        ~ResolveRequest();
+
+        // 0xFFFFFFFFFFFF until the answer is there, and if nobody answers
+        common::uint64_t MACAddress();
+    };
+
   }
 
 }
@@ -66,6 +66,8 @@
 #include <common/types.h>
 #include <drivers/amd_am79c973.h>
 #include <memorymanagement.h>
+#include <arena.h>
+#include <synchronization.h>
 
 namespace myos {
 
@@ -108,6 +110,13 @@ namespace myos {
       protected:
         EtherFrameHandler* handlers[65535];
 
+        // the frames that we send only live until backend->Send has copied them,
+        // one frame (2048 bytes like a buffer of the card) at a time
+        Arena sendArena;
+        // the tasks and the receive tasklet (on this or another processor) send
+        // at the same time, so only the holder of the lock uses the sendArena
+        Spinlock sendLock;
+
       public:
         EtherFrameProvider(drivers::amd_am79c973* backend);
         ~EtherFrameProvider();
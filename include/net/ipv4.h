@@ -2,6 +2,7 @@
 #define __MYOS__NET__IPV4_H
 
 #include <common/types.h>
+#include <arena.h>
 #include <net/etherframe.h>
 #include <net/arp.h>
 
@@ -60,6 +61,10 @@ namespace myos {
         common::uint32_t gatewayIP;
         common::uint32_t subnetMask;
 
+        // scratch memory for the messages of Send, see EtherFrameProvider::sendArena
+        Arena sendArena;
+        Spinlock sendLock;
+
       public:
         // arp for get MAC address
         InternetProtocolProvider(EtherFrameProvider* backend, 
@@ -0,0 +1,113 @@
+
+#ifndef __MYOS__PAGING_H
+#define __MYOS__PAGING_H
+
+#include <common/types.h>
+#include <physicalmemory.h>
+#include <hardwarecommunication/interrupts.h>
+
+// https://wiki.osdev.org/Paging
+//
+// With paging enabled every address the processor sees is a virtual address
+// and it is translated through two levels of tables:
+//
+//   31          22 21          12 11            0
+//  +--------------+--------------+---------------+
+//  |  directory   |    table     |    offset     |
+//  +--------------+--------------+---------------+
+//         |              |
+//         |              +--> page table entry --> 4 KiB frame
+//         +--> page directory entry (PDE)
+//
+// A PDE can also map a 4 MiB page directly if the PS bit is set and
+// CR4.PSE is on (page size extension). One TLB entry then covers 4 MiB
+// instead of 4 KiB, so this is what we use for the kernel.
+//
+// The virtual address space looks like this:
+//
+//   0x00000000 +------------------------------+
+//              |  kernel image and all of the |  4 MiB pages, virtual == physical
+//              |  RAM we manage (direct map)  |
+//   0x40000000 +------------------------------+
+//              |  user space                  |  4 KiB pages, filled on demand
+//   0xC0000000 +------------------------------+
+//              |  memory mapped IO            |
+//   0xFFFFFFFF +------------------------------+
+//
+// The kernel stays where grub loaded it and the direct map is an identity
+// map, because the drivers give their pointers straight to the hardware
+// (the am79c973 reads its descriptor rings with DMA) and printf writes to
+// 0xb8000, so for them the virtual address must be the physical address.
+
+namespace myos {
+
+  const common::uint32_t PagePresent      = 1 << 0;
+  const common::uint32_t PageWritable     = 1 << 1;
+  const common::uint32_t PageUser         = 1 << 2;
+  const common::uint32_t PageWriteThrough = 1 << 3;
+  const common::uint32_t PageCacheDisable = 1 << 4;
+  const common::uint32_t PageAccessed     = 1 << 5;
+  const common::uint32_t PageDirty        = 1 << 6;
+  const common::uint32_t PageLarge        = 1 << 7; // PS bit in a PDE: 4 MiB page
+  const common::uint32_t PageGlobal       = 1 << 8; // not flushed from the TLB on a CR3 write
+
+  class PageTableManager {
+    public:
+      static const common::size_t PageSize = 4096;
+      static const common::size_t LargePageSize = 4 * 1024 * 1024;
+
+      static const common::uint32_t UserSpaceStart = 0x40000000;
+      static const common::uint32_t UserSpaceEnd   = 0xC0000000;
+
+    protected:
+      PhysicalMemoryManager* frames;
+
+      // 1024 entries of 4 bytes, exactly one frame
+      common::uint32_t* pageDirectory;
+
+      // does the processor support 4 MiB pages and global pages
+      bool largePages;
+      bool globalPages;
+
+      common::uint32_t* PageTable(common::uint32_t virtualAddress, bool create);
+      static void Invalidate(common::uint32_t virtualAddress);
+
+    public:
+      static PageTableManager* activePageTableManager;
+
+      PageTableManager(PhysicalMemoryManager* frames);
+      ~PageTableManager();
+
+      // load the page directory into CR3 and switch paging on
+      void Activate();
+
+      bool MapPage(common::uint32_t virtualAddress, common::uint32_t physicalAddress, common::uint32_t flags);
+      bool MapLargePage(common::uint32_t virtualAddress, common::uint32_t physicalAddress, common::uint32_t flags);
+
+      // returns the physical address that was mapped there, or 0
+      common::uint32_t UnmapPage(common::uint32_t virtualAddress);
+
+      // the physical address behind a virtual address, or 0 if it is not mapped
+      common::uint32_t Translate(common::uint32_t virtualAddress);
+
+      // map device memory (framebuffer, APIC, ...) with the caching disabled
+      void MapMemoryMappedIO(common::uint32_t physicalAddress, common::size_t size);
+
+      // a fault on a page that is not present in user space gets a fresh zeroed frame
+      bool HandleDemandFault(common::uint32_t virtualAddress);
+  };
+
+  class PageFaultHandler : public hardwarecommunication::InterruptHandler {
+    protected:
+      PageTableManager* pageTableManager;
+
+    public:
+      PageFaultHandler(hardwarecommunication::InterruptManager* interruptManager, PageTableManager* pageTableManager);
+      ~PageFaultHandler();
+
+      virtual common::uint32_t HandleInterrupt(common::uint32_t esp);
+  };
+
+}
+
+#endif
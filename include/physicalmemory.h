@@ -0,0 +1,100 @@
+
+#ifndef __MYOS__PHYSICALMEMORY_H
+#define __MYOS__PHYSICALMEMORY_H
+
+#include <common/types.h>
+#include <multiboot.h>
+
+// The PhysicalMemoryManager hands out physical memory in frames of 4 KiB.
+//
+// It is a buddy system: every free block is 2^order frames large and
+// naturally aligned to its size. If we need a block of order n and the
+// smallest free block has order k > n, we split it in two halves (buddies)
+// again and again until we have a block of order n, and the halves we don't
+// need go into the free lists of their order.
+//
+//   order 2: +---------------+---------------+
+//            |       A       |       B       |   4 frames
+//            +-------+-------+---------------+
+//   order 1: |   A0  |   A1  |                   2 frames each
+//            +---+---+-------+
+//   order 0: |A00|A01|                           1 frame each
+//            +---+---+
+//
+// When a block is freed we look at its buddy (the address with the bit of
+// the order flipped). If the buddy is free too we merge them into a block of
+// the next order and try again. So allocating and freeing both cost O(log n).
+
+namespace myos {
+
+  // the links of a free block are stored inside of the free block itself
+  struct FreeFrameBlock {
+    FreeFrameBlock* next;
+    FreeFrameBlock* prev;
+  };
+
+  class PhysicalMemoryManager {
+    public:
+      static const common::size_t PageSize = 4096;
+
+      // the largest block is 2^10 frames = 4 MiB
+      static const common::uint32_t MaxOrder = 10;
+
+      // we only manage the first GiB of physical memory
+      static const common::uint32_t MaxFrames = (1024*1024*1024) / PageSize;
+
+    protected:
+      FreeFrameBlock* freeLists[MaxOrder + 1];
+
+      // bit n is set if freeLists[n] is not empty
+      common::uint32_t freeBitmap;
+
+      // for every frame: the order of the free block that starts at this frame
+      // or NotFree if no free block starts here
+      static const common::uint8_t NotFree = 0xFF;
+      static common::uint8_t blockOrder[MaxFrames];
+
+      common::uint32_t freeFrames;
+      common::uint32_t totalFrames;
+
+      // the end of the highest frame we manage
+      common::uint32_t highestAddress;
+
+      // ranges inside of available RAM that must not become free frames
+      common::uint32_t reservedStart[4];
+      common::uint32_t reservedEnd[4];
+      common::uint32_t numReserved;
+
+      void Insert(common::uint32_t frame, common::uint32_t order);
+      void Remove(common::uint32_t frame, common::uint32_t order);
+
+      void AddRange(common::uint64_t start, common::uint64_t end);
+
+    public:
+      static PhysicalMemoryManager* activePhysicalMemoryManager;
+
+      PhysicalMemoryManager(MultibootInformation* multiboot);
+      ~PhysicalMemoryManager();
+
+      // a naturally aligned block of 2^order frames, or 0 if there is none
+      void* AllocateFrames(common::uint32_t order);
+      void FreeFrames(void* address, common::uint32_t order);
+
+      // the same, but the whole block ends at or below limit
+      // for devices that can't reach all of the physical memory with DMA
+      void* AllocateFramesBelow(common::uint32_t order, common::uint32_t limit);
+
+      void* AllocateFrame();
+      void FreeFrame(void* address);
+
+      // the smallest order with 2^order frames >= size bytes
+      static common::uint32_t OrderOf(common::size_t size);
+
+      common::uint32_t FreeFrameCount();
+      common::uint32_t TotalFrameCount();
+      common::uint32_t HighestAddress();
+  };
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef __MYOS__RESERVEPOOL_H
+#define __MYOS__RESERVEPOOL_H
+
+#include <common/types.h>
+#include <memorymanagement.h>
+
+// The MemoryManager is not safe to use in an interrupt handler: if the
+// interrupt comes while a task is in the middle of malloc, the handler sees a
+// half changed chunk list. We don't want to switch interrupts off in the heap
+// either, a large free can take a while to coalesce.
+//
+// A ReservePool is a stack of equal sized blocks for interrupt handlers:
+//
+//   interrupt handler          main loop / task
+//   -----------------          ----------------
+//   Allocate()  --- pop --->   +------+------+------+
+//   Free(block) --- push -->   | free | free | free |   <--- Refill() mallocs
+//                              +------+------+------+        up to target
+//
+// Allocate and Free only take the top of the stack with the interrupts off
+// for a few instructions, they never call into the MemoryManager and never
+// wait. If the pool is empty Allocate returns 0 and the handler drops what it
+// wanted to do, like a network card drops a frame when its ring is full.
+//
+// Refill must not be called from an interrupt handler. The main loop calls
+// RefillAll for every pool that was created.
+
+namespace myos {
+
+  class ReservePool {
+    protected:
+      struct ReserveBlock {
+        ReserveBlock* next;
+      };
+
+      ReserveBlock* freeList;
+      volatile common::uint32_t available;
+      volatile common::uint32_t misses;
+
+      common::size_t blockSize;
+      common::uint32_t target;
+      MemoryTag tag;
+
+      // all pools, so the main loop can refill them without knowing them
+      ReservePool* nextPool;
+      static ReservePool* pools;
+
+      void Push(ReserveBlock* block);
+      ReserveBlock* Pop();
+
+    public:
+      ReservePool(common::size_t blockSize, common::uint32_t target, MemoryTag tag = MemoryTagUntagged);
+      ~ReservePool();
+
+      // O(1), 0 if the pool is empty, safe in interrupt handlers
+      void* Allocate();
+      // O(1), only for blocks from this pool, safe in interrupt handlers
+      void Free(void* block);
+
+      // malloc blocks until there are target of them again
+      void Refill();
+      static void RefillAll();
+
+      common::size_t BlockSize();
+      common::uint32_t Available();
+      // how often Allocate found the pool empty
+      common::uint32_t Misses();
+  };
+
+}
+
+#endif
@@ -0,0 +1,226 @@
+
+#ifndef __MYOS__SLABCACHE_H
+#define __MYOS__SLABCACHE_H
+
+#include <common/types.h>
+#include <memorymanagement.h>
+
+// A slab cache hands out objects of one fixed type.
+//
+// Instead of asking the MemoryManager for every single object (which costs a
+// 16 bytes MemoryChunk header per object and splits the heap into lots of
+// little pieces) the cache asks for a whole slab of at least one page and cuts
+// it into equally sized, cache line aligned slots.
+//
+//   +--------+---------------+---------------+---------------+-----
+//   |  Slab  |  object | next |  object | next |  object | next |
+//   +--------+---------------+---------------+---------------+-----
+//   ^        ^               ^
+//  slab   slot 0          slot 1        (every slot starts on a cache line)
+//
+// The link to the next free slot lives behind the object and not inside of it,
+// so if we give the cache a constructor the objects are constructed only once
+// when the slab is created and they stay constructed while they are free.
+// That is the object caching idea of Bonwick's slab allocator.
+
+namespace myos {
+
+  struct Slab {
+    Slab* next;
+    Slab* prev;
+
+    // the first free slot of this slab
+    common::uint8_t* freeList;
+
+    // how many objects are handed out from this slab
+    common::uint32_t inUse;
+  };
+
+  template<class T>
+  class SlabCache {
+    public:
+      static const common::size_t PageSize = 4096;
+      static const common::size_t CacheLineSize = 64;
+
+    protected:
+      // slabs that have at least one free object and slabs that are full
+      Slab* partial;
+      Slab* full;
+
+      // size of one slot including the link to the next free slot
+      common::size_t slotSize;
+      common::size_t slabSize;
+      common::uint32_t objectsPerSlab;
+
+      void (*constructor)(T*);
+      void (*destructor)(T*);
+
+      // the slabs are on the account of this subsystem
+      MemoryTag tag;
+
+      static common::size_t RoundUp(common::size_t value, common::size_t align) {
+        return (value + align - 1) & ~(align - 1);
+      }
+
+      static common::size_t SlabHeaderSize() {
+        return RoundUp(sizeof(Slab), CacheLineSize);
+      }
+
+      common::uint8_t** Link(common::uint8_t* slot) {
+        return (common::uint8_t**)(slot + slotSize - sizeof(common::uint8_t*));
+      }
+
+      common::uint8_t* Slot(Slab* slab, common::uint32_t i) {
+        return (common::uint8_t*)slab + SlabHeaderSize() + i * slotSize;
+      }
+
+      static void Unlink(Slab** list, Slab* slab) {
+        if (slab->prev != 0) {
+          slab->prev->next = slab->next;
+        }
+        else {
+          *list = slab->next;
+        }
+        if (slab->next != 0) {
+          slab->next->prev = slab->prev;
+        }
+      }
+
+      static void Push(Slab** list, Slab* slab) {
+        slab->prev = 0;
+        slab->next = *list;
+        if (*list != 0) {
+          (*list)->prev = slab;
+        }
+        *list = slab;
+      }
+
+      // find the slab that owns the object
+      // the slabs are aligned to their (power of two) size, so that is just cutting off the low bits
+      Slab* Owner(common::uint8_t* object) {
+        return (Slab*)((common::size_t)object & ~(slabSize - 1));
+      }
+
+      Slab* Grow() {
+        if (MemoryManager::activeMemoryManager == 0) {
+          return 0;
+        }
+
+        common::uint8_t* start = (common::uint8_t*)MemoryManager::activeMemoryManager->malloc_aligned(slabSize, slabSize, tag);
+        if (start == 0) {
+          return 0;
+        }
+
+        Slab* slab = (Slab*)start;
+        slab->inUse = 0;
+        slab->freeList = 0;
+
+        // chain all the slots together, the first slot at the head of the list
+        for (common::uint32_t i = objectsPerSlab; i > 0; --i) {
+          common::uint8_t* slot = Slot(slab, i - 1);
+          if (constructor != 0) {
+            constructor((T*)slot);
+          }
+          *Link(slot) = slab->freeList;
+          slab->freeList = slot;
+        }
+
+        Push(&partial, slab);
+        return slab;
+      }
+
+      void Destroy(Slab* slab) {
+        if (destructor != 0) {
+          for (common::uint32_t i = 0; i < objectsPerSlab; i++) {
+            destructor((T*)Slot(slab, i));
+          }
+        }
+
+        MemoryManager::activeMemoryManager->free(slab);
+      }
+
+    public:
+      SlabCache(void (*constructor)(T*) = 0, void (*destructor)(T*) = 0, MemoryTag tag = MemoryTagUntagged) {
+        this->constructor = constructor;
+        this->destructor = destructor;
+        this->tag = tag;
+
+        partial = 0;
+        full = 0;
+
+        slotSize = RoundUp(sizeof(T) + sizeof(common::uint8_t*), CacheLineSize);
+
+        // a slab is at least one page but large objects get a slab which holds one of them
+        // and it is a power of two, then Owner finds the slab of an object in O(1)
+        slabSize = PageSize;
+        while (slabSize < SlabHeaderSize() + slotSize) {
+          slabSize <<= 1;
+        }
+        objectsPerSlab = (slabSize - SlabHeaderSize()) / slotSize;
+      }
+
+      // take a free object (if the cache has a constructor then it is already constructed)
+      T* Allocate() {
+        Slab* slab = partial;
+        if (slab == 0) {
+          slab = Grow();
+          if (slab == 0) {
+            return 0;
+          }
+        }
+
+        common::uint8_t* slot = slab->freeList;
+        slab->freeList = *Link(slot);
+        slab->inUse++;
+
+        // the slab is full now so we don't have to look at it until something is freed again
+        if (slab->freeList == 0) {
+          Unlink(&partial, slab);
+          Push(&full, slab);
+        }
+
+        return (T*)slot;
+      }
+
+      // give the object back to the cache (it is not destructed)
+      void Free(T* object) {
+        if (object == 0) {
+          return;
+        }
+
+        Slab* slab = Owner((common::uint8_t*)object);
+
+        if (slab->freeList == 0) {
+          Unlink(&full, slab);
+          Push(&partial, slab);
+        }
+
+        *Link((common::uint8_t*)object) = slab->freeList;
+        slab->freeList = (common::uint8_t*)object;
+        slab->inUse--;
+      }
+
+      // give the slabs that have no objects in use back to the MemoryManager
+      //
+      // there is no destructor which does that, because the caches are global objects
+      // and we have no atexit to register destructors of global objects with
+      void Shrink() {
+        Slab* slab = partial;
+        while (slab != 0) {
+          Slab* next = slab->next;
+          if (slab->inUse == 0) {
+            Unlink(&partial, slab);
+            Destroy(slab);
+          }
+          slab = next;
+        }
+      }
+
+      common::size_t ObjectSize() {
+        return slotSize;
+      }
+  };
+
+}
+
+#endif
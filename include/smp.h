@@ -0,0 +1,78 @@
+#ifndef __MYOS__SMP_H
+#define __MYOS__SMP_H
+
+#include <common/types.h>
+#include <gdt.h>
+#include <cpu.h>
+#include <paging.h>
+#include <multitasking.h>
+#include <hardwarecommunication/localapic.h>
+
+// https://wiki.osdev.org/Symmetric_Multiprocessing
+//
+// After the reset only the bootstrap processor runs (grub and then kernelMain),
+// the others (application processors) wait for a startup IPI. We find them in
+// the MADT of the ACPI tables, one entry with the local APIC ID for every
+// processor, and wake them up one after the other:
+//
+//   INIT IPI           reset, and wait 10 ms
+//   startup IPI        start in real mode at the trampoline (smpboot.s)
+//   startup IPI        once more, if the first one got lost
+//
+// The trampoline switches to protected mode and paging like the first
+// processor and calls ApplicationProcessorMain on its own stack, which loads
+// the GDT and the IDT, switches on its local APIC and its timer and becomes the
+// idle loop of this processor. From then on the TaskManager gives it tasks from
+// its own run queue, or it takes them from the others (see TaskManager).
+
+namespace myos {
+
+  class ProcessorManager {
+    public:
+      // the trampoline is copied here, the startup IPI needs a page below 1 MiB
+      static const common::uint32_t Trampoline = 0x8000;
+
+      // the stack of the idle loop of the other processors
+      static const common::uint32_t StackSize = 16384;
+
+    protected:
+      TaskManager* taskManager;
+      PageTableManager* pageTableManager;
+      drivers::ProgrammableIntervalTimer* timer;
+      hardwarecommunication::LocalAPIC* localAPIC;
+
+      // from the MADT, the first processor is one of them
+      common::uint32_t localAPICBase;
+      common::uint8_t apicIds[CPU::MaxCPUs];
+      common::uint32_t numFound;
+
+      // every processor loads its own GDT with its CPU and TSS in it, we
+      // allocate them because the others cannot while we hold the KernelLock
+      GlobalDescriptorTable* gdts[CPU::MaxCPUs];
+
+      // make sure an ACPI table is mapped before we read it
+      void MapTable(common::uint32_t address, common::uint32_t size);
+      // looks for the MADT, false if there is none
+      bool FindProcessors();
+
+      // start the processor and wait until it runs
+      bool Start(common::uint32_t index, common::uint8_t apicId);
+
+      // where the trampoline goes, with the index of the processor
+      static void ApplicationProcessorMain(common::uint32_t index);
+
+    public:
+      static ProcessorManager* activeProcessorManager;
+
+      ProcessorManager(TaskManager* taskManager, PageTableManager* pageTableManager,
+                       drivers::ProgrammableIntervalTimer* timer);
+      ~ProcessorManager();
+
+      // start all the other processors, after InterruptManager::Activate
+      // returns how many processors run now (at least this one)
+      common::uint32_t StartAll();
+  };
+
+}
+
+#endif
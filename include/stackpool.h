@@ -0,0 +1,65 @@
+#ifndef __MYOS__STACKPOOL_H
+#define __MYOS__STACKPOOL_H
+
+#include <common/types.h>
+#include <physicalmemory.h>
+
+// Every task needs a stack, and a worker task that only lives for a moment
+// shouldn't have to go to the buddy allocator twice for it. So the stacks
+// of the tasks that are gone are kept in the StackPool, one free list for
+// every size (4, 8, 16, 32 and 64 KiB):
+//
+//   Allocate(8192)   [4K] -> [4K]
+//        |           [8K] -> [8K] -> [8K]      <-- Free(stack, 8192)
+//        +---------- ...
+//
+// A free stack is not used, so the link to the next one is at its bottom.
+// Only if the list of the size is empty we take new frames, and if more than
+// MaxCached stacks of a size are free the others go back to the frames.
+
+namespace myos {
+
+  class StackPool {
+    public:
+      static const common::uint32_t MinStackSize = PhysicalMemoryManager::PageSize;
+      // orders 0 - 4 of the buddy allocator, 4 KiB to 64 KiB
+      static const common::uint32_t NumSizes = 5;
+      static const common::uint32_t MaxStackSize = MinStackSize << (NumSizes - 1);
+      static const common::uint32_t MaxCached = 16;
+
+    protected:
+      PhysicalMemoryManager* frames;
+
+      struct FreeStack {
+        FreeStack* next;
+      };
+
+      FreeStack* freeStacks[NumSizes];
+      common::uint32_t numFree[NumSizes];
+
+      common::uint32_t hits;
+      common::uint32_t misses;
+
+    public:
+      static StackPool* activeStackPool;
+
+      StackPool(PhysicalMemoryManager* frames);
+      ~StackPool();
+
+      // the size is rounded up to the next of the sizes above,
+      // 0 if it is larger than MaxStackSize or there are no frames left
+      void* Allocate(common::uint32_t size);
+      // with the same size as Allocate
+      void Free(void* stack, common::uint32_t size);
+
+      // the size Allocate really gives for this size
+      static common::uint32_t RoundUp(common::uint32_t size);
+
+      // Allocate calls that got a stack from a free list / from the frames
+      common::uint32_t Hits();
+      common::uint32_t Misses();
+  };
+
+}
+
+#endif
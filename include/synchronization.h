@@ -0,0 +1,222 @@
+#ifndef __MYOS__SYNCHRONIZATION_H
+#define __MYOS__SYNCHRONIZATION_H
+
+#include <common/types.h>
+#include <clock.h>
+#include <multitasking.h>
+#include <hardwarecommunication/interrupts.h>
+
+// count how often the locks are taken and how long everybody waits for them,
+// costs two rdtsc for every lock that somebody else has
+// #define LOCKSTATISTICS
+
+// The locks for data that more than one task (or a task and an interrupt
+// handler) works on:
+//
+//   Spinlock       short things, also in interrupt handlers, with the
+//                  interrupts off so nobody switches away while we hold it
+//   Mutex          longer things in tasks, whoever has to wait sleeps
+//   Semaphore      counts something (free buffers, packets in a queue),
+//                  Down waits if there is nothing, Up can come from an interrupt
+//   ReadWriteLock  many readers at the same time or one writer
+//
+// A Mutex, a Semaphore and a ReadWriteLock can't be taken in an interrupt
+// handler (the handler can't sleep), only Semaphore::Up and TryLock can.
+
+namespace myos {
+
+  struct LockStatistics {
+    common::uint32_t acquisitions;
+    // somebody else had it and we had to wait
+    common::uint32_t contentions;
+    // rdtsc cycles of all the waits
+    common::uint64_t waitCycles;
+  };
+
+  // A ticket lock: everyone takes the next number and waits until it is served,
+  // like at the counter of an office, so whoever comes first gets it first
+  //
+  //   next     5   <- the next one who comes gets ticket 5
+  //   serving  3   <- ticket 3 has the lock, 4 is spinning
+  //
+  // With one processor nobody else can hold it while the interrupts are off,
+  // so LockSave never spins there. It is for the other processors, but as
+  // long as SaveInterrupts takes the KernelLock they can't hold it either
+  // (see interrupts.h), and the contentions stay 0. It only says which data
+  // it protects until the KernelLock is gone.
+  //
+  // Everything is inline, so code like the heap can use it without
+  // taking the scheduler into the tools.
+  class Spinlock {
+    protected:
+      volatile common::uint32_t next;
+      volatile common::uint32_t serving;
+
+#ifdef LOCKSTATISTICS
+      LockStatistics statistics;
+#endif
+
+    public:
+      Spinlock() {
+        next = 0;
+        serving = 0;
+#ifdef LOCKSTATISTICS
+        statistics.acquisitions = 0;
+        statistics.contentions = 0;
+        statistics.waitCycles = 0;
+#endif
+      }
+
+      // without switching the interrupts off, only for code that runs
+      // with the interrupts off anyway, like an interrupt handler
+      void Lock() {
+        common::uint32_t ticket = __sync_fetch_and_add(&next, 1);
+#ifdef LOCKSTATISTICS
+        statistics.acquisitions++;
+        if (serving != ticket) {
+          common::uint64_t start = rdtsc();
+          while (serving != ticket) {
+            asm volatile("pause");
+          }
+          statistics.contentions++;
+          statistics.waitCycles += rdtsc() - start;
+        }
+#else
+        while (serving != ticket) {
+          asm volatile("pause");
+        }
+#endif
+      }
+
+      bool TryLock() {
+        common::uint32_t ticket = serving;
+        if (!__sync_bool_compare_and_swap(&next, ticket, ticket + 1)) {
+          return false;
+        }
+#ifdef LOCKSTATISTICS
+        statistics.acquisitions++;
+#endif
+        return true;
+      }
+
+      void Unlock() {
+        // only the holder writes serving, the barrier keeps the writes
+        // to the data in front of it
+        __sync_synchronize();
+        serving = serving + 1;
+      }
+
+      //   uint32_t eflags = lock.LockSave();
+      //   ...
+      //   lock.UnlockRestore(eflags);
+      common::uint32_t LockSave() {
+        common::uint32_t eflags = hardwarecommunication::SaveInterrupts();
+        Lock();
+        return eflags;
+      }
+
+      void UnlockRestore(common::uint32_t eflags) {
+        Unlock();
+        hardwarecommunication::RestoreInterrupts(eflags);
+      }
+
+      bool Locked() {
+        return next != serving;
+      }
+
+      // 0 without LOCKSTATISTICS
+      LockStatistics* Statistics() {
+#ifdef LOCKSTATISTICS
+        return &statistics;
+#else
+        return 0;
+#endif
+      }
+  };
+
+  // Only one task at a time, the others block in the WaitQueue until Unlock.
+  // The task that locks it must unlock it, and it must not lock it twice.
+  class Mutex {
+    protected:
+      volatile bool locked;
+      Task* owner;
+      WaitQueue waiters;
+
+#ifdef LOCKSTATISTICS
+      LockStatistics statistics;
+#endif
+
+    public:
+      Mutex();
+      ~Mutex();
+
+      void Lock();
+      bool TryLock();
+      void Unlock();
+
+      bool Locked();
+      // the task that has it, 0 if nobody or kernelMain
+      Task* Owner();
+
+      LockStatistics* Statistics();
+  };
+
+  class Semaphore {
+    protected:
+      volatile common::uint32_t count;
+      WaitQueue waiters;
+
+#ifdef LOCKSTATISTICS
+      LockStatistics statistics;
+#endif
+
+    public:
+      Semaphore(common::uint32_t count = 0);
+      ~Semaphore();
+
+      // take one, false if the timeout (in milliseconds) was over first
+      bool Down(common::uint32_t timeoutMilliseconds = WaitQueue::WaitForever);
+      bool TryDown();
+      // give one back, also from an interrupt handler
+      void Up();
+
+      common::uint32_t Count();
+
+      LockStatistics* Statistics();
+  };
+
+  // Readers don't change anything, so any number of them can have it at the
+  // same time, but a writer has it alone. As soon as a writer waits, no new
+  // readers get it, otherwise a steady stream of readers would starve it.
+  class ReadWriteLock {
+    protected:
+      volatile common::uint32_t readers;
+      volatile bool writer;
+      volatile common::uint32_t waitingWriters;
+
+      WaitQueue readQueue;
+      WaitQueue writeQueue;
+
+#ifdef LOCKSTATISTICS
+      LockStatistics statistics;
+#endif
+
+    public:
+      ReadWriteLock();
+      ~ReadWriteLock();
+
+      void LockRead();
+      void UnlockRead();
+
+      void LockWrite();
+      void UnlockWrite();
+
+      LockStatistics* Statistics();
+  };
+
+  // one line with the counters, if there are any
+  void PrintLockStatistics(char* name, LockStatistics* statistics);
+
+}
+
+#endif
@@ -100,6 +100,21 @@
 
 namespace myos {
 
+  // our own system calls, above the numbers that we borrowed from linux
+  //
+  // | Name                | eax   | ebx                         | ecx                         |
+  // | ------------------- | ----- | --------------------------- | --------------------------- |
+  // | sys_heap_statistics | 0x100 | MemoryStatistics* (or 0)    | MemoryFragmentation* (or 0) |
+  // | sys_heap_dump       | 0x101 | -                           | -                           |
+  // | sys_clock           | 0x102 | uint64_t* nanoseconds       | -                           |
+  // | sys_task_statistics | 0x103 | task ID (0: the caller)     | TaskStatistics*             |
+  // | sys_sched_dump      | 0x104 | -                           | -                           |
+  const common::uint32_t SyscallHeapStatistics = 0x100;
+  const common::uint32_t SyscallHeapDump       = 0x101;
+  const common::uint32_t SyscallClock          = 0x102;
+  const common::uint32_t SyscallTaskStatistics = 0x103;
+  const common::uint32_t SyscallSchedulerDump  = 0x104;
+
   class SyscallHandler : public hardwarecommunication::InterruptHandler {
 
     public:
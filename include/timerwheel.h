@@ -0,0 +1,117 @@
+#ifndef __MYOS__TIMERWHEEL_H
+#define __MYOS__TIMERWHEEL_H
+
+#include <common/types.h>
+
+// A Timer calls a function after some timer ticks, for timeouts, retries
+// and everything else that has to happen later.
+//
+// The TimerWheel keeps them in 4 levels of 64 slots. A slot is a list of the
+// timers that expire in the same tick (level 0) or in the same 64 ticks
+// (level 1), 64*64 ticks (level 2) and so on:
+//
+//   level 0  [ 0][ 1][ 2] ... [63]   the next 64 ticks, one tick per slot
+//   level 1  [ 0][ 1][ 2] ... [63]   the next 4096 ticks, 64 ticks per slot
+//   level 2  [ 0][ 1][ 2] ... [63]   262144 ticks, 4096 ticks per slot
+//   level 3  [ 0][ 1][ 2] ... [63]   16777216 ticks (46 hours at 100 Hz)
+//
+// Add only computes the slot from the expiry time and puts the timer at the
+// front of its list, and Cancel just takes it out again, both O(1). On every
+// tick we only look at one slot of level 0. Every 64 ticks we take the next
+// slot of level 1 and spread its timers over level 0, every 4096 ticks the
+// same for level 2 into level 1, and so on (cascade).
+//
+// Advance runs in the timer interrupt. It doesn't call the functions of the
+// timers there, because they might want to allocate memory or wait (for
+// example send a packet again), it puts them on the expired list and a task
+// calls them with RunExpired. Only timers with runInInterrupt set are called
+// right away, that is for the TaskManager that wakes up sleeping tasks.
+
+namespace myos {
+
+  class TimerWheel;
+
+  class Timer {
+    friend class TimerWheel;
+
+    protected:
+      TimerWheel* wheel;
+
+      // the list of the slot or the expired list we are in, or 0
+      Timer** list;
+      Timer* next;
+      Timer* prev;
+
+      common::uint64_t expires;
+
+    public:
+      void (*callback)(void* data);
+      void* data;
+
+      // call the callback in the timer interrupt instead of in the timer task,
+      // it must not allocate, wait or take long
+      bool runInInterrupt;
+
+      Timer(void (*callback)(void* data) = 0, void* data = 0);
+      ~Timer();
+
+      // added and not called (or cancelled) yet
+      bool Pending();
+      common::uint64_t Expires();
+  };
+
+  class TimerWheel {
+    public:
+      static const common::uint32_t LevelBits = 6;
+      static const common::uint32_t SlotsPerLevel = 1 << LevelBits;
+      static const common::uint32_t NumLevels = 4;
+
+      // timers further away expire at the end of level 3
+      static const common::uint32_t MaxTicks = (1 << (LevelBits * NumLevels)) - 1;
+
+    protected:
+      Timer* slots[NumLevels][SlotsPerLevel];
+
+      // expired timers for RunExpired, in the order in which they expired
+      Timer* expiredHead;
+      Timer* expiredTail;
+
+      // the tick that the next timer interrupt counts,
+      // every timer before it has expired already
+      common::uint64_t current;
+
+      // timers in the slots
+      common::uint32_t pending;
+
+      void Insert(Timer* timer);
+      void Unlink(Timer* timer);
+      void Cascade(common::uint32_t level);
+
+    public:
+      static TimerWheel* activeTimerWheel;
+
+      TimerWheel();
+      ~TimerWheel();
+
+      // the timer expires this many ticks from now (1 is the next tick),
+      // if it is pending already it is moved
+      void Add(Timer* timer, common::uint32_t ticks);
+      // false if it wasn't pending
+      bool Cancel(Timer* timer);
+
+      // handle all ticks up to now (more than one after a tickless idle)
+      // true if there are expired timers for RunExpired
+      bool Advance(common::uint64_t now);
+
+      // the number of ticks until the next timer expires, at most limit
+      // (1 if one expires on the next tick), for the tickless Idle
+      common::uint32_t TicksUntilNext(common::uint32_t limit);
+
+      bool HasExpired();
+      // call the callbacks of the expired timers, not in an interrupt handler
+      void RunExpired();
+  };
+
+}
+
+#endif
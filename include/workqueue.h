@@ -0,0 +1,106 @@
+#ifndef __MYOS__WORKQUEUE_H
+#define __MYOS__WORKQUEUE_H
+
+#include <common/types.h>
+#include <multitasking.h>
+
+// An interrupt handler runs with the interrupts off, so while it works the
+// keyboard, the mouse and the timer have to wait. So a handler should only do
+// what can't wait (read the status of the device and acknowledge it) and
+// leave the rest to a WorkItem, like the bottom half of a linux driver:
+//
+//   interrupt handler                    worker task of the WorkQueue
+//   -----------------                    ----------------------------
+//   acknowledge the device
+//   tasklet_schedule(&receiveWork) --->  [item] -> [item] -> ...
+//   return                               receiveWork.function(data)
+//                                          with the interrupts on
+//
+// The worker tasks wait in a WaitQueue, Queue puts the item at the end of the
+// list and wakes one of them up. That is safe in an interrupt handler, it
+// never allocates and never waits. An item that is already queued is not
+// queued again, so a burst of interrupts only makes the work run once.
+//
+// The kernel has two of them:
+//
+//   tasklets  one worker with TaskPrioritySoftInterrupt, more important than
+//             every other task. Preempt switches to it right after the
+//             interrupt, so the work runs as soon as it would have in the
+//             handler, only with the interrupts on. Its items must not wait,
+//             WaitQueue::Wait returns false for them like in a handler.
+//   workers   a few workers with TaskPriorityNormal, for longer work that
+//             may wait (for a lock, an ARP answer, the disk).
+
+namespace myos {
+
+  class WorkQueue;
+
+  class WorkItem {
+    friend class WorkQueue;
+
+    protected:
+      WorkItem* next;
+      // in the list of a WorkQueue, until a worker takes it out
+      volatile bool queued;
+
+    public:
+      void (*function)(void* data);
+      void* data;
+
+      WorkItem(void (*function)(void* data) = 0, void* data = 0);
+      ~WorkItem();
+
+      bool Queued();
+  };
+
+  class WorkQueue {
+    public:
+      static const common::uint32_t MaxWorkers = 4;
+
+    protected:
+      WorkItem* head;
+      WorkItem* tail;
+
+      // the workers wait here while the list is empty
+      WaitQueue work;
+
+      TaskManager* taskManager;
+      common::uint8_t priority;
+      common::uint32_t workers[MaxWorkers];
+      common::uint32_t numWorkers;
+
+      // counters, for the numbers of PrintStatistics
+      common::uint32_t numQueued;
+      common::uint32_t numRun;
+      common::uint32_t pending;
+      common::uint32_t maxPending;
+
+      // the function of the worker tasks, forever
+      static void Worker(void* queue);
+      WorkItem* Take();
+
+    public:
+      static WorkQueue* activeTasklets;
+      static WorkQueue* activeWorkers;
+
+      // spawns numWorkers tasks with the priority, the first queue with
+      // TaskPrioritySoftInterrupt becomes activeTasklets and the first other one activeWorkers
+      WorkQueue(TaskManager* taskManager, common::uint8_t priority, common::uint32_t numWorkers = 1);
+      ~WorkQueue();
+
+      // safe in interrupt handlers, false if the item was queued already
+      bool Queue(WorkItem* item);
+
+      common::uint32_t NumWorkers();
+      void PrintStatistics();
+  };
+
+  // WorkQueue::activeTasklets->Queue, and if there is none (yet) the function
+  // runs right away, like it did before in the interrupt handler
+  bool tasklet_schedule(WorkItem* item);
+  // WorkQueue::activeWorkers->Queue, the same without one
+  bool schedule_work(WorkItem* item);
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __MYOS__ZEROPAGEPOOL_H
+#define __MYOS__ZEROPAGEPOOL_H
+
+#include <common/types.h>
+#include <physicalmemory.h>
+
+// A page table or a page for user space must be all zeros before we can use
+// it, and clearing 4 KiB costs more than getting the frame from the buddy
+// allocator. So we clear frames in advance, when there is nothing else to do,
+// and keep them in the ZeroPagePool:
+//
+//   idle loop: Fill()                        AllocateFrame(FrameZeroed)
+//   PhysicalMemoryManager --> clear --> [ zeroed | zeroed | ... ] --> caller
+//
+// A zeroed frame can't keep a link to the next one inside of itself, so the
+// pool is a small array of pointers. If the pool is empty, AllocateFrame
+// clears the frame itself like before, it just takes longer.
+
+namespace myos {
+
+  // flags for ZeroPagePool::AllocateFrame
+  const common::uint32_t FrameZeroed = 1 << 0;
+
+  class ZeroPagePool {
+    public:
+      static const common::uint32_t MaxPages = 64;
+
+    protected:
+      PhysicalMemoryManager* frames;
+
+      void* pages[MaxPages];
+      volatile common::uint32_t numPages;
+      common::uint32_t target;
+
+      common::uint32_t hits;
+      common::uint32_t misses;
+
+      bool Push(void* page);
+      void* Pop();
+
+    public:
+      static ZeroPagePool* activeZeroPagePool;
+
+      ZeroPagePool(PhysicalMemoryManager* frames, common::uint32_t target = MaxPages);
+      ~ZeroPagePool();
+
+      // one frame, with FrameZeroed it is cleared
+      void* AllocateFrame(common::uint32_t flags = 0);
+      void FreeFrame(void* page);
+
+      // clear one more frame if the pool is below target,
+      // false if there was nothing to do
+      bool Fill();
+
+      common::uint32_t Available();
+      // FrameZeroed requests that got a frame from the pool / had to clear it themselves
+      common::uint32_t Hits();
+      common::uint32_t Misses();
+  };
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include <arena.h>
+
+using namespace myos;
+using namespace myos::common;
+
+Arena::Arena(size_t capacity, MemoryTag tag) {
+  start = 0;
+  top = 0;
+  this->capacity = 0;
+
+  if (MemoryManager::activeMemoryManager != 0) {
+    start = (uint8_t*)MemoryManager::activeMemoryManager->malloc(capacity, tag);
+  }
+  if (start != 0) {
+    this->capacity = capacity;
+  }
+}
+
+Arena::~Arena() {
+  if (start != 0 && MemoryManager::activeMemoryManager != 0) {
+    MemoryManager::activeMemoryManager->free(start);
+  }
+}
+
+void* Arena::Allocate(size_t size, size_t align) {
+  size_t address = ((size_t)start + top + align - 1) & ~(align - 1);
+  size_t end = address - (size_t)start + size;
+
+  if (end > capacity) {
+    return 0;
+  }
+
+  top = end;
+  return (void*)address;
+}
+
+size_t Arena::Mark() {
+  return top;
+}
+
+void Arena::Release(size_t mark) {
+  top = mark;
+}
+
+void Arena::Reset() {
+  top = 0;
+}
+
+size_t Arena::Used() {
+  return top;
+}
+
+size_t Arena::Capacity() {
+  return capacity;
+}
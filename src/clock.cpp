@@ -0,0 +1,94 @@
+#include <clock.h>
+#include <drivers/timer.h>
+#include <multitasking.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::drivers;
+
+Clock* Clock::activeClock = 0;
+
+// 59659 counts of the PIT are 50 ms
+static const uint16_t CalibrationCounts = 59659;
+
+// edx:eax / divisor with one divl, the result must fit into 32 bits
+// (that is dividend >> 32 < divisor), we have no __udivdi3 in the kernel
+static uint32_t Divide(uint64_t dividend, uint32_t divisor) {
+  uint32_t quotient, remainder;
+  asm("divl %4"
+      : "=a" (quotient), "=d" (remainder)
+      : "a" ((uint32_t)dividend), "d" ((uint32_t)(dividend >> 32)), "rm" (divisor));
+  return quotient;
+}
+
+Clock::Clock(ProgrammableIntervalTimer* timer) {
+  start = 0;
+  nanosecondsPerCycle = 0;
+  cyclesPerMillisecond = 0;
+
+  // cpuid with eax = 1 tells us in edx bit 4 if there is a TSC
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  hasTimestampCounter = (edx & (1 << 4)) != 0;
+
+  if (hasTimestampCounter) {
+    uint64_t before = rdtsc();
+    timer->Wait(CalibrationCounts);
+    uint64_t after = rdtsc();
+
+    uint32_t nanoseconds = Divide((uint64_t)CalibrationCounts * 1000000000, ProgrammableIntervalTimer::BaseFrequency);
+    uint32_t delta = (uint32_t)(after - before);
+
+    // slower than 4 MHz (or a TSC that doesn't count) doesn't fit into the fixed point
+    if (delta > (nanoseconds >> 8)) {
+      nanosecondsPerCycle = Divide((uint64_t)nanoseconds << 24, delta);
+      cyclesPerMillisecond = Divide((uint64_t)delta * 1000000, nanoseconds);
+      start = after;
+    }
+    else {
+      hasTimestampCounter = false;
+    }
+  }
+
+  if (activeClock == 0) {
+    activeClock = this;
+  }
+}
+
+Clock::~Clock() {
+  if (activeClock == this) {
+    activeClock = 0;
+  }
+}
+
+uint64_t Clock::CyclesToNanoseconds(uint64_t cycles) {
+  // cycles * nanosecondsPerCycle >> 24, in two halves so nothing overflows
+  uint32_t high = cycles >> 32;
+  uint32_t low = (uint32_t)cycles;
+  return (((uint64_t)high * nanosecondsPerCycle) << 8)
+       + (((uint64_t)low * nanosecondsPerCycle) >> 24);
+}
+
+uint64_t Clock::Nanoseconds() {
+  if (hasTimestampCounter) {
+    return CyclesToNanoseconds(rdtsc() - start);
+  }
+
+  // a 486 without TSC, then the timer ticks are all we have
+  TaskManager* taskManager = TaskManager::activeTaskManager;
+  if (taskManager == 0) {
+    return 0;
+  }
+  return taskManager->Ticks() * taskManager->TickMicroseconds() * 1000;
+}
+
+uint32_t Clock::CyclesPerMillisecond() {
+  return cyclesPerMillisecond;
+}
+
+uint64_t myos::now_ns() {
+  if (Clock::activeClock == 0) {
+    return 0;
+  }
+  return Clock::activeClock->Nanoseconds();
+}
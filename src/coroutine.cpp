@@ -0,0 +1,265 @@
+#include <coroutine.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+void printf(char*);
+void printfHex32(uint32_t);
+
+CoroutineEvent::CoroutineEvent() {
+  head = 0;
+}
+
+CoroutineEvent::~CoroutineEvent() {
+  SignalAll();
+}
+
+void CoroutineEvent::Append(Coroutine* coroutine) {
+  // the order doesn't matter, they all look at their condition again
+  coroutine->next = head;
+  coroutine->event = this;
+  head = coroutine;
+}
+
+void CoroutineEvent::Remove(Coroutine* coroutine) {
+  Coroutine** link = &head;
+  while (*link != 0 && *link != coroutine) {
+    link = &(*link)->next;
+  }
+  if (*link != 0) {
+    *link = coroutine->next;
+  }
+  coroutine->next = 0;
+  coroutine->event = 0;
+}
+
+void CoroutineEvent::SignalOne() {
+  uint32_t eflags = SaveInterrupts();
+  if (head != 0) {
+    head->executor->Wake(head, false);
+  }
+  RestoreInterrupts(eflags);
+}
+
+void CoroutineEvent::SignalAll() {
+  uint32_t eflags = SaveInterrupts();
+  while (head != 0) {
+    head->executor->Wake(head, false);
+  }
+  RestoreInterrupts(eflags);
+}
+
+Coroutine::Coroutine()
+: timer(Timeout, this)
+{
+  resumePoint = 0;
+  eflags = 0;
+  state = CoroutineNew;
+  executor = 0;
+  deleteWhenDone = false;
+  next = 0;
+  event = 0;
+
+  // Wake only puts the coroutine into the ready list, that is fast enough for the timer interrupt
+  timer.runInInterrupt = true;
+  timedOut = false;
+}
+
+Coroutine::~Coroutine() {
+  uint32_t eflags = SaveInterrupts();
+  if (event != 0) {
+    event->Remove(this);
+  }
+  RestoreInterrupts(eflags);
+}
+
+bool Coroutine::Park(CoroutineEvent* event, bool wait, uint32_t timeoutMilliseconds) {
+  if (!wait) {
+    RestoreInterrupts(eflags);
+    return false;
+  }
+
+  // Resume returns right after this, and if somebody signals before that the
+  // coroutine is just in the ready list again
+  state = CoroutineBlocked;
+  if (event != 0) {
+    event->Append(this);
+  }
+  else if (timeoutMilliseconds == WaitForever) {
+    // a sleep, nothing else wakes us up
+    timeoutMilliseconds = 1;
+  }
+  if (timeoutMilliseconds != WaitForever) {
+    executor->taskManager->AddTimer(&timer, timeoutMilliseconds);
+  }
+
+  RestoreInterrupts(eflags);
+  return true;
+}
+
+void Coroutine::Timeout(void* data) {
+  Coroutine* coroutine = (Coroutine*)data;
+  coroutine->executor->Wake(coroutine, true);
+}
+
+CoroutineStatus Coroutine::Resume() {
+  return CoroutineDone;
+}
+
+CoroutineState Coroutine::State() {
+  return state;
+}
+
+bool Coroutine::Done() {
+  return state == CoroutineFinished;
+}
+
+bool Coroutine::TimedOut() {
+  return timedOut;
+}
+
+CoroutineEvent* Coroutine::Finished() {
+  return &finished;
+}
+
+CoroutineExecutor* CoroutineExecutor::activeCoroutineExecutor = 0;
+
+CoroutineExecutor::CoroutineExecutor(TaskManager* taskManager, uint8_t priority) {
+  head = 0;
+  tail = 0;
+  this->taskManager = taskManager;
+  running = 0;
+  numStarted = 0;
+  numDone = 0;
+  numResumes = 0;
+
+  task = taskManager->Spawn(Run, this, priority);
+  if (task != 0 && activeCoroutineExecutor == 0) {
+    activeCoroutineExecutor = this;
+  }
+}
+
+CoroutineExecutor::~CoroutineExecutor() {
+  if (activeCoroutineExecutor == this) {
+    activeCoroutineExecutor = 0;
+  }
+}
+
+void CoroutineExecutor::Append(Coroutine* coroutine) {
+  coroutine->state = CoroutineReady;
+  coroutine->next = 0;
+  if (tail == 0) {
+    head = coroutine;
+  }
+  else {
+    tail->next = coroutine;
+  }
+  tail = coroutine;
+  work.WakeOne();
+}
+
+void CoroutineExecutor::Wake(Coroutine* coroutine, bool timedOut) {
+  uint32_t eflags = SaveInterrupts();
+
+  // the event and the timer can both come, only the first one counts
+  if (coroutine->state == CoroutineBlocked) {
+    if (coroutine->event != 0) {
+      coroutine->event->Remove(coroutine);
+    }
+    taskManager->Timers()->Cancel(&coroutine->timer);
+    coroutine->timedOut = timedOut;
+    Append(coroutine);
+  }
+
+  RestoreInterrupts(eflags);
+}
+
+bool CoroutineExecutor::Start(Coroutine* coroutine, bool deleteWhenDone) {
+  if (task == 0) {
+    return false;
+  }
+
+  uint32_t eflags = SaveInterrupts();
+  if (coroutine->state == CoroutineReady || coroutine->state == CoroutineBlocked) {
+    RestoreInterrupts(eflags);
+    return false;
+  }
+
+  coroutine->executor = this;
+  coroutine->deleteWhenDone = deleteWhenDone;
+  coroutine->resumePoint = 0;
+  coroutine->timedOut = false;
+  running++;
+  numStarted++;
+  Append(coroutine);
+
+  RestoreInterrupts(eflags);
+  return true;
+}
+
+void CoroutineExecutor::Run(void* data) {
+  CoroutineExecutor* executor = (CoroutineExecutor*)data;
+  Task* task = executor->taskManager->CurrentTask();
+
+  while (true) {
+    uint32_t eflags = SaveInterrupts();
+    while (executor->head == 0) {
+      executor->work.Wait();
+    }
+    Coroutine* coroutine = executor->head;
+    executor->head = coroutine->next;
+    if (executor->head == 0) {
+      executor->tail = 0;
+    }
+    coroutine->next = 0;
+    executor->numResumes++;
+    RestoreInterrupts(eflags);
+
+    // all coroutines share this task, one that blocks it would stop all the others
+    task->SetNonBlocking(true);
+    CoroutineStatus status = coroutine->Resume();
+    task->SetNonBlocking(false);
+
+    eflags = SaveInterrupts();
+    if (status == CoroutineYielded) {
+      executor->Append(coroutine);
+    }
+    else if (status == CoroutineDone) {
+      coroutine->state = CoroutineFinished;
+      executor->running--;
+      executor->numDone++;
+      coroutine->finished.SignalAll();
+    }
+    // CoroutineWaiting: it is blocked on its event or timer, or already ready again
+    RestoreInterrupts(eflags);
+
+    if (status == CoroutineDone && coroutine->deleteWhenDone) {
+      delete coroutine;
+    }
+  }
+}
+
+uint32_t CoroutineExecutor::Running() {
+  return running;
+}
+
+void CoroutineExecutor::PrintStatistics() {
+  // coroutines: running 0x00000003 started 0x00000010 done 0x0000000D resumes 0x00000040
+  printf("coroutines: running 0x");
+  printfHex32(running);
+  printf(" started 0x");
+  printfHex32(numStarted);
+  printf(" done 0x");
+  printfHex32(numDone);
+  printf(" resumes 0x");
+  printfHex32(numResumes);
+  printf("\n");
+}
+
+bool myos::coroutine_start(Coroutine* coroutine, bool deleteWhenDone) {
+  if (CoroutineExecutor::activeCoroutineExecutor == 0) {
+    return false;
+  }
+  return CoroutineExecutor::activeCoroutineExecutor->Start(coroutine, deleteWhenDone);
+}
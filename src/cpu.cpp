@@ -0,0 +1,40 @@
+#include <cpu.h>
+
+using namespace myos;
+using namespace myos::common;
+
+void printf(char*);
+void printfHex(uint8_t);
+void printfHex32(uint32_t);
+
+CPU CPU::cpus[MaxCPUs];
+
+volatile uint32_t CPU::numOnline = 1;
+
+CPU::CPU() {
+  self = this;
+  index = this - cpus;
+  currentTask = 0;
+  apicId = 0;
+  online = false;
+  interruptDepth = 0;
+  interrupts = 0;
+  taskSwitches = 0;
+}
+
+void CPU::Register(uint32_t index, uint8_t apicId) {
+  cpus[index].apicId = apicId;
+}
+
+void CPU::PrintStatistics() {
+  // cpu 0x01: interrupts 0x00001234 task switches 0x00000567
+  for (uint32_t i = 0; i < numOnline; i++) {
+    printf("cpu 0x");
+    printfHex(i);
+    printf(": interrupts 0x");
+    printfHex32(cpus[i].interrupts);
+    printf(" task switches 0x");
+    printfHex32(cpus[i].taskSwitches);
+    printf("\n");
+  }
+}
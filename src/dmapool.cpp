@@ -0,0 +1,76 @@
+#include <dmapool.h>
+#include <paging.h>
+#include <hardwarecommunication/interrupts.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+DirectMemoryAccessPool* DirectMemoryAccessPool::activeDirectMemoryAccessPool = 0;
+
+DirectMemoryAccessPool::DirectMemoryAccessPool(PhysicalMemoryManager* frames, uint32_t limit)
+: heap((PhysicalMemoryManager*)0)
+{
+  this->frames = frames;
+  this->limit = limit;
+
+  if (activeDirectMemoryAccessPool == 0) {
+    activeDirectMemoryAccessPool = this;
+  }
+}
+
+DirectMemoryAccessPool::~DirectMemoryAccessPool() {
+  if (activeDirectMemoryAccessPool == this) {
+    activeDirectMemoryAccessPool = 0;
+  }
+}
+
+bool DirectMemoryAccessPool::Grow(size_t size, size_t align) {
+  // like MemoryManager::Grow, but only with frames below the limit
+  // (Allocate has turned the interrupts off, the buddy allocator has no lock of its own)
+  uint32_t order = PhysicalMemoryManager::OrderOf(size + align + sizeof(MemoryRegion) + sizeof(MemoryChunk) + 1);
+  if (order < MemoryManager::GrowOrder) {
+    order = MemoryManager::GrowOrder;
+  }
+
+  void* block = frames->AllocateFramesBelow(order, limit);
+  if (block == 0) {
+    return false;
+  }
+
+  if (!heap.AddRegion((size_t)block, PhysicalMemoryManager::PageSize << order)) {
+    frames->FreeFrames(block, order);
+    return false;
+  }
+  return true;
+}
+
+void* DirectMemoryAccessPool::Allocate(size_t size, size_t align, uint32_t* physicalAddress) {
+  // the heap of the pool has no lock and Grow calls the buddy allocator,
+  // so all of it runs with the interrupts off like the ZeroPagePool
+  uint32_t eflags = SaveInterrupts();
+  void* ptr = heap.malloc_aligned(size, align);
+  if (ptr == 0 && Grow(size, align)) {
+    ptr = heap.malloc_aligned(size, align);
+  }
+  RestoreInterrupts(eflags);
+
+  if (ptr != 0 && physicalAddress != 0) {
+    *physicalAddress = PhysicalAddress(ptr);
+  }
+  return ptr;
+}
+
+void DirectMemoryAccessPool::Free(void* ptr) {
+  uint32_t eflags = SaveInterrupts();
+  heap.free(ptr);
+  RestoreInterrupts(eflags);
+}
+
+uint32_t DirectMemoryAccessPool::PhysicalAddress(void* ptr) {
+  // before paging is on every address is a physical address
+  if (PageTableManager::activePageTableManager == 0) {
+    return (uint32_t)ptr;
+  }
+  return PageTableManager::activePageTableManager->Translate((uint32_t)ptr);
+}
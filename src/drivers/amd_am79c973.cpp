@@ -1,4 +1,5 @@
 #include <drivers/amd_am79c973.h>
+#include <dmapool.h>
 
 using namespace myos;
 using namespace myos::common;
@@ -34,12 +35,20 @@ amd_am79c973::amd_am79c973(PeripheralComponentInterconnectDeviceDescriptor *dev,
   registerDataPort(dev->portBase + 0x10),
   registerAddressPort(dev->portBase + 0x12),
   resetPort(dev->portBase + 0x14),
-  busControlRegisterDataPort(dev->portBase + 0x16)
+  busControlRegisterDataPort(dev->portBase + 0x16),
+  receivePool(BufferSize, NumBuffers, MemoryTagNet),
+  receiveWork(ReceiveWork, this)
 {
   this->handler = 0;
   currentSendBuffer = 0;
   currentRecvBuffer = 0;
 
+  initBlock = 0;
+  sendBufferDescr = 0;
+  recvBufferDescr = 0;
+  sendBuffers = 0;
+  recvBuffers = 0;
+
   uint64_t MAC0 = MACAddress0Port.Read() % 256;
   uint64_t MAC1 = MACAddress0Port.Read() / 256;
   uint64_t MAC2 = MACAddress2Port.Read() % 256;
@@ -63,45 +72,98 @@ amd_am79c973::amd_am79c973(PeripheralComponentInterconnectDeviceDescriptor *dev,
   registerAddressPort.Write(0);
   registerDataPort.Write(0x04);
 
+  // the descriptor rings must be 16 byte aligned, we give them a cache line
+  // and the buffers get a page, so a buffer never crosses a page boundary
+  DirectMemoryAccessPool* pool = DirectMemoryAccessPool::activeDirectMemoryAccessPool;
+  uint32_t initBlockAddress;
+  uint32_t sendBufferDescrAddress, recvBufferDescrAddress;
+  uint32_t sendBuffersAddress, recvBuffersAddress;
+
+  if (pool == 0) {
+    printf("AMD am79c973 NO DMA POOL\n");
+    return;
+  }
+
+  initBlock = (InitializationBlock*)pool->Allocate(sizeof(InitializationBlock),
+      DirectMemoryAccessPool::CacheLineSize, &initBlockAddress);
+  sendBufferDescr = (BufferDescriptor*)pool->Allocate(NumBuffers * sizeof(BufferDescriptor),
+      DirectMemoryAccessPool::CacheLineSize, &sendBufferDescrAddress);
+  recvBufferDescr = (BufferDescriptor*)pool->Allocate(NumBuffers * sizeof(BufferDescriptor),
+      DirectMemoryAccessPool::CacheLineSize, &recvBufferDescrAddress);
+  sendBuffers = (uint8_t*)pool->Allocate(NumBuffers * BufferSize,
+      PhysicalMemoryManager::PageSize, &sendBuffersAddress);
+  recvBuffers = (uint8_t*)pool->Allocate(NumBuffers * BufferSize,
+      PhysicalMemoryManager::PageSize, &recvBuffersAddress);
+
+  // without all of them the card stays stopped, and Activate and Send
+  // don't touch it (initBlock is 0)
+  if (initBlock == 0 || sendBufferDescr == 0 || recvBufferDescr == 0
+      || sendBuffers == 0 || recvBuffers == 0) {
+    printf("AMD am79c973 NO DMA MEMORY\n");
+    FreeRings();
+    return;
+  }
+
   // initBlock
-  initBlock.mode = 0x0000; // promiscuous mode = false
-  initBlock.reserved1 = 0;
-  initBlock.numSendBuffers = 3;
-  initBlock.reserved2 = 0;
-  initBlock.numRecvBuffers = 3;
-  initBlock.physicalAddress = MAC;
-  initBlock.reserved3 = 0;
-  initBlock.logicalAddress = 0;
-
-  sendBufferDescr = (BufferDescriptor*)((((uint32_t)&sendBufferDescrMemory[0]) + 15) & ~((uint32_t)0xF));
-  initBlock.sendBufferDescrAddress = (uint32_t)sendBufferDescr;
-  recvBufferDescr = (BufferDescriptor*)((((uint32_t)&recvBufferDescrMemory[0]) + 15) & ~((uint32_t)0xF));
-  initBlock.recvBufferDescrAddress = (uint32_t)recvBufferDescr;
-
-  for (uint8_t i = 0; i < 8; i++) {
-    sendBufferDescr[i].address = (((uint32_t)&sendBuffers[i]) + 15) & ~(uint32_t)0xF;
+  initBlock->mode = 0x0000; // promiscuous mode = false
+  initBlock->reserved1 = 0;
+  initBlock->numSendBuffers = 3; // 2^3 = NumBuffers
+  initBlock->reserved2 = 0;
+  initBlock->numRecvBuffers = 3;
+  initBlock->physicalAddress = MAC;
+  initBlock->reserved3 = 0;
+  initBlock->logicalAddress = 0;
+
+  initBlock->sendBufferDescrAddress = sendBufferDescrAddress;
+  initBlock->recvBufferDescrAddress = recvBufferDescrAddress;
+
+  for (uint8_t i = 0; i < NumBuffers; i++) {
+    sendBufferDescr[i].address = sendBuffersAddress + i * BufferSize;
     sendBufferDescr[i].flags = 0x7FF | 0xF000;
     sendBufferDescr[i].flags2 = 0;
     sendBufferDescr[i].avail = 0;
 
-    recvBufferDescr[i].address = (((uint32_t)&recvBuffers[i]) + 15) & ~(uint32_t)0xF;
+    recvBufferDescr[i].address = recvBuffersAddress + i * BufferSize;
     recvBufferDescr[i].flags = 0xF7FF | 0x80000000;
     recvBufferDescr[i].flags2 = 0;
     recvBufferDescr[i].avail = 0;
   }
 
   registerAddressPort.Write(1);
-  registerDataPort.Write((uint32_t)(&initBlock) & 0xFFFF);
+  registerDataPort.Write(initBlockAddress & 0xFFFF);
 
   registerAddressPort.Write(2);
-  registerDataPort.Write(((uint32_t)(&initBlock) >> 16) & 0xFFFF);
+  registerDataPort.Write((initBlockAddress >> 16) & 0xFFFF);
 }
 
 amd_am79c973::~amd_am79c973() {
+  FreeRings();
+}
 
+void amd_am79c973::FreeRings() {
+  // Free of the pool takes 0 too
+  DirectMemoryAccessPool* pool = DirectMemoryAccessPool::activeDirectMemoryAccessPool;
+  if (pool != 0) {
+    pool->Free(recvBuffers);
+    pool->Free(sendBuffers);
+    pool->Free(recvBufferDescr);
+    pool->Free(sendBufferDescr);
+    pool->Free(initBlock);
+  }
+
+  initBlock = 0;
+  sendBufferDescr = 0;
+  recvBufferDescr = 0;
+  sendBuffers = 0;
+  recvBuffers = 0;
 }
 
 void amd_am79c973::Activate() {
+  // the constructor got no DMA memory, the card stays stopped
+  if (initBlock == 0) {
+    return;
+  }
+
   registerAddressPort.Write(0);
   registerDataPort.Write(0x41);
 
@@ -130,7 +192,7 @@ uint32_t amd_am79c973::HandleInterrupt(uint32_t esp) {
   if ((temp & 0x2000) == 0x2000) printf("AMD am79c973 COLLISION ERROR\n"); // collision error
   if ((temp & 0x1000) == 0x1000) printf("AMD am79c973 MISSED FRAME\n"); // missed frame
   if ((temp & 0x0800) == 0x0800) printf("AMD am79c973 MEMORY ERROR\n"); // memory error
-  if ((temp & 0x0400) == 0x0400) Receive(); // data receved
+  if ((temp & 0x0400) == 0x0400) tasklet_schedule(&receiveWork); // data receved, Receive runs later
   if ((temp & 0x0200) == 0x0200) printf("AMD am79c973 DATA SENT\n"); // data sent
 
   // acknowledge
@@ -143,12 +205,19 @@ uint32_t amd_am79c973::HandleInterrupt(uint32_t esp) {
 }
 
 void amd_am79c973::Send(uint8_t* buffer, int size) {
+  if (initBlock == 0) {
+    return;
+  }
+
   // get the number of currentSendBuffer
+  // the receive tasklet sends replies, it can come in the middle of a Send of a task
+  uint32_t eflags = SaveInterrupts();
   int sendDescriptor = currentSendBuffer;
 
   // remove the currentSendBuffer cyclic to the next send buffer
   // that we could write or send data from different tasks in parallel
-  currentSendBuffer = (currentSendBuffer + 1) % 8;
+  currentSendBuffer = (currentSendBuffer + 1) % NumBuffers;
+  RestoreInterrupts(eflags);
 
   // send more than 1518 bytes at once (this is too large)
   // then we'll just discard everything after that
@@ -163,9 +232,10 @@ void amd_am79c973::Send(uint8_t* buffer, int size) {
   // and another `dst` pinter to the buffer where we want to write it
   // move these two pointer to the end of the buffers
   // `src` is the end of the `buffer`
-  // `dst` is the end of the `sendBufferDescr`
+  // `dst` is the end of the send buffer of this descriptor
+  // (the descriptor only has the physical address for the card)
   for (uint8_t *src = buffer + size - 1,
-      *dst = (uint8_t*)(sendBufferDescr[sendDescriptor].address + size - 1);
+      *dst = sendBuffers + sendDescriptor * BufferSize + size - 1;
       src >= buffer; src--, dst--) {
     // copy the data from the `src` buffer to the `dst` buffer
     *dst = *src;
@@ -199,13 +269,25 @@ void amd_am79c973::Send(uint8_t* buffer, int size) {
 
 }
 
+void amd_am79c973::ReceiveWork(void* nic) {
+  ((amd_am79c973*)nic)->Receive();
+}
+
 void amd_am79c973::Receive() {
+  if (initBlock == 0) {
+    return;
+  }
+
   printf("AMD am79c973 DATA RECEIVED\n");
 
   // iterate through the receive buffers as long as we have received buffers that contain data
   // in this loop, we move the currentRecvBuffer cyclic around
   // until we find a received buffer that has no data
-  for (; (recvBufferDescr[currentRecvBuffer].flags & 0x80000000) == 0; currentRecvBuffer = (currentRecvBuffer + 1) % 8) {
+  while ((recvBufferDescr[currentRecvBuffer].flags & 0x80000000) == 0) {
+    uint8_t descriptor = currentRecvBuffer;
+    uint8_t* buffer = 0;
+    uint32_t size = 0;
+
     // receive buffer that hold data
     //
     // The first line checks the Error Bit (ERR)
@@ -213,11 +295,11 @@ void amd_am79c973::Receive() {
     //
     // See AMD am79c973 chip documentation page 184
     // https://www.amd.com/system/files/TechDocs/20550.pdf
-    if (!(recvBufferDescr[currentRecvBuffer].flags & 0x40000000)
-        && (recvBufferDescr[currentRecvBuffer].flags & 0x03000000) == 0x03000000)
+    if (!(recvBufferDescr[descriptor].flags & 0x40000000)
+        && (recvBufferDescr[descriptor].flags & 0x03000000) == 0x03000000)
     {
       // read the size from the recvBufferDescr
-      uint32_t size = recvBufferDescr[currentRecvBuffer].flags & 0xFFF;
+      size = recvBufferDescr[descriptor].flags & 0xFFF;
 
       // if the size is larger than 64, which this is the size of an Ethernet II frame
       // then remove the last four bytes
@@ -226,35 +308,41 @@ void amd_am79c973::Receive() {
         size -= 4;
       }
 
-      uint8_t* buffer = (uint8_t*)(recvBufferDescr[currentRecvBuffer].address);
-
-      if (handler != 0) {
-        // if we receive something then we just sent this out again
-        if (handler->OnRawDataReceived(buffer, size)) {
-          Send(buffer, size);
+      // The frame goes into a buffer of the receivePool, and if that is
+      // empty we drop it like the card does when the ring is full.
+      buffer = (uint8_t*)receivePool.Allocate();
+      if (buffer != 0) {
+        uint8_t* src = recvBuffers + descriptor * BufferSize;
+        for (uint32_t i = 0; i < size; i++) {
+          buffer[i] = src[i];
         }
       }
+    }
+
+    // we have our copy, so the card can have this buffer back right now
+    // and doesn't have to wait until the handlers are done with the frame
+    recvBufferDescr[descriptor].flags2 = 0;
+    recvBufferDescr[descriptor].flags = 0x8000F7FF;
+    currentRecvBuffer = (currentRecvBuffer + 1) % NumBuffers;
+
+    if (buffer == 0) {
+      continue;
+    }
 
-      // now copy the address of the buffer and basically iterate over the data
-      // print what we have received
-      // uint8_t* buffer = (uint8_t*)(recvBufferDescr[currentRecvBuffer].address);
-      // for (int i = 0; i < size; i++) {
-      //   printfHex(buffer[i]);
-      //   printf(" ");
-      // }
-      // ARP: just print the data out before we handle it
-      size = 64;
-      for (int i = 0; i < size; i++) {
-        printfHex(buffer[i]);
-        printf(" ");
+    if (handler != 0) {
+      // if we receive something then we just sent this out again
+      if (handler->OnRawDataReceived(buffer, size)) {
+        Send(buffer, size);
       }
+    }
 
+    // ARP: just print the data out after we handle it
+    for (int i = 0; i < 64; i++) {
+      printfHex(buffer[i]);
+      printf(" ");
     }
 
-    // in the end of the loop, we have finished handling this
-    // so you can have this back
-    recvBufferDescr[currentRecvBuffer].flags2 = 0;
-    recvBufferDescr[currentRecvBuffer].flags = 0x8000F7FF;
+    receivePool.Free(buffer);
   }
 }
 
@@ -264,13 +352,15 @@ void amd_am79c973::SetHandler(RawDataHandler* handler) {
 
 // we need a way to ask father MAC address
 uint64_t amd_am79c973::GetMACAddress() {
-  return initBlock.physicalAddress;
+  return initBlock != 0 ? initBlock->physicalAddress : 0;
 }
 
 void amd_am79c973::SetIPAddress(uint32_t ip) {
-  initBlock.logicalAddress = ip;
+  if (initBlock != 0) {
+    initBlock->logicalAddress = ip;
+  }
 }
 
 uint32_t amd_am79c973::GetIPAddress() {
-  return initBlock.logicalAddress;
+  return initBlock != 0 ? initBlock->logicalAddress : 0;
 }
@@ -3,12 +3,21 @@
 using namespace myos;
 using namespace myos::common;
 using namespace myos::drivers;
+using namespace myos::hardwarecommunication;
 
 void printf(char*);
 void printfHex(uint8_t);
 
-AdvancedTechnologyAttachment::AdvancedTechnologyAttachment(bool master, common::uint16_t portBase)
-: dataPort(portBase),
+WaitQueue AdvancedTechnologyAttachment::completions[2];
+
+// the primary bus (0x1F0) has IRQ 14 and the secondary bus (0x170) IRQ 15
+static uint8_t ChannelOf(uint16_t portBase) {
+  return portBase == 0x170 ? 1 : 0;
+}
+
+AdvancedTechnologyAttachment::AdvancedTechnologyAttachment(InterruptManager* interruptManager, bool master, common::uint16_t portBase)
+: InterruptHandler(interruptManager, interruptManager->HardwareInterruptOffset() + 14 + ChannelOf(portBase)),
+  dataPort(portBase),
   errorPort(portBase + 0x1),
   sectorCountPort(portBase + 0x2),
   lbaLowPort(portBase + 0x3),
@@ -19,12 +28,40 @@ AdvancedTechnologyAttachment::AdvancedTechnologyAttachment(bool master, common::
   controlPort(portBase + 0x206)
 {
   this->master = master;
+  channel = ChannelOf(portBase);
 }
 
 AdvancedTechnologyAttachment::~AdvancedTechnologyAttachment() {
 
 }
 
+uint32_t AdvancedTechnologyAttachment::HandleInterrupt(uint32_t esp) {
+  // reading the status tells the drive that we got the interrupt
+  commandPort.Read();
+
+  // master and slave share the interrupt, so wake up whoever waits on this bus
+  completions[channel].WakeAll();
+  return esp;
+}
+
+uint8_t AdvancedTechnologyAttachment::WaitWhileBusy() {
+  // with the interrupts off, so the interrupt of the drive can't come
+  // between reading the status and Wait
+  uint32_t eflags = SaveInterrupts();
+
+  uint8_t status = commandPort.Read();
+  while (((status & 0x80) == 0x80) // if device is busy
+      && ((status & 0x01) != 0x01)) { // if device has error
+    // the drive sends an interrupt when it is done, until then other tasks can run
+    // if we can't wait (the interrupts are not activated yet) we just ask again
+    completions[channel].Wait(BusyTimeout);
+    status = commandPort.Read();
+  }
+
+  RestoreInterrupts(eflags);
+  return status;
+}
+
 void AdvancedTechnologyAttachment::Identify() {
   // want to talk to master or slave
   devicePort.Write(master ? 0xA0 : 0xB0);
@@ -62,10 +99,7 @@ void AdvancedTechnologyAttachment::Identify() {
   // it might take some time until the hard drive is ready to
   // give us the answer to this identify command, so here just wait
   // until the device ready
-  while (((status & 0x80) == 0x80) // if device is busy
-      && ((status & 0x01) != 0x01)) { // if device has error
-    status = commandPort.Read();
-  }
+  status = WaitWhileBusy();
 
   if (status & 0x01) {
     printf("ERROR");
@@ -117,11 +151,7 @@ void AdvancedTechnologyAttachment::Read28(common::uint32_t sectorNum, int count)
   // is ready to give us that data.
   //
   // Wait for the device to be ready to give us a data
-  uint8_t status = commandPort.Read();
-  while (((status & 0x80) == 0x80) // if device is busy
-      && ((status & 0x01) != 0x01)) { // if device has error
-    status = commandPort.Read();
-  }
+  uint8_t status = WaitWhileBusy();
 
   if (status & 0x01) {
     printf("ERROR");
@@ -233,10 +263,7 @@ void AdvancedTechnologyAttachment::Flush() {
     return;
   }
 
-  while (((status & 0x80) == 0x80) // if device is busy
-      && ((status & 0x01) != 0x01)) { // if device has error
-    status = commandPort.Read();
-  }
+  status = WaitWhileBusy();
 
   if (status & 0x01) {
     printf("ERROR");
@@ -0,0 +1,51 @@
+#include <drivers/serial.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::drivers;
+using namespace myos::hardwarecommunication;
+
+SerialPort::SerialPort(uint16_t portBase)
+: dataPort(portBase),
+  interruptEnablePort(portBase + 1),
+  fifoControlPort(portBase + 2),
+  lineControlPort(portBase + 3),
+  modemControlPort(portBase + 4),
+  lineStatusPort(portBase + 5)
+{
+}
+
+SerialPort::~SerialPort() {
+}
+
+void SerialPort::Activate() {
+  // no interrupts, we poll
+  interruptEnablePort.Write(0x00);
+
+  // with the DLAB bit set the first two ports are the divisor of the 115200 Hz clock
+  lineControlPort.Write(0x80);
+  dataPort.Write(1);
+  interruptEnablePort.Write(0);
+
+  // 8 bits, no parity, one stop bit, and DLAB off again
+  lineControlPort.Write(0x03);
+
+  // enable the FIFOs, clear them, interrupt threshold 14 bytes
+  fifoControlPort.Write(0xC7);
+
+  // data terminal ready, request to send, OUT2
+  modemControlPort.Write(0x0B);
+}
+
+void SerialPort::Write(uint8_t data) {
+  // bit 5 of the line status: the transmit holding register is empty
+  while ((lineStatusPort.Read() & 0x20) == 0) {
+  }
+  dataPort.Write(data);
+}
+
+void SerialPort::Write(uint8_t* buffer, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    Write(buffer[i]);
+  }
+}
@@ -0,0 +1,114 @@
+#include <drivers/timer.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::drivers;
+using namespace myos::hardwarecommunication;
+
+ProgrammableIntervalTimer::ProgrammableIntervalTimer(uint32_t frequency)
+: channel0Port(0x40),
+  channel2Port(0x42),
+  commandPort(0x43),
+  channel2GatePort(0x61)
+{
+  this->frequency = 0;
+  countsPerTick = 0;
+  oneShotCount = 0;
+  SetFrequency(frequency);
+}
+
+ProgrammableIntervalTimer::~ProgrammableIntervalTimer() {
+}
+
+void ProgrammableIntervalTimer::Load(uint8_t mode, uint32_t count) {
+  // command: channel 0 (bits 6-7 = 0), low byte then high byte (bits 4-5 = 3),
+  // the mode in bits 1-3 and binary counting (bit 0 = 0)
+  commandPort.Write(0x30 | (mode << 1));
+
+  // 0 means 65536 for the PIT
+  channel0Port.Write(count & 0xFF);
+  channel0Port.Write((count >> 8) & 0xFF);
+}
+
+void ProgrammableIntervalTimer::Activate() {
+  oneShotCount = 0;
+  Load(2, countsPerTick);
+}
+
+void ProgrammableIntervalTimer::SetFrequency(uint32_t frequency) {
+  // the counter has 16 bits, so we can't go slower than 18.2 Hz
+  if (frequency < 19) {
+    frequency = 19;
+  }
+  if (frequency > BaseFrequency) {
+    frequency = BaseFrequency;
+  }
+
+  this->frequency = frequency;
+  countsPerTick = (BaseFrequency + frequency / 2) / frequency;
+}
+
+uint32_t ProgrammableIntervalTimer::Frequency() {
+  return frequency;
+}
+
+uint32_t ProgrammableIntervalTimer::TickMicroseconds() {
+  // countsPerTick * 1000000 / BaseFrequency without an overflow
+  return (countsPerTick * 1000 + BaseFrequency / 2000) / (BaseFrequency / 1000);
+}
+
+uint32_t ProgrammableIntervalTimer::MaxOneShotTicks() {
+  return MaxCount / countsPerTick;
+}
+
+void ProgrammableIntervalTimer::OneShot(uint32_t ticks) {
+  if (ticks > MaxOneShotTicks()) {
+    ticks = MaxOneShotTicks();
+  }
+  if (ticks == 0) {
+    ticks = 1;
+  }
+
+  oneShotCount = ticks * countsPerTick;
+  Load(0, oneShotCount);
+}
+
+uint32_t ProgrammableIntervalTimer::Periodic() {
+  if (oneShotCount == 0) {
+    return 0;
+  }
+
+  // this is for the case that something else than the timer interrupt ended
+  // the wait, after the interrupt of the one shot the counter wraps around
+  // and keeps on counting, then we can't tell how far it is anymore
+  uint32_t count = ReadCount();
+  uint32_t elapsed = count <= oneShotCount ? oneShotCount - count : oneShotCount;
+
+  Activate();
+  return elapsed / countsPerTick;
+}
+
+uint16_t ProgrammableIntervalTimer::ReadCount() {
+  // latch command for channel 0, then the latched value low byte first
+  commandPort.Write(0x00);
+  uint16_t low = channel0Port.Read();
+  uint16_t high = channel0Port.Read();
+  return (high << 8) | low;
+}
+
+void ProgrammableIntervalTimer::Wait(uint16_t counts) {
+  // gate on, but not into the speaker
+  uint8_t gate = channel2GatePort.Read();
+  channel2GatePort.Write((gate & ~0x02) | 0x01);
+
+  // channel 2 (bits 6-7 = 2), low byte then high byte, mode 0
+  // in mode 0 the output goes high when the counter reaches 0
+  commandPort.Write(0xB0);
+  channel2Port.Write(counts & 0xFF);
+  channel2Port.Write((counts >> 8) & 0xFF);
+
+  while ((channel2GatePort.Read() & 0x20) == 0) {
+  }
+
+  channel2GatePort.Write(gate);
+}
@@ -0,0 +1,162 @@
+#include <fpu.h>
+#include <multitasking.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+void printf(char*);
+
+static uint8_t* Align(uint8_t* area) {
+  return (uint8_t*)(((uint32_t)area + FloatingPointUnit::StateAlignment - 1) & ~(FloatingPointUnit::StateAlignment - 1));
+}
+
+static inline void SetTaskSwitched() {
+  uint32_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r" (cr0));
+  asm volatile("mov %0, %%cr0" : : "r" (cr0 | (1 << 3))); // TS
+}
+
+FloatingPointUnit* FloatingPointUnit::activeFloatingPointUnit = 0;
+
+FloatingPointUnit::FloatingPointUnit(InterruptManager* interruptManager)
+: InterruptHandler(interruptManager, 0x07)
+{
+  hasFxsr = false;
+  hasSSE = false;
+  for (uint32_t i = 0; i < CPU::MaxCPUs; i++) {
+    owner[i] = 0;
+    idleUsed[i] = false;
+  }
+
+  if (activeFloatingPointUnit == 0) {
+    activeFloatingPointUnit = this;
+  }
+}
+
+FloatingPointUnit::~FloatingPointUnit() {
+  if (activeFloatingPointUnit == this) {
+    activeFloatingPointUnit = 0;
+  }
+}
+
+void FloatingPointUnit::Activate() {
+  // cpuid with eax = 1: edx bit 24 is fxsave/fxrstor, bit 25 is SSE
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  hasFxsr = (edx & (1 << 24)) != 0;
+  hasSSE = hasFxsr && (edx & (1 << 25)) != 0;
+
+  uint32_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r" (cr0));
+  cr0 &= ~(1 << 2); // EM: without an FPU every FPU instruction traps
+  cr0 &= ~(1 << 3); // TS
+  cr0 |= 1 << 1;    // MP: wait/fwait trap too when TS is set
+  cr0 |= 1 << 5;    // NE: FPU errors as exception 16, not IRQ 13
+  asm volatile("mov %0, %%cr0" : : "r" (cr0));
+
+  if (hasSSE) {
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= 1 << 9;  // OSFXSR: we save with fxsave, this switches SSE on
+    cr4 |= 1 << 10; // OSXMMEXCPT: SSE errors as exception 19
+    asm volatile("mov %0, %%cr4" : : "r" (cr4));
+  }
+
+  // the state that every task gets when it uses the FPU the first time
+  asm volatile("fninit");
+  Save(Align(initialArea));
+
+  // nobody has used it yet, so the first one traps
+  owner[CPU::CurrentIndex()] = 0;
+  SetTaskSwitched();
+}
+
+bool FloatingPointUnit::HasSSE() {
+  return hasSSE;
+}
+
+void FloatingPointUnit::Save(uint8_t* area) {
+  if (hasFxsr) {
+    asm volatile("fxsave (%0)" : : "r" (area) : "memory");
+  }
+  else {
+    asm volatile("fnsave (%0)" : : "r" (area) : "memory");
+  }
+}
+
+void FloatingPointUnit::Restore(uint8_t* area) {
+  if (hasFxsr) {
+    asm volatile("fxrstor (%0)" : : "r" (area) : "memory");
+  }
+  else {
+    asm volatile("frstor (%0)" : : "r" (area) : "memory");
+  }
+}
+
+void FloatingPointUnit::TaskSwitched(Task* task) {
+  uint32_t cpu = CPU::CurrentIndex();
+  uint8_t* area = task != 0 ? Align(task->fpuArea) : Align(idleArea[cpu]);
+
+  // if the registers are still the ones of this task it can just go on
+  if (area == owner[cpu]) {
+    asm volatile("clts");
+    return;
+  }
+
+  // the last one might go on on another processor, see above
+  if (owner[cpu] != 0 && CPU::numOnline > 1) {
+    asm volatile("clts");
+    Save(owner[cpu]);
+    owner[cpu] = 0;
+  }
+  SetTaskSwitched();
+}
+
+void FloatingPointUnit::Release(Task* task) {
+  uint32_t eflags = SaveInterrupts();
+  for (uint32_t i = 0; i < CPU::MaxCPUs; i++) {
+    if (owner[i] == Align(task->fpuArea)) {
+      owner[i] = 0;
+    }
+  }
+  RestoreInterrupts(eflags);
+}
+
+uint32_t FloatingPointUnit::HandleInterrupt(uint32_t esp) {
+  // we are allowed to use the FPU again
+  asm volatile("clts");
+
+  if (InterruptManager::InInterrupt()) {
+    printf("\nFPU IN INTERRUPT HANDLER\n");
+  }
+
+  uint32_t cpu = CPU::CurrentIndex();
+  Task* task = TaskManager::activeTaskManager != 0 ? TaskManager::activeTaskManager->CurrentTask() : 0;
+  uint8_t* area;
+  bool* used;
+  if (task != 0) {
+    area = Align(task->fpuArea);
+    used = &task->fpuUsed;
+  }
+  else {
+    area = Align(idleArea[cpu]);
+    used = &idleUsed[cpu];
+  }
+
+  if (owner[cpu] == area) {
+    return esp;
+  }
+
+  // the registers of the last one go into its area,
+  // and we load the ones of the current task
+  if (owner[cpu] != 0) {
+    Save(owner[cpu]);
+  }
+  Restore(*used ? area : Align(initialArea));
+  *used = true;
+  owner[cpu] = area;
+
+  // iret executes the FPU instruction again
+  return esp;
+}
@@ -65,17 +65,37 @@ using namespace myos::common;
  *   A code segment descriptor (for your kernel, it should have type 0x9A)
  *
  *  A data segment descriptor (you can't write to a code segment, so add this with type 0x92)
+ *
+ * Both segments are flat and cover all 4GiB, the protection is done by paging
+ * (see paging.h) and with 64MiB we couldn't reach user space at 0x40000000.
  */
-GlobalDescriptorTable::GlobalDescriptorTable()
+GlobalDescriptorTable::GlobalDescriptorTable(CPU* cpu)
 : nullSegmentSelector(0, 0, 0),
   unusedSegmentSelector(0, 0, 0),
-  codeSegmentSelector(0, 64*1024*1024, 0x9A), // 64MiB for code segment
-  dataSegmentSelector(0, 64*1024*1024, 0x92)  // 64MiB for data segment
+  codeSegmentSelector(0, 0xFFFFFFFF, 0x9A), // 4GiB for code segment
+  dataSegmentSelector(0, 0xFFFFFFFF, 0x92), // 4GiB for data segment
+  cpuSegmentSelector((uint32_t)cpu, sizeof(CPU) - 1, 0x92),
+  taskStateSegmentSelector((uint32_t)&taskStateSegment, sizeof(TaskStateSegment) - 1, 0x89) // present, 32 bit TSS
 {
+  uint8_t* tss = (uint8_t*)&taskStateSegment;
+  for (uint32_t i = 0; i < sizeof(TaskStateSegment); i++) {
+    tss[i] = 0;
+  }
+  taskStateSegment.ss0 = DataSegmentSelector();
+  taskStateSegment.ioMapBase = sizeof(TaskStateSegment);
+
+  Load();
+
+  // ltr marks the TSS as busy, so this only works once for every TSS
+  asm volatile("ltr %0" : : "r" (TaskStateSegmentSelector()));
+}
+
+void GlobalDescriptorTable::Load() {
   uint32_t i[2];
 
+  // only the descriptors, the TSS behind them is no part of the table
   i[1] = (uint32_t)this;
-  i[0] = sizeof(GlobalDescriptorTable) << 16; // 65535 entries = 2 ^ 19 bytes
+  i[0] = ((uint8_t*)&taskStateSegment - (uint8_t*)this - 1) << 16;
 
   // Telling the CPU where the table stands
   //   lgdt: load global descriptor table
@@ -84,6 +104,8 @@ GlobalDescriptorTable::GlobalDescriptorTable()
   //   p: a valid memory address (pointer)
   asm volatile("lgdt (%0)": :"p" (((uint8_t *) i)+2));
 
+  // the descriptors of GS are only read when the register is loaded
+  asm volatile("mov %0, %%gs" : : "r" (CPUSegmentSelector()));
 }
 
 GlobalDescriptorTable::~GlobalDescriptorTable() {
@@ -98,6 +120,18 @@ uint16_t GlobalDescriptorTable::CodeSegmentSelector() {
   return (uint8_t*)&codeSegmentSelector - (uint8_t*)this;
 }
 
+uint16_t GlobalDescriptorTable::CPUSegmentSelector() {
+  return (uint8_t*)&cpuSegmentSelector - (uint8_t*)this;
+}
+
+uint16_t GlobalDescriptorTable::TaskStateSegmentSelector() {
+  return (uint8_t*)&taskStateSegmentSelector - (uint8_t*)this;
+}
+
+void GlobalDescriptorTable::SetKernelStack(uint32_t esp0) {
+  taskStateSegment.esp0 = esp0;
+}
+
 GlobalDescriptorTable::SegmentDescriptor::SegmentDescriptor(uint32_t base, uint32_t limit, uint8_t type) {
   uint8_t* target = (uint8_t*)this;
 
@@ -150,6 +184,11 @@ GlobalDescriptorTable::SegmentDescriptor::SegmentDescriptor(uint32_t base, uint3
 
   // Type
   target[5] = type;
+
+  // a system segment (S bit 0, like a TSS) has no size bit
+  if ((type & 0x10) == 0) {
+    target[6] &= ~0x40;
+  }
 }
 
 // Decode the base
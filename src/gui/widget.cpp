@@ -2,6 +2,7 @@
 
 using namespace myos::gui;
 using namespace myos::common;
+using namespace myos::hardwarecommunication;
 
 Widget::Widget(Widget* parent, int32_t x, int32_t y, int32_t w, int32_t h, uint8_t r, uint8_t g, uint8_t b)
   : KeyboardEventHandler()
@@ -97,16 +98,25 @@ void CompositeWidget::GetFocus(Widget* widget) {
 }
 
 bool CompositeWidget::AddChild(Widget* child) {
+  // two tasks that add a child at the same time would take the same slot,
+  // with the interrupts off (and the KernelLock) only one of them is in here
+  uint32_t eflags = SaveInterrupts();
+
   // if we already haves as many children as we can
   // then we were just returned false
   if (numChildren >= 100) {
+    RestoreInterrupts(eflags);
     return false;
   }
 
-  // so this isn't exactly a threat safe but whatever
-  // right now everything is synchronous still anyways
-  children[numChildren++] = child;
+  // Draw and the mouse events walk through the children without a lock,
+  // they only go up to numChildren, so the child must be in its slot
+  // before numChildren counts it (children are never removed)
+  children[numChildren] = child;
+  __sync_synchronize();
+  numChildren++;
 
+  RestoreInterrupts(eflags);
   return true;
 }
 
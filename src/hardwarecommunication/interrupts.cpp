@@ -1,4 +1,6 @@
 #include <hardwarecommunication/interrupts.h>
+#include <hardwarecommunication/localapic.h>
+#include <cpu.h>
 
 using namespace myos;
 using namespace myos::common;
@@ -131,6 +133,11 @@ InterruptManager::InterruptManager(uint16_t hardwareInterruptOffset, GlobalDescr
   SetInterruptDescriptorTableEntry(hardwareInterruptOffset + 0x0F, CodeSegment, &HandleInterruptRequest0x0F, 0, IDT_INTERRUPT_GATE);
 
   SetInterruptDescriptorTableEntry(                          0x80, CodeSegment, &HandleInterruptRequest0x80, 0, IDT_INTERRUPT_GATE); // syscall
+  SetInterruptDescriptorTableEntry(                YieldInterrupt, CodeSegment, &HandleInterruptRequest0x81, 0, IDT_INTERRUPT_GATE); // yield
+
+  // the stubs add 0x20 to the number, so 0x20 and 0x21 arrive as 0x40 and 0x41
+  SetInterruptDescriptorTableEntry(           LocalTimerInterrupt, CodeSegment, &HandleInterruptRequest0x20, 0, IDT_INTERRUPT_GATE);
+  SetInterruptDescriptorTableEntry(           RescheduleInterrupt, CodeSegment, &HandleInterruptRequest0x21, 0, IDT_INTERRUPT_GATE);
 
   programmableInterruptControllerMasterCommandPort.Write(0x11);
   programmableInterruptControllerSlaveCommandPort.Write(0x11);
@@ -149,6 +156,10 @@ InterruptManager::InterruptManager(uint16_t hardwareInterruptOffset, GlobalDescr
   programmableInterruptControllerSlaveDataPort.Write(0x00);
 
   // after creating the table, tell the processor to use it
+  LoadInterruptDescriptorTable();
+}
+
+void InterruptManager::LoadInterruptDescriptorTable() {
   InterruptDescriptorTablePointer idt_pointer;
   idt_pointer.size  = 256 * sizeof(GateDescriptor) - 1;    // IDT size
   idt_pointer.base  = (uint32_t)interruptDescriptorTable;  // pointer to IDT
@@ -185,6 +196,10 @@ void InterruptManager::Deactivate() {
 }
 
 uint32_t InterruptManager::HandleInterrupt(uint8_t interrupt, uint32_t esp) {
+  // we came from code with the interrupts on, so we don't have the lock yet
+  if (KernelLock::enabled && (((CPUState*)esp)->eflags & 0x200) != 0) {
+    KernelLock::Lock();
+  }
 
   if (ActiveInterruptManager != 0) {
     return ActiveInterruptManager->DoHandleInterrupt(interrupt, esp);
@@ -195,18 +210,43 @@ uint32_t InterruptManager::HandleInterrupt(uint8_t interrupt, uint32_t esp) {
   return esp;
 }
 
+void InterruptManager::LeaveInterrupt(uint32_t esp) {
+  // and we go back to code with the interrupts on
+  if (KernelLock::enabled && (((CPUState*)esp)->eflags & 0x200) != 0) {
+    KernelLock::Unlock();
+  }
+}
+
+bool InterruptManager::InInterrupt() {
+  return CPU::Current()->interruptDepth != 0;
+}
+
+bool InterruptManager::Activated() {
+  return ActiveInterruptManager != 0;
+}
+
 uint32_t InterruptManager::DoHandleInterrupt(uint8_t interrupt, uint32_t esp) {
+  // exceptions and syscalls belong to the task that caused them,
+  // only the hardware interrupts come from somewhere else
+  bool localInterrupt = interrupt == LocalTimerInterrupt || interrupt == RescheduleInterrupt;
+  bool hardwareInterrupt = localInterrupt || (hardwareInterruptOffset <= interrupt && interrupt < hardwareInterruptOffset+16);
+  CPU* cpu = CPU::Current();
+  if (hardwareInterrupt) {
+    cpu->interruptDepth++;
+    CPU::CountInterrupt();
+  }
+
   if (handlers[interrupt] != 0) {
     esp = handlers[interrupt]->HandleInterrupt(esp);
   }
-  else if (interrupt != hardwareInterruptOffset) {
+  else if (interrupt != hardwareInterruptOffset && interrupt != hardwareInterruptOffset + YieldInterrupt && !localInterrupt) {
     printf("UNHANDLED INTERRUPT 0x");
     printfHex(interrupt);
   }
 
   // setting ESP again so we could actually remove that from the interrupt handlers
   // but I will leave it there right now
-  if (interrupt == hardwareInterruptOffset) {
+  if (interrupt == hardwareInterruptOffset || interrupt == LocalTimerInterrupt) {
     // so if we have a timer interrupt
     // then I will set ESP to the taskManager schedule
     //
@@ -214,9 +254,25 @@ uint32_t InterruptManager::DoHandleInterrupt(uint8_t interrupt, uint32_t esp) {
     // I think that would be a little bit more clean
     esp = (uint32_t)taskManager->Schedule((CPUState*)esp);
   }
+  else if (interrupt == hardwareInterruptOffset + YieldInterrupt) {
+    // the stubs add the offset to every number, like for the syscalls
+    // so the yield interrupt arrives here as 0x81 + 0x20
+    esp = (uint32_t)taskManager->Yield((CPUState*)esp);
+  }
+  else if (hardwareInterrupt) {
+    // the handler might have woken up a task that is more important than
+    // the one we interrupted, then it shouldn't wait for the next timer interrupt
+    esp = (uint32_t)taskManager->Preempt((CPUState*)esp);
+  }
 
-  // hardware interrupts must be acknowledged
-  if (hardwareInterruptOffset <= interrupt && interrupt < hardwareInterruptOffset+16) {
+  // hardware interrupts must be acknowledged,
+  // the ones from the local APIC at the local APIC
+  if (localInterrupt) {
+    cpu->interruptDepth--;
+    LocalAPIC::activeLocalAPIC->EndOfInterrupt();
+  }
+  else if (hardwareInterrupt) {
+    cpu->interruptDepth--;
     programmableInterruptControllerMasterCommandPort.Write(0x20);
     if (hardwareInterruptOffset + 8 <= interrupt) {
       programmableInterruptControllerSlaveCommandPort.Write(0x20);
@@ -3,20 +3,31 @@
 .section .text
 
 .extern _ZN4myos21hardwarecommunication16InterruptManager15HandleInterruptEhj
+.extern _ZN4myos21hardwarecommunication16InterruptManager14LeaveInterruptEj
 
 # interrupt service routines
 .macro HandleException num
 .global _ZN4myos21hardwarecommunication16InterruptManager19HandleException\num\()Ev
 _ZN4myos21hardwarecommunication16InterruptManager19HandleException\num\()Ev:
-  movb $\num, (interruptnumber)
+  # most exceptions don't push an error code either,
+  # so we push 0 like for the interrupt requests down there
+  pushl $0
+  pushl $\num
+
+  jmp int_bottom
+.endm
+
+# only the exceptions 0x08, 0x0A - 0x0E and 0x11 get an error code from the CPU
+.macro HandleExceptionErrorCode num
+.global _ZN4myos21hardwarecommunication16InterruptManager19HandleException\num\()Ev
+_ZN4myos21hardwarecommunication16InterruptManager19HandleException\num\()Ev:
+  pushl $\num
   jmp int_bottom
 .endm
 
 .macro HandleInterruptRequest num
 .global _ZN4myos21hardwarecommunication16InterruptManager26HandleInterruptRequest\num\()Ev
 _ZN4myos21hardwarecommunication16InterruptManager26HandleInterruptRequest\num\()Ev:
-  movb $\num + IRQ_BASE, (interruptnumber)
-
   # in the handler interrupt request we need to just push something like 0
   # because this is for the error flag of CPUState
   # so otherwise we would have just in the interrupt request the thing would get confused
@@ -25,6 +36,10 @@ _ZN4myos21hardwarecommunication16InterruptManager26HandleInterruptRequest\num\()
   # so we have to push something so that this structure works
   pushl $0
 
+  # the number goes onto the stack too, with more than one processor
+  # a global variable for it would be overwritten by the others
+  pushl $\num + IRQ_BASE
+
   jmp int_bottom
 .endm
 
@@ -35,17 +50,17 @@ HandleException 0x03
 HandleException 0x04
 HandleException 0x05
 HandleException 0x06
-HandleException 0x07
-HandleException 0x08
+HandleException 0x07 # device not available (FPU)
+HandleExceptionErrorCode 0x08 # double fault
 HandleException 0x09
-HandleException 0x0A
-HandleException 0x0B
-HandleException 0x0C
-HandleException 0x0D
-HandleException 0x0E
+HandleExceptionErrorCode 0x0A
+HandleExceptionErrorCode 0x0B
+HandleExceptionErrorCode 0x0C
+HandleExceptionErrorCode 0x0D # general protection fault
+HandleExceptionErrorCode 0x0E # page fault
 HandleException 0x0F
 HandleException 0x10
-HandleException 0x11
+HandleExceptionErrorCode 0x11
 HandleException 0x12
 HandleException 0x13
 
@@ -66,8 +81,11 @@ HandleInterruptRequest 0x0D
 HandleInterruptRequest 0x0E
 HandleInterruptRequest 0x0F
 HandleInterruptRequest 0x31
+HandleInterruptRequest 0x20 # 0x40 local APIC timer
+HandleInterruptRequest 0x21 # 0x41 reschedule, from another processor
 
 HandleInterruptRequest 0x80 # syscall
+HandleInterruptRequest 0x81 # yield
 
 int_bottom:
 
@@ -102,14 +120,22 @@ int_bottom:
 
   # call C++ Handler
   # basically jump into the handle interrupt function
+  #
+  # CPUState::interrupt is 7 registers above us, and one more after the push of esp
   pushl %esp
-  push (interruptnumber)
+  pushl 32(%esp)
   call _ZN4myos21hardwarecommunication16InterruptManager15HandleInterruptEhj
 
   # add %esp, 6
   # add $5, %esp   # pop the old stack pointer
   mov %eax, %esp # switch the stack # overwrite esp with the result value from the handleInterrupt function
 
+  # only now that we are on the stack of the next task another processor may
+  # take the last one (and free its stack), see KernelLock
+  pushl %esp
+  call _ZN4myos21hardwarecommunication16InterruptManager14LeaveInterruptEj
+  add $4, %esp
+
   # restore registers
   popl %eax
   popl %ebx
@@ -125,9 +151,9 @@ int_bottom:
   # popl %ds
   # popa
 
-  # for this error value that we have just pushed up there
-  # we need to add 4 to ESP so here we pop that again
-  add $4, %esp
+  # for the interrupt number and this error value that we have just pushed up there
+  # we need to add 8 to ESP so here we pop them again
+  add $8, %esp
 
 .global _ZN4myos21hardwarecommunication16InterruptManager15InterruptIgnoreEv
 
@@ -137,7 +163,3 @@ _ZN4myos21hardwarecommunication16InterruptManager15InterruptIgnoreEv:
   # or if we have switched the stack then it will jump it will work on the diffreent process
   iret       # interrupt return
 
-# we need to also have this interrupt number is a byte which is initialized to zero
-.data
-  interruptnumber: .byte 0
-
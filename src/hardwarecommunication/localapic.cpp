@@ -0,0 +1,129 @@
+#include <hardwarecommunication/localapic.h>
+#include <drivers/timer.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::drivers;
+using namespace myos::hardwarecommunication;
+
+// the registers, every one is 16 bytes apart
+static const uint32_t IdRegister               = 0x020;
+static const uint32_t EndOfInterruptRegister   = 0x0B0;
+static const uint32_t SpuriousRegister         = 0x0F0;
+static const uint32_t CommandLowRegister       = 0x300;
+static const uint32_t CommandHighRegister      = 0x310;
+static const uint32_t TimerRegister            = 0x320;
+static const uint32_t TimerInitialRegister     = 0x380;
+static const uint32_t TimerCurrentRegister     = 0x390;
+static const uint32_t TimerDivideRegister      = 0x3E0;
+
+// 10 ms of the PIT, for the calibration
+static const uint16_t CalibrationCounts = 11932;
+
+LocalAPIC* LocalAPIC::activeLocalAPIC = 0;
+
+LocalAPIC::LocalAPIC(uint32_t base) {
+  registers = (volatile uint32_t*)base;
+  timerCountsPerTick = 0;
+
+  if (activeLocalAPIC == 0) {
+    activeLocalAPIC = this;
+  }
+}
+
+LocalAPIC::~LocalAPIC() {
+  if (activeLocalAPIC == this) {
+    activeLocalAPIC = 0;
+  }
+}
+
+bool LocalAPIC::Present() {
+  // cpuid with eax = 1: edx bit 9
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & (1 << 9)) != 0;
+}
+
+uint32_t LocalAPIC::Read(uint32_t offset) {
+  return registers[offset / 4];
+}
+
+void LocalAPIC::Write(uint32_t offset, uint32_t value) {
+  registers[offset / 4] = value;
+}
+
+uint8_t LocalAPIC::Id() {
+  return Read(IdRegister) >> 24;
+}
+
+void LocalAPIC::Activate() {
+  // bit 8 switches it on, the LINT0 and LINT1 entries stay like the BIOS set them
+  Write(SpuriousRegister, 0x100 | SpuriousInterrupt);
+}
+
+void LocalAPIC::EndOfInterrupt() {
+  Write(EndOfInterruptRegister, 0);
+}
+
+void LocalAPIC::Send(uint8_t apicId, uint32_t command) {
+  Write(CommandHighRegister, (uint32_t)apicId << 24);
+  Write(CommandLowRegister, command);
+
+  // bit 12: delivery status, still sending
+  while ((Read(CommandLowRegister) & (1 << 12)) != 0) {
+    asm volatile("pause");
+  }
+}
+
+void LocalAPIC::SendInit(uint8_t apicId) {
+  // delivery mode 5 (INIT), level assert
+  Send(apicId, 0x4500);
+}
+
+void LocalAPIC::SendStartup(uint8_t apicId, uint32_t trampoline) {
+  // delivery mode 6 (startup), the processor starts in real mode at
+  // vector << 12, so the trampoline must be on a page below 1 MiB
+  Send(apicId, 0x4600 | ((trampoline >> 12) & 0xFF));
+}
+
+void LocalAPIC::SendInterrupt(uint8_t apicId, uint8_t interrupt) {
+  // delivery mode 0 (fixed), level assert
+  Send(apicId, 0x4000 | interrupt);
+}
+
+void LocalAPIC::CalibrateTimer(ProgrammableIntervalTimer* timer, uint32_t tickMicroseconds) {
+  // divide by 16, one shot and masked, from the largest value
+  Write(TimerDivideRegister, 0x3);
+  Write(TimerRegister, 1 << 16);
+  Write(TimerInitialRegister, 0xFFFFFFFF);
+
+  timer->Wait(CalibrationCounts);
+
+  uint32_t countsPer10Milliseconds = 0xFFFFFFFF - Read(TimerCurrentRegister);
+  Write(TimerInitialRegister, 0);
+
+  // 10 ms are 10000 microseconds, in two steps so it fits into 32 bits
+  timerCountsPerTick = countsPer10Milliseconds / 100 * (tickMicroseconds / 100);
+  if (timerCountsPerTick == 0) {
+    timerCountsPerTick = 1;
+  }
+}
+
+void LocalAPIC::StartTimer(uint8_t interrupt) {
+  // bit 17: periodic
+  Write(TimerDivideRegister, 0x3);
+  Write(TimerRegister, (1 << 17) | interrupt);
+  Write(TimerInitialRegister, timerCountsPerTick);
+}
+
+void LocalAPIC::OneShotTimer(uint8_t interrupt, uint32_t ticks) {
+  // the counter has 32 bits
+  if (ticks > 0xFFFFFFFF / timerCountsPerTick) {
+    ticks = 0xFFFFFFFF / timerCountsPerTick;
+  }
+
+  // without bit 17 it counts down once, writing the initial count starts it
+  Write(TimerDivideRegister, 0x3);
+  Write(TimerRegister, interrupt);
+  Write(TimerInitialRegister, ticks * timerCountsPerTick);
+}
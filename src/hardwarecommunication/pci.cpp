@@ -1,5 +1,6 @@
 #include <hardwarecommunication/pci.h>
 #include <drivers/amd_am79c973.h>
+#include <slabcache.h>
 
 using namespace myos::common;
 using namespace myos::drivers;
@@ -210,6 +211,10 @@ BaseAddressRegister PeripheralComponentInterconnectController::GetBaseAddressReg
   return result;
 }
 
+// the driver objects are not allocated one by one from the heap
+// but from a cache which only holds objects of that driver
+static myos::SlabCache<amd_am79c973> amd_am79c973Cache(0, 0, myos::MemoryTagDrivers);
+
 Driver* PeripheralComponentInterconnectController::GetDriver(PeripheralComponentInterconnectDeviceDescriptor dev, InterruptManager* interrupts) {
 
   Driver *driver = 0;
@@ -228,7 +233,7 @@ Driver* PeripheralComponentInterconnectController::GetDriver(PeripheralComponent
           // you allocated a size of class you give here and then
           // you have to check explicitly if this is 0
           // only if it is not NULL you call the constructor explicitly
-          driver = (amd_am79c973*)MemoryManager::activeMemoryManager->malloc(sizeof(amd_am79c973));
+          driver = amd_am79c973Cache.Allocate();
           if (driver != 0) {
             new (driver) amd_am79c973(&dev, interrupts);
           }
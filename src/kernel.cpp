@@ -1,6 +1,19 @@
 #include <common/types.h>
 #include <gdt.h>
+#include <physicalmemory.h>
 #include <memorymanagement.h>
+#include <memorytrace.h>
+#include <reservepool.h>
+#include <paging.h>
+#include <clock.h>
+#include <fpu.h>
+#include <zeropagepool.h>
+#include <stackpool.h>
+#include <synchronization.h>
+#include <workqueue.h>
+#include <coroutine.h>
+#include <smp.h>
+#include <dmapool.h>
 #include <hardwarecommunication/interrupts.h>
 #include <syscalls.h>
 #include <hardwarecommunication/pci.h>
@@ -9,6 +22,8 @@
 #include <drivers/mouse.h>
 #include <drivers/vga.h>
 #include <drivers/ata.h>
+#include <drivers/serial.h>
+#include <drivers/timer.h>
 #include <gui/desktop.h>
 #include <gui/window.h>
 #include <multitasking.h>
@@ -20,6 +35,15 @@
 
 // #define GRAPHICSMODE
 
+// timer interrupts per second, the length of a scheduler tick
+static const myos::common::uint32_t TimerFrequency = 100;
+
+// stop the timer interrupt while nothing runs, see TaskManager::Idle
+#define TICKLESS
+
+// record every malloc and free and send them over COM1 (see tools/allocreplay.cpp)
+// #define MEMORYTRACE
+
 using namespace myos;
 using namespace myos::common;
 using namespace myos::drivers;
@@ -145,6 +169,9 @@ void sysprintf(char* str) {
 void taskA() { while(true) { sysprintf("A"); } }
 void taskB() { while(true) { sysprintf("B"); } }
 
+// the callbacks of the expired timers run in this task, not in the timer interrupt
+void timerTask() { TaskManager::activeTaskManager->RunTimers(); }
+
 // Write a custom contructor
 typedef void (*constructor)();
 extern "C" constructor start_ctors;
@@ -158,45 +185,47 @@ extern "C" void callConstructors() {
 extern "C" void kernelMain(const void* multiboot_structure, uint32_t /*multiboot_magic*/) {
   printf("Hello World!\n");
 
-  GlobalDescriptorTable gdt;
-
-  // instantiate one
-  // the question really is what values do we pass here
-  // so I will just hard code this to start at 10MB
-  // but what should we use as the size
-  // we have given the virtaul machine 64 MB so we could use just 54 MB as size here
-  // but that wouldn't be protable so what I'm going to do instead
-  // as far as I know there is a BIOS interrupt which will give you the size of the memory but I really
-  // don't want to got into interrupts inside the C++ code
-  // so there's actually a better way to get this
-  //
-  // so here's a situation is this
-  // we are getting this pointer to the multi boot structure from grub right
-  // and so far we haven't done anything with it
-  // but when you look into the multibook.h from the group project also known as linux
+  GlobalDescriptorTable gdt(&CPU::cpus[0]);
+
+  // grub gives us a pointer to the multiboot structure
   // (https://www.gnu.org/software/grub/manual/multiboot/html_node/multiboot_002eh.html)
-  // then you will find this structure here the multiboot_info
-  // and there you see how this data is structured
-  // so you could just copy that multiboot.h and include it
-  // and then you could use multiboot_info pointer instead of void pointer
+  // and in there is a map of the physical memory, which parts are RAM and which
+  // parts are reserved or holes
   //
-  // is I'll take this pointer to the multiboot_structure at 8 bytes and
-  // cast the result to in you 32 pointer
-  uint32_t *memupper = (uint32_t*)(((size_t)multiboot_structure) + 8);
-
-  // hard coding heap to 10MB
-  size_t heap = 10*1024*1024;
-
-  // and here as size I will just take the content of that pointer
-  // multiply it with 1024 because it is in kilobytes
-  // and I will substruct the address where the heap starts
-  // and I will also substract 10 kilobytes of padding behind the heap
-  MemoryManager memoryManager(heap, (*memupper)*1024 - heap - 10*1024);
-  printf("heap: 0x");
-  printfHex((heap >> 24) & 0xFF);
-  printfHex((heap >> 16) & 0xFF);
-  printfHex((heap >>  8) & 0xFF);
-  printfHex((heap      ) & 0xFF);
+  // so we give that map to the PhysicalMemoryManager, it hands out frames of 4 KiB
+  // and the MemoryManager takes blocks of frames from it whenever the heap is full
+  PhysicalMemoryManager physicalMemoryManager((MultibootInformation*)multiboot_structure);
+  MemoryManager memoryManager(&physicalMemoryManager);
+
+  // the tasks preempt each other in the middle of a malloc
+  Spinlock heapLock;
+  memoryManager.SetLock(&heapLock);
+
+#ifdef MEMORYTRACE
+  SerialPort serial;
+  serial.Activate();
+  MemoryTrace memoryTrace;
+  memoryManager.SetTrace(&memoryTrace);
+#endif
+
+  // page tables and user pages must be cleared before we use them,
+  // the main loop clears some frames in advance while there is nothing else to do
+  ZeroPagePool zeroPages(&physicalMemoryManager);
+
+  // switch on paging, the kernel and all the RAM are mapped with 4 MiB pages
+  // at the same virtual address as their physical address
+  PageTableManager pageTableManager(&physicalMemoryManager);
+  pageTableManager.Activate();
+
+  // the network card and the other PCI bus masters get their rings and buffers from here
+  DirectMemoryAccessPool dmaPool(&physicalMemoryManager, DirectMemoryAccessPool::PciLimit);
+
+  uint32_t frames = physicalMemoryManager.FreeFrameCount();
+  printf("free frames: 0x");
+  printfHex((frames >> 24) & 0xFF);
+  printfHex((frames >> 16) & 0xFF);
+  printfHex((frames >>  8) & 0xFF);
+  printfHex((frames      ) & 0xFF);
 
   void* allocated = memoryManager.malloc(1024);
   printf("\nallocated: 0x");
@@ -205,10 +234,36 @@ extern "C" void kernelMain(const void* multiboot_structure, uint32_t /*multiboot
   printfHex(((size_t)allocated >>  8) & 0xFF);
   printfHex(((size_t)allocated      ) & 0xFF);
   printf("\n");
+  memoryManager.PrintStatistics();
+
+  // the stacks of the tasks, the ones of the tasks that are gone are used again
+  StackPool stacks(&physicalMemoryManager);
 
   // the reason why I instantiated it up there is because
   // the interrupt handler will need to talk to the taskManager to do the scheduling
-  TaskManager taskManager;
+  TaskManager taskManager(&gdt);
+
+  // the timer interrupt comes TimerFrequency times per second, that is the tick of the scheduler
+  ProgrammableIntervalTimer timer(TimerFrequency);
+  timer.Activate();
+  taskManager.SetTimer(&timer);
+
+  // now_ns() and everything that measures time
+  Clock clock(&timer);
+#ifdef TICKLESS
+  taskManager.SetTickless(true);
+#endif
+
+  Task timers(&gdt, timerTask, TaskPriorityTimer);
+  taskManager.AddTask(&timers);
+
+  // the bottom halves of the interrupt handlers, before the drivers queue anything
+  WorkQueue tasklets(&taskManager, TaskPrioritySoftInterrupt);
+  WorkQueue workers(&taskManager, TaskPriorityNormal, 2);
+
+  // one task for all the small things that wait a lot, like ARP requests
+  CoroutineExecutor coroutines(&taskManager);
+
 #ifdef AB_TASK
   Task task1(&gdt, taskA);
   Task task2(&gdt, taskB);
@@ -218,6 +273,12 @@ extern "C" void kernelMain(const void* multiboot_structure, uint32_t /*multiboot
 
   InterruptManager interrupts(0x20, &gdt, &taskManager);
   SyscallHandler syscalls(&interrupts, 0x80);
+  PageFaultHandler pageFaults(&interrupts, &pageTableManager);
+
+  // the FPU and SSE, their registers are switched only for the tasks that use them
+  FloatingPointUnit fpu(&interrupts);
+  fpu.Activate();
+  taskManager.SetFloatingPointUnit(&fpu);
 
   printf("Initializing Hardware, Stage 1\n");
 
@@ -268,11 +329,11 @@ extern "C" void kernelMain(const void* multiboot_structure, uint32_t /*multiboot
 #ifdef ATA
   // interrupt 14
   printf("\nS-ATA primary master: ");
-  AdvancedTechnologyAttachment ata0m(true, 0x1F0); // master, portBase: 0x1F0
+  AdvancedTechnologyAttachment ata0m(&interrupts, true, 0x1F0); // master, portBase: 0x1F0
   ata0m.Identify();
 
   printf("\nS-ATA primary slave: ");
-  AdvancedTechnologyAttachment ata0s(false, 0x1F0); // slave
+  AdvancedTechnologyAttachment ata0s(&interrupts, false, 0x1F0); // slave
   ata0s.Identify();
 
   // write something to the disk and flush. after that read it.
@@ -282,11 +343,11 @@ extern "C" void kernelMain(const void* multiboot_structure, uint32_t /*multiboot
 
   // interrupt 15
   printf("\nS-ATA secondary master: ");
-  AdvancedTechnologyAttachment ata1m(true, 0x170); // master, portBase: 0x1F0
+  AdvancedTechnologyAttachment ata1m(&interrupts, true, 0x170); // master, portBase: 0x1F0
   ata1m.Identify();
 
   printf("\nS-ATA secondary slave: ");
-  AdvancedTechnologyAttachment ata1s(false, 0x170); // slave
+  AdvancedTechnologyAttachment ata1s(&interrupts, false, 0x170); // slave
   ata1s.Identify();
 
   // third portBase: 0x1E8
@@ -337,6 +398,11 @@ extern "C" void kernelMain(const void* multiboot_structure, uint32_t /*multiboot
   // so that's why this really should be the last thing here
   interrupts.Activate();
 
+  // wake up the other processors, they need the interrupts of this one
+  // (and the KernelLock) for that, so this comes after the Activate
+  ProcessorManager processors(&taskManager, &pageTableManager, &timer);
+  processors.StartAll();
+
   // ARP: We can get an answer only after the interrputs are activated.
   // Because when we get an answer, this is done through an interrupt handler.
   // printf("\n");
@@ -346,9 +412,22 @@ extern "C" void kernelMain(const void* multiboot_structure, uint32_t /*multiboot
   // 0x0008 is big endian encoding for ipv4
   ipv4.Send(gip_be, 0x0008, (uint8_t*) "foobar", 6); // send something to the gateway
 
-  // when we start the multitasking,
-  // this loop will never be executed anymore
+  // this loop is the idle task: the TaskManager comes back here whenever
+  // no task is ready, so we do the work that can wait and then halt
+  // until the next interrupt instead of spinning
   while(1) {
+    // the interrupt handlers took buffers from their ReservePools,
+    // out here we are allowed to malloc new ones
+    ReservePool::RefillAll();
+
+    // the detached tasks that have exited
+    taskManager.ReapZombies();
+
+    // one frame per round, so we don't sit here for long when there is work
+    bool busy = zeroPages.Fill();
+#ifdef MEMORYTRACE
+    memoryTrace.Flush(&serial);
+#endif
 #ifdef GRAPHICSMODE
     // draw the desktop in the loop
     //
@@ -359,5 +438,9 @@ extern "C" void kernelMain(const void* multiboot_structure, uint32_t /*multiboot
     // and then you should just have a different task for the redrawing here
     desktop.Draw(&vga);
 #endif
+
+    if (!busy) {
+      taskManager.Idle();
+    }
   }
 }
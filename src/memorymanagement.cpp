@@ -1,4 +1,5 @@
 #include <memorymanagement.h>
+#include <synchronization.h>
 
 using namespace myos;
 using namespace myos::common;
@@ -6,32 +7,126 @@ using namespace myos::common;
 MemoryManager* MemoryManager::activeMemoryManager = 0;
 
 MemoryManager::MemoryManager(size_t start, size_t size) {
-  // set the activeMemoryManager to this
-  activeMemoryManager = this;
+  Initialize(0);
 
   // the data that the MemoryManager is going to handle
   // so this is where we put the first MemoryChunk
-  // but if the size that we get here **isn't sufficient**
+  AddRegion(start, size);
+}
+
+MemoryManager::MemoryManager(PhysicalMemoryManager* frames) {
+  // we don't get any memory here
+  // the heap grows with blocks of frames the first time malloc needs memory
+  Initialize(frames);
+}
+
+void MemoryManager::Initialize(PhysicalMemoryManager* frames) {
+  // the first MemoryManager is the kernel heap
+  // others (like the heap of the DMA pool) must not take over operator new
+  if (activeMemoryManager == 0) {
+    activeMemoryManager = this;
+  }
+
+  this->frames = frames;
+  numRegions = 0;
+
+  // all the bins are empty in the beginning
+  for (uint32_t i = 0; i < NumBins; i++) {
+    bins[i] = 0;
+    binStatistics[i].hits = 0;
+    binStatistics[i].misses = 0;
+    binStatistics[i].releases = 0;
+  }
+  binBitmap = 0;
+
+  policy = MemoryPolicyBins;
+  trace = 0;
+  lock = 0;
+
+  statistics.bytesInUse = 0;
+  statistics.peakBytesInUse = 0;
+  statistics.allocations = 0;
+  statistics.frees = 0;
+  statistics.failedAllocations = 0;
+  statistics.largestFreeBlock = 0;
+  for (uint32_t tag = 0; tag < NumMemoryTags; tag++) {
+    statistics.tagBytesInUse[tag] = 0;
+  }
+}
+
+bool MemoryManager::AddRegion(size_t start, size_t size) {
+  if (numRegions == MaxRegions) {
+    return false;
+  }
+
+  // the chunks of the region must start 16 byte aligned
+  size_t end = (start + size) & ~(MinBinSize - 1);
+  start = (start + MinBinSize - 1) & ~(MinBinSize - 1);
+
+  // if the size that we get here **isn't sufficient**
   // we should really protect ourselves against the situation
   // because if the situation arises
   // and we would be writing outside of the area that we are allowed to write
   // so it's not really likely that this happen but to make sure
-  if (size < sizeof(MemoryChunk)) {
-    first = 0;
+  if (end <= start || end - start < sizeof(MemoryRegion) + sizeof(MemoryChunk) + MinBinSize) {
+    return false;
   }
-  else {
 
-    first = (MemoryChunk*)start;
+  // the regions are not next to each other in memory (there are holes in the
+  // physical memory, or the memory in between belongs to someone else)
+  // so every region has its own chunk list and the chunks never merge across regions
+  //
+  // +----------------+----------------+-----------------------------------------+
+  // |     region     |     chunk      |              chunk size                 |
+  // +----------------+----------------+-----------------------------------------+
+  //        |         ^
+  //        +- first -+
+  MemoryRegion* region = (MemoryRegion*)start;
+  MemoryChunk* chunk = (MemoryChunk*)(start + sizeof(MemoryRegion));
+
+  // first chunk is not allocated
+  chunk->allocated = false;
+  chunk->region = numRegions;
+  chunk->size = end - start - sizeof(MemoryRegion) - sizeof(MemoryChunk);
+  chunk->prev = 0;
+  chunk->next = 0;
+
+  region->first = chunk;
+  region->start = start;
+  region->size = end - start;
+  region->largestFree = chunk->size;
+
+  regions[numRegions++] = region;
+  return true;
+}
+
+bool MemoryManager::Grow(size_t size) {
+  if (frames == 0) {
+    return false;
+  }
 
-    // first chunk is not allocated
-    first->allocated = false;
+  // we need room for the region, the chunk and the size itself
+  // and we don't want to go to the PhysicalMemoryManager for every little allocation
+  // the more regions we have, the larger the next one, so the region table doesn't run full
+  uint32_t order = PhysicalMemoryManager::OrderOf(size + sizeof(MemoryRegion) + sizeof(MemoryChunk) + 1);
+  uint32_t minimum = GrowOrder + numRegions / 64;
+  if (minimum > PhysicalMemoryManager::MaxOrder) {
+    minimum = PhysicalMemoryManager::MaxOrder;
+  }
+  if (order < minimum) {
+    order = minimum;
+  }
 
-    // set the first prev and next pointer are 0
-    first->prev = 0;
-    first->next = 0;
+  void* block = frames->AllocateFrames(order);
+  if (block == 0) {
+    return false;
+  }
 
-    first->size = size - sizeof(MemoryChunk);
+  if (!AddRegion((size_t)block, PhysicalMemoryManager::PageSize << order)) {
+    frames->FreeFrames(block, order);
+    return false;
   }
+  return true;
 }
 
 MemoryManager::~MemoryManager() {
@@ -40,24 +135,209 @@ MemoryManager::~MemoryManager() {
   }
 }
 
-void* MemoryManager::malloc(size_t size) {
+uint32_t MemoryManager::BinIndex(size_t size) {
+  // the index of the smallest size class that is large enough
+  //
+  //   size:   1..16  17..32  33..64  ...  1025..2048
+  //   index:    0      1       2     ...      7
+  if (size <= MinBinSize) {
+    return 0;
+  }
+
+  // bsr gives us the index of the highest set bit
+  // so for size - 1 = 0b10000 (size 17) that is 4 and we end up in bin 1
+  return (31 - __builtin_clz(size - 1)) + 1 - 4;
+}
+
+MemoryChunk* MemoryManager::FirstFit(MemoryRegion* region, size_t size) {
   // it doest that in a relatively slow way
   // you know if we allocate a million bytes one by one then the next allocation will take a million iterations to find some free space
   //
   // iterate through the list of chunks and look for a chunk that is large enough
-  MemoryChunk *result = 0;
-  for (MemoryChunk* chunk = first; chunk != 0 && result == 0; chunk = chunk->next) {
+  size_t largest = 0;
+  for (MemoryChunk* chunk = region->first; chunk != 0; chunk = chunk->next) {
+    if (chunk->allocated) {
+      continue;
+    }
+
     // chunk is free and large enough
-    if (chunk->size > size && !chunk->allocated) {
+    if (chunk->size > size) {
+      return chunk;
+    }
+
+    if (chunk->size > largest) {
+      largest = chunk->size;
+    }
+  }
+
+  // we have seen all the free chunks of the region, so now we know its largest one
+  region->largestFree = largest;
+  return 0;
+}
+
+void MemoryManager::SetPolicy(uint32_t policy) {
+  // without bins the chunks that are parked there would never come back
+  if (!(policy & MemoryPolicyBins)) {
+    FlushBins();
+  }
+  this->policy = policy;
+}
+
+void MemoryManager::SetTrace(MemoryTrace* trace) {
+  this->trace = trace;
+}
+
+void MemoryManager::SetLock(Spinlock* lock) {
+  this->lock = lock;
+}
+
+MemoryChunk* MemoryManager::BestFit(MemoryRegion* region, size_t size) {
+  // the whole list every time, but the large free chunks stay in one piece
+  MemoryChunk *result = 0;
+  size_t largest = 0;
+  for (MemoryChunk* chunk = region->first; chunk != 0; chunk = chunk->next) {
+    if (chunk->allocated) {
+      continue;
+    }
+
+    if (chunk->size > largest) {
+      largest = chunk->size;
+    }
+
+    if (chunk->size > size && (result == 0 || chunk->size < result->size)) {
       result = chunk;
+
+      // it can't get any better than that
+      if (chunk->size < size + sizeof(MemoryChunk) + 1) {
+        return result;
+      }
     }
   }
 
-  // if we haven't found anything result large enough
+  region->largestFree = largest;
+  return result;
+}
+
+void* MemoryManager::malloc(size_t size, MemoryTag tag) {
+  uint32_t eflags = lock != 0 ? lock->LockSave() : 0;
+
+  void* ptr = Allocate(size, tag);
+  if (trace != 0) {
+    trace->Record(MemoryTraceMalloc, tag, size, 0, ptr, __builtin_return_address(0));
+  }
+
+  if (lock != 0) {
+    lock->UnlockRestore(eflags);
+  }
+  return ptr;
+}
+
+void* MemoryManager::malloc_aligned(size_t size, size_t align, MemoryTag tag) {
+  uint32_t eflags = lock != 0 ? lock->LockSave() : 0;
+
+  void* ptr = AllocateAligned(size, align, tag);
+  if (trace != 0) {
+    trace->Record(MemoryTraceMallocAligned, tag, size, align, ptr, __builtin_return_address(0));
+  }
+
+  if (lock != 0) {
+    lock->UnlockRestore(eflags);
+  }
+  return ptr;
+}
+
+void* MemoryManager::Allocate(size_t size, MemoryTag tag) {
+  // the common case are small allocations like packet buffers and driver objects
+  // so we round them up to their size class and look into the free list of that class
+  // if somebody has freed a chunk of this size before then we just take it
+  // and we don't have to walk the chunk list at all
+  if (size <= MaxBinSize && (policy & MemoryPolicyBins)) {
+    uint32_t bin = BinIndex(size);
+    size = MinBinSize << bin;
+
+    if (binBitmap & (1 << bin)) {
+      MemoryChunk* chunk = bins[bin];
+
+      // the next chunk of the bin is stored in the payload
+      bins[bin] = *(MemoryChunk**)((size_t)chunk + sizeof(MemoryChunk));
+      if (bins[bin] == 0) {
+        binBitmap &= ~(1 << bin);
+      }
+
+      binStatistics[bin].hits++;
+      CountAllocation(chunk, tag);
+      return (void*)(((size_t)chunk) + sizeof(MemoryChunk));
+    }
+
+    binStatistics[bin].misses++;
+  }
+  else {
+    // the other chunks keep the payloads of the chunks behind them 16 byte aligned
+    size = (size + MinBinSize - 1) & ~(MinBinSize - 1);
+  }
+
+  // otherwise we fall back to the chunk list
+  MemoryChunk* result = Find(size);
   if (result == 0) {
+    statistics.failedAllocations++;
     return 0;
   }
 
+  // cut off what we don't need and return the address behind the MemoryChunk
+  //
+  // +----------------+--------------------------------+
+  // |  result chunk  |        requested size          |
+  // +----------------+--------------------------------+
+  //                  ^
+  //          return this address
+  result = Split(result, size);
+  CountAllocation(result, tag);
+  return (void*)(((size_t)result) + sizeof(MemoryChunk));
+}
+
+MemoryChunk* MemoryManager::Fit(size_t size) {
+  // every region knows how large its largest free chunk is at most
+  // so we only walk the chunk list of a region that can have a chunk for us
+  for (uint32_t i = 0; i < numRegions; i++) {
+    MemoryRegion* region = regions[i];
+    if (region->largestFree <= size) {
+      continue;
+    }
+
+    MemoryChunk* result;
+    if (policy & MemoryPolicyBestFit) {
+      result = BestFit(region, size);
+    }
+    else {
+      result = FirstFit(region, size);
+    }
+
+    if (result != 0) {
+      return result;
+    }
+  }
+
+  return 0;
+}
+
+MemoryChunk* MemoryManager::Find(size_t size) {
+  MemoryChunk *result = Fit(size);
+
+  // the free space might be hidden in the bins
+  // so give all the binned chunks back to the chunk list and try again
+  if (result == 0 && FlushBins()) {
+    result = Fit(size);
+  }
+
+  // and if there is really no space left then we ask for more frames
+  if (result == 0 && Grow(size)) {
+    result = Fit(size);
+  }
+
+  return result;
+}
+
+MemoryChunk* MemoryManager::Split(MemoryChunk* result, size_t size) {
   // 
   // the chunk that is free and large enough
   // 
@@ -80,6 +360,7 @@ void* MemoryManager::malloc(size_t size) {
     MemoryChunk* temp = (MemoryChunk*)((size_t)result + sizeof(MemoryChunk) + size);
 
     temp->allocated = false;
+    temp->region = result->region;
 
     // calculate the new chunk size: just cut off the new chunk and the size of requested
     temp->size = result->size - sizeof(MemoryChunk) - size;
@@ -111,19 +392,80 @@ void* MemoryManager::malloc(size_t size) {
   // 
   // so we mark the few bytes as allocated
   result->allocated = true;
+  return result;
+}
 
-  // return the result address + the size of MemoryChunk
-  // so this is a pointer to the beginning of the region that I have allocated
+void* MemoryManager::AllocateAligned(size_t size, size_t align, MemoryTag tag) {
+  // every payload is 16 byte aligned anyway
+  if (align <= MinBinSize) {
+    return Allocate(size, tag);
+  }
+
+  // align must be a power of two
+  if ((align & (align - 1)) != 0) {
+    statistics.failedAllocations++;
+    return 0;
+  }
+
+  // the same sizes as malloc, then free can put the chunk into its bin later
+  if (size <= MaxBinSize && (policy & MemoryPolicyBins)) {
+    size = MinBinSize << BinIndex(size);
+  }
+  else {
+    size = (size + MinBinSize - 1) & ~(MinBinSize - 1);
+  }
+
+  // a chunk that is large enough for the size even if
+  // the aligned address is almost align bytes behind its payload
+  MemoryChunk* result = Find(size + align);
+  if (result == 0) {
+    statistics.failedAllocations++;
+    return 0;
+  }
+
+  size_t payload = (size_t)result + sizeof(MemoryChunk);
+  size_t aligned = (payload + align - 1) & ~(align - 1);
+
+  // both addresses are 16 byte aligned, so if they are not the same then
+  // there is at least room for a MemoryChunk in front of the aligned address
   //
-  // +-------------------------------------------------+
-  // |  result chunk  |        requested size          |
-  // +----------------+--------------------------------+
-  //                  ^
-  //          return this address
+  // +----------------+------------+----------------+-----------------------------+
+  // |  result chunk  |  leftover  |  aligned chunk |        requested size   ...  |
+  // +----------------+------------+----------------+-----------------------------+
+  //                                                ^
+  //                                             aligned
+  //
+  // the result chunk keeps the leftover and goes back to the chunk list
+  if (aligned != payload) {
+    MemoryChunk* chunk = (MemoryChunk*)(aligned - sizeof(MemoryChunk));
+
+    chunk->allocated = true;
+    chunk->region = result->region;
+    chunk->size = result->size - (aligned - payload);
+    chunk->prev = result;
+    chunk->next = result->next;
+    if (chunk->next != 0) {
+      chunk->next->prev = chunk;
+    }
+
+    result->size = aligned - payload - sizeof(MemoryChunk);
+    result->next = chunk;
+
+    // the leftover can even be empty, but the previous chunk swallows it if it is free
+    Release(result);
+    result = chunk;
+  }
+
+  result = Split(result, size);
+  CountAllocation(result, tag);
   return (void*)(((size_t)result) + sizeof(MemoryChunk));
 }
 
 void MemoryManager::free(void* ptr) {
+  if (ptr == 0) {
+    return;
+  }
+
   // get the chunk pointer by subtract the size of MemoryChunk
   //
   //   +----------------+--------------------------------+
@@ -133,6 +475,35 @@ void MemoryManager::free(void* ptr) {
   // chunk             ptr
   MemoryChunk* chunk = (MemoryChunk*)((size_t)ptr - sizeof(MemoryChunk));
 
+  uint32_t eflags = lock != 0 ? lock->LockSave() : 0;
+  CountFree(chunk);
+
+  if (trace != 0) {
+    trace->Record(MemoryTraceFree, chunk->tag, chunk->size, 0, ptr, __builtin_return_address(0));
+  }
+
+  // small chunks are not merged but parked in the bin of their size class
+  // the chunk might be a bit larger than its size class if it couldn't be split
+  // so we take the largest size class that still fits into the chunk
+  if (chunk->size <= MaxBinSize && (policy & MemoryPolicyBins)) {
+    uint32_t bin = (31 - __builtin_clz(chunk->size)) - 4;
+
+    *(MemoryChunk**)ptr = bins[bin];
+    bins[bin] = chunk;
+    binBitmap |= (1 << bin);
+
+    binStatistics[bin].releases++;
+  }
+  else {
+    Release(chunk);
+  }
+
+  if (lock != 0) {
+    lock->UnlockRestore(eflags);
+  }
+}
+
+void MemoryManager::Release(MemoryChunk* chunk) {
   chunk->allocated = false;
 
   // merge the chunk with the previous one
@@ -160,6 +531,187 @@ void MemoryManager::free(void* ptr) {
       chunk->next->prev = chunk;
     }
   }
+
+  // the summary of the region can only grow here
+  MemoryRegion* region = regions[chunk->region];
+  if (chunk->size > region->largestFree) {
+    region->largestFree = chunk->size;
+  }
+}
+
+void MemoryManager::CountAllocation(MemoryChunk* chunk, MemoryTag tag) {
+  chunk->tag = tag;
+
+  statistics.allocations++;
+  statistics.bytesInUse += chunk->size;
+  statistics.tagBytesInUse[tag] += chunk->size;
+  if (statistics.bytesInUse > statistics.peakBytesInUse) {
+    statistics.peakBytesInUse = statistics.bytesInUse;
+  }
+}
+
+void MemoryManager::CountFree(MemoryChunk* chunk) {
+  statistics.frees++;
+  statistics.bytesInUse -= chunk->size;
+  statistics.tagBytesInUse[chunk->tag] -= chunk->size;
+}
+
+bool MemoryManager::FlushBins() {
+  bool released = false;
+
+  // walk through all non-empty bins and really free their chunks
+  // so that they can be merged with their neighbours again
+  for (uint32_t bin = 0; bin < NumBins; bin++) {
+    while (bins[bin] != 0) {
+      MemoryChunk* chunk = bins[bin];
+      bins[bin] = *(MemoryChunk**)((size_t)chunk + sizeof(MemoryChunk));
+      Release(chunk);
+      released = true;
+    }
+  }
+  binBitmap = 0;
+
+  return released;
+}
+
+MemoryBinStatistics MemoryManager::GetBinStatistics(uint32_t bin) {
+  if (bin >= NumBins) {
+    MemoryBinStatistics empty = { 0, 0, 0 };
+    return empty;
+  }
+  return binStatistics[bin];
+}
+
+void printf(char*);
+void printfHex16(uint16_t);
+void printfHex32(uint32_t);
+
+void MemoryManager::PrintBinStatistics() {
+  // one line per size class
+  //   bin 0x0010: hits 0x00000123 misses 0x00000004 releases 0x00000120
+  for (uint32_t bin = 0; bin < NumBins; bin++) {
+    printf("bin 0x");
+    printfHex16(MinBinSize << bin);
+    printf(": hits 0x");
+    printfHex32(binStatistics[bin].hits);
+    printf(" misses 0x");
+    printfHex32(binStatistics[bin].misses);
+    printf(" releases 0x");
+    printfHex32(binStatistics[bin].releases);
+    printf("\n");
+  }
+}
+
+MemoryStatistics MemoryManager::GetStatistics() {
+  MemoryFragmentation fragmentation;
+  GetFragmentation(&fragmentation);
+
+  statistics.largestFreeBlock = fragmentation.largestFreeBlock;
+  return statistics;
+}
+
+void MemoryManager::GetFragmentation(MemoryFragmentation* fragmentation) {
+  for (uint32_t bucket = 0; bucket < MemoryFragmentation::NumBuckets; bucket++) {
+    fragmentation->freeChunks[bucket] = 0;
+  }
+  fragmentation->freeBytes = 0;
+  fragmentation->largestFreeBlock = 0;
+  fragmentation->largestFreeBlocks = 0;
+  fragmentation->binnedChunks = 0;
+  fragmentation->binnedBytes = 0;
+
+  fragmentation->regions = numRegions;
+
+  // walk through all the chunks of all the regions
+  for (uint32_t i = 0; i < numRegions; i++) {
+    size_t largest = 0;
+
+    for (MemoryChunk* chunk = regions[i]->first; chunk != 0; chunk = chunk->next) {
+      if (chunk->allocated || chunk->size == 0) {
+        continue;
+      }
+
+      uint32_t bucket = 0;
+      if (chunk->size >= 2 * MinBinSize) {
+        bucket = (31 - __builtin_clz(chunk->size)) - 4;
+      }
+      if (bucket >= MemoryFragmentation::NumBuckets) {
+        bucket = MemoryFragmentation::NumBuckets - 1;
+      }
+
+      fragmentation->freeChunks[bucket]++;
+      fragmentation->freeBytes += chunk->size;
+      if (chunk->size > largest) {
+        largest = chunk->size;
+      }
+    }
+
+    // now the summary is exact again
+    regions[i]->largestFree = largest;
+    fragmentation->largestFreeBlocks += largest;
+    if (largest > fragmentation->largestFreeBlock) {
+      fragmentation->largestFreeBlock = largest;
+    }
+  }
+
+  for (uint32_t bin = 0; bin < NumBins; bin++) {
+    for (MemoryChunk* chunk = bins[bin]; chunk != 0; chunk = *(MemoryChunk**)((size_t)chunk + sizeof(MemoryChunk))) {
+      fragmentation->binnedChunks++;
+      fragmentation->binnedBytes += chunk->size;
+    }
+  }
+}
+
+void MemoryManager::PrintStatistics() {
+  static char* tagNames[NumMemoryTags] = { "untagged", "kernel", "net", "gui", "drivers" };
+
+  MemoryFragmentation fragmentation;
+  GetFragmentation(&fragmentation);
+  statistics.largestFreeBlock = fragmentation.largestFreeBlock;
+
+  // heap: in use 0x00001000 peak 0x00002000 allocs 0x00000010 frees 0x0000000F failed 0x00000000
+  printf("heap: in use 0x");
+  printfHex32(statistics.bytesInUse);
+  printf(" peak 0x");
+  printfHex32(statistics.peakBytesInUse);
+  printf(" allocs 0x");
+  printfHex32(statistics.allocations);
+  printf(" frees 0x");
+  printfHex32(statistics.frees);
+  printf(" failed 0x");
+  printfHex32(statistics.failedAllocations);
+  printf("\n");
+
+  printf("free 0x");
+  printfHex32(fragmentation.freeBytes);
+  printf(" largest 0x");
+  printfHex32(fragmentation.largestFreeBlock);
+  printf(" binned 0x");
+  printfHex32(fragmentation.binnedBytes);
+  printf(" regions 0x");
+  printfHex32(fragmentation.regions);
+  printf("\n");
+
+  // only the buckets that have chunks, 16 buckets don't fit on the screen
+  for (uint32_t bucket = 0; bucket < MemoryFragmentation::NumBuckets; bucket++) {
+    if (fragmentation.freeChunks[bucket] != 0) {
+      printf("  >= 0x");
+      printfHex32(MinBinSize << bucket);
+      printf(": 0x");
+      printfHex32(fragmentation.freeChunks[bucket]);
+      printf("\n");
+    }
+  }
+
+  for (uint32_t tag = 0; tag < NumMemoryTags; tag++) {
+    if (statistics.tagBytesInUse[tag] != 0) {
+      printf("  ");
+      printf(tagNames[tag]);
+      printf(": 0x");
+      printfHex32(statistics.tagBytesInUse[tag]);
+      printf("\n");
+    }
+  }
 }
 
 void* operator new(unsigned size) {
@@ -178,6 +730,22 @@ void* operator new[](unsigned size) {
   return myos::MemoryManager::activeMemoryManager->malloc(size);
 }
 
+void* operator new(unsigned size, myos::MemoryTag tag) throw() {
+  if (myos::MemoryManager::activeMemoryManager == 0) {
+    return 0;
+  }
+
+  return myos::MemoryManager::activeMemoryManager->malloc(size, tag);
+}
+
+void* operator new[](unsigned size, myos::MemoryTag tag) throw() {
+  if (myos::MemoryManager::activeMemoryManager == 0) {
+    return 0;
+  }
+
+  return myos::MemoryManager::activeMemoryManager->malloc(size, tag);
+}
+
 void* operator new(unsigned size, void* ptr) {
   return ptr;
 }
@@ -197,3 +765,13 @@ void operator delete[](void* ptr) {
     myos::MemoryManager::activeMemoryManager->free(ptr);
   }
 }
+
+// g++ calls these for objects whose size it knows,
+// free doesn't need the size, the chunk knows it
+void operator delete(void* ptr, unsigned size) {
+  operator delete(ptr);
+}
+
+void operator delete[](void* ptr, unsigned size) {
+  operator delete[](ptr);
+}
@@ -0,0 +1,39 @@
+#include <memorytrace.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::drivers;
+
+// there is only one ring, 128 KiB are too much for the kernel stack
+static MemoryTraceRecord traceRing[MemoryTrace::RingSize];
+
+MemoryTrace::MemoryTrace() {
+  ring = traceRing;
+  head = 0;
+  tail = 0;
+  dropped = 0;
+}
+
+MemoryTrace::~MemoryTrace() {
+}
+
+uint32_t MemoryTrace::Flush(SerialPort* serial) {
+  uint32_t end = head;
+
+  // the ring has been overwritten since the last Flush
+  // so the oldest records that are still there start at end - RingSize
+  if (end - tail > RingSize) {
+    dropped += (end - tail) - RingSize;
+    tail = end - RingSize;
+  }
+
+  uint32_t sent = 0;
+  for (; tail != end; tail++, sent++) {
+    serial->Write((uint8_t*)&ring[tail & (RingSize - 1)], sizeof(MemoryTraceRecord));
+  }
+  return sent;
+}
+
+uint32_t MemoryTrace::Dropped() {
+  return dropped;
+}
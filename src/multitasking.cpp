@@ -1,13 +1,78 @@
 #include <multitasking.h>
+#include <hardwarecommunication/interrupts.h>
+#include <hardwarecommunication/localapic.h>
+#include <drivers/timer.h>
+#include <fpu.h>
+#include <stackpool.h>
+#include <slabcache.h>
+#include <memorymanagement.h>
+#include <clock.h>
 using namespace myos;
 using namespace myos::common;
-Task::Task(GlobalDescriptorTable* gdt, void entrypoint()) {
+using namespace myos::drivers;
+using namespace myos::hardwarecommunication;
+
+void printf(char*);
+void printfHex(uint8_t);
+void printfHex32(uint32_t);
+
+// the function of a task returns here, see Task::Setup
+static void TaskReturn() {
+  TaskManager::activeTaskManager->Exit(0);
+}
+
+Task::Task(GlobalDescriptorTable* gdt, void entrypoint(), uint8_t priority, uint32_t stackSize) {
+  Setup(gdt, (uint32_t)entrypoint, 0, priority, stackSize);
+}
+
+Task::Task(GlobalDescriptorTable* gdt, void entrypoint(void*), void* argument, uint8_t priority, uint32_t stackSize) {
+  Setup(gdt, (uint32_t)entrypoint, argument, priority, stackSize);
+}
+
+void Task::Setup(GlobalDescriptorTable* gdt, uint32_t entrypoint, void* argument, uint8_t priority, uint32_t stackSize) {
+  if (priority >= NumTaskPriorities) {
+    priority = NumTaskPriorities - 1;
+  }
+  this->priority = priority;
+  cpu = 0;
+  timeslice = 0;
+  statistics.runNanoseconds = 0;
+  statistics.switches = 0;
+  statistics.wakeups = 0;
+  statistics.maxWakeNanoseconds = 0;
+  readySince = 0;
+  runningSince = 0;
+  state = TaskRunnable;
+  next = 0;
+  waitQueue = 0;
+  timedOut = false;
+  fpuUsed = false;
+
+  id = 0;
+  exitCode = 0;
+  joining = false;
+  detached = false;
+  spawned = false;
+  nonBlocking = false;
+
+  // without a stack AddTask doesn't take the task
+  stack = 0;
+  this->stackSize = 0;
+  cpustate = 0;
+  if (StackPool::activeStackPool != 0) {
+    stack = (uint8_t*)StackPool::activeStackPool->Allocate(stackSize);
+  }
+  if (stack == 0) {
+    return;
+  }
+  this->stackSize = StackPool::RoundUp(stackSize);
+
   // CPUState is supposed to be a pointer to the start of the task stack block here
   // and for a new task this is just all the way to the right
   // so we will set this just as a pointer to the stack
   //
   // the pointer of the start of the stack plus the size of the stack minus size of CPUState
-  cpustate = (CPUState*)(stack + 4096 - sizeof(CPUState));
+  cpustate = (CPUState*)(stack + this->stackSize - sizeof(CPUState));
   
   // set phony entries
   cpustate->eax = 0;
@@ -32,7 +97,7 @@ Task::Task(GlobalDescriptorTable* gdt, void entrypoint()) {
   // cpustate->error = 0;
 
   // instruction pointer is set to the entry point;
-  cpustate->eip = (uint32_t)entrypoint;
+  cpustate->eip = entrypoint;
 
   // in the tutorial, they just set this to 0x08,
   // but got a lot of general projections faults which is the equivalent of a blue screen
@@ -48,63 +113,1017 @@ Task::Task(GlobalDescriptorTable* gdt, void entrypoint()) {
 
   cpustate->eflags = 0x202;
 
-  // comment this out because this only has to do with if we are dealing with user space and different security levels
-  // and we are not doing that for now
-  // cpustate->esp = 0;
-
-  // stack segment also is also not used
-  // cpustate->ss = 0;
+  // esp and ss are only popped by iret if we come from user space, and we
+  // are not doing that for now. So after the iret the stack of the task
+  // starts right there, and for the function of the task these two look
+  // like the return address and its first argument:
+  //
+  //   cpustate->esp   return address -> TaskReturn, so returning is Exit(0)
+  //   cpustate->ss    the argument
+  cpustate->esp = (uint32_t)TaskReturn;
+  cpustate->ss = (uint32_t)argument;
 }
 
 Task::~Task() {
+  if (FloatingPointUnit::activeFloatingPointUnit != 0) {
+    FloatingPointUnit::activeFloatingPointUnit->Release(this);
+  }
+  if (stack != 0 && StackPool::activeStackPool != 0) {
+    StackPool::activeStackPool->Free(stack, stackSize);
+  }
+}
+
+uint32_t Task::Id() {
+  return id;
+}
+
+uint8_t Task::Priority() {
+  return priority;
+}
+
+TaskState Task::State() {
+  return state;
+}
+
+uint32_t Task::StackSize() {
+  return stackSize;
+}
+
+void Task::SetNonBlocking(bool nonBlocking) {
+  this->nonBlocking = nonBlocking;
+}
+
+WaitQueue::WaitQueue() {
+  head = 0;
+  tail = 0;
+  wakeups = 0;
+}
+
+WaitQueue::~WaitQueue() {
+  WakeAll();
 }
 
-TaskManager::TaskManager() {
+void WaitQueue::Append(Task* task) {
+  task->next = 0;
+  task->waitQueue = this;
+  if (tail == 0) {
+    head = task;
+  }
+  else {
+    tail->next = task;
+  }
+  tail = task;
+}
+
+void WaitQueue::Remove(Task* task) {
+  Task* previous = 0;
+  for (Task* t = head; t != 0; previous = t, t = t->next) {
+    if (t != task) {
+      continue;
+    }
+
+    if (previous == 0) {
+      head = t->next;
+    }
+    else {
+      previous->next = t->next;
+    }
+    if (tail == t) {
+      tail = previous;
+    }
+    break;
+  }
+
+  task->next = 0;
+  task->waitQueue = 0;
+}
+
+bool WaitQueue::Wait(uint32_t timeoutMilliseconds) {
+  // in an interrupt handler we can't wait, because the task below us would
+  // wait with us, and before the interrupts are activated nobody would wake us
+  TaskManager* taskManager = TaskManager::activeTaskManager;
+  if (taskManager == 0 || InterruptManager::InInterrupt() || !InterruptManager::Activated()) {
+    return false;
+  }
+  Task* task = taskManager->CurrentTask();
+  if (task != 0 && task->nonBlocking) {
+    return false;
+  }
+
+  return taskManager->Block(this, timeoutMilliseconds);
+}
+
+void WaitQueue::WakeOne() {
+  uint32_t eflags = SaveInterrupts();
+  wakeups++;
+  if (head != 0 && TaskManager::activeTaskManager != 0) {
+    TaskManager::activeTaskManager->Wake(head);
+  }
+  RestoreInterrupts(eflags);
+}
+
+void WaitQueue::WakeAll() {
+  uint32_t eflags = SaveInterrupts();
+  wakeups++;
+  while (head != 0 && TaskManager::activeTaskManager != 0) {
+    TaskManager::activeTaskManager->Wake(head);
+  }
+  RestoreInterrupts(eflags);
+}
+
+TaskManager* TaskManager::activeTaskManager = 0;
+
+TaskManager::TaskManager(GlobalDescriptorTable* gdt) {
   // just set numTasks to 0 because we have no tasks in the beginning
   numTasks = 0;
+  for (int i = 0; i < MaxTasks; i++) {
+    tasks[i] = 0;
+  }
+  this->gdt = gdt;
+  nextId = 1;
+  zombies = 0;
+
+  uint8_t* bytes = (uint8_t*)&statistics;
+  for (uint32_t i = 0; i < sizeof(SchedulerStatistics); i++) {
+    bytes[i] = 0;
+  }
 
-  // and the current task to -1 because it's not set to anything legal inside the array
-  currentTask = -1;
+  // and no current task (see CPU), we are still on the stack of kernelMain
+  for (uint32_t cpu = 0; cpu < CPU::MaxCPUs; cpu++) {
+    RunQueue* queue = &runQueues[cpu];
+    queue->idle = 0;
+    for (int i = 0; i < NumTaskPriorities; i++) {
+      queue->head[i] = 0;
+      queue->tail[i] = 0;
+    }
+    queue->readyBitmap = 0;
+    queue->numReady = 0;
+    queue->timerOneShot = false;
+  }
+
+  ticks = 0;
+  tickMicroseconds = DefaultTickMicroseconds;
+
+  timer = 0;
+  tickless = false;
+  idleTicks = 0;
+  fpu = 0;
+
+  for (int i = 0; i < NumTaskPriorities; i++) {
+    // one timer tick is 10 ms with the timer of kernelMain, the more important the shorter
+    if (i < TaskPriorityNetwork) {
+      timeslices[i] = 1;
+    }
+    else if (i < TaskPriorityNormal) {
+      timeslices[i] = 2;
+    }
+    else if (i < TaskPriorityBatch) {
+      timeslices[i] = 4;
+    }
+    else {
+      timeslices[i] = 8;
+    }
+  }
+
+  if (activeTaskManager == 0) {
+    activeTaskManager = this;
+  }
 }
 
 TaskManager::~TaskManager() {
+  if (activeTaskManager == this) {
+    activeTaskManager = 0;
+  }
 }
 
 bool TaskManager::AddTask(Task* task) {
+  uint32_t eflags = SaveInterrupts();
+
   // if we already have 256 tasks in there then the array is full
-  // so we just return false
-  if (numTasks >= 256) {
+  // so we just return false, and a task without a stack can't run
+  if (numTasks >= MaxTasks || task->cpustate == 0) {
+    RestoreInterrupts(eflags);
     return false;
   }
 
   // otherwise we put the task in the next free spot and return true
-  tasks[numTasks++] = task;
+  int slot = 0;
+  while (tasks[slot] != 0) {
+    slot++;
+  }
+  tasks[slot] = task;
+  numTasks++;
+
+  task->id = (nextId << 8) | slot;
+  nextId = nextId < 0xFFFFFF ? nextId + 1 : 1;
+
+  // a new task is ready to run right away, first on our processor
+  task->cpu = CPU::CurrentIndex();
+  Ready(task);
+
+  RestoreInterrupts(eflags);
+  return true;
+}
+
+Task* TaskManager::CurrentTask() {
+  return CPU::CurrentTask();
+}
+
+Task* TaskManager::FindTask(uint32_t id) {
+  Task* task = tasks[id & (MaxTasks - 1)];
+  return task != 0 && task->id == id ? task : 0;
+}
+
+int TaskManager::NumTasks() {
+  return numTasks;
+}
+
+// the spawned tasks are not allocated one by one from the heap but from a
+// cache which only holds Tasks, the workers come and go all the time
+static SlabCache<Task> taskCache(0, 0, MemoryTagKernel);
+
+uint32_t TaskManager::Spawn(void entrypoint(void*), void* argument, uint8_t priority, uint32_t stackSize) {
+  // the slots and stacks of the workers that are done can be used again
+  ReapZombies();
+
+  if (gdt == 0) {
+    return 0;
+  }
 
+  // the cache has no lock of its own, Reap gives the Tasks back with the interrupts off too
+  uint32_t eflags = SaveInterrupts();
+  Task* task = taskCache.Allocate();
+  RestoreInterrupts(eflags);
+  if (task == 0) {
+    return 0;
+  }
+  new (task) Task(gdt, entrypoint, argument, priority, stackSize);
+  task->spawned = true;
+
+  if (!AddTask(task)) {
+    eflags = SaveInterrupts();
+    task->~Task();
+    taskCache.Free(task);
+    RestoreInterrupts(eflags);
+    return 0;
+  }
+  return task->id;
+}
+
+void TaskManager::Exit(int exitCode) {
+  // the interrupts stay off until we have left this task for good
+  uint32_t eflags = SaveInterrupts();
+
+  // kernelMain is no task, it can't exit
+  Task* task = CPU::CurrentTask();
+  if (task == 0) {
+    RestoreInterrupts(eflags);
+    return;
+  }
+
+  task->exitCode = exitCode;
+  task->state = TaskExited;
+  if (task->detached) {
+    task->next = zombies;
+    zombies = task;
+  }
+  task->exited.WakeAll();
+
+  // Yield doesn't put an exited task back into its run queue, so we never come back
+  asm volatile("int %0" : : "i" (InterruptManager::YieldInterrupt) : "memory");
+
+  while (true) {
+    asm volatile("hlt");
+  }
+}
+
+bool TaskManager::Join(uint32_t id, int* exitCode) {
+  uint32_t eflags = SaveInterrupts();
+
+  Task* task = FindTask(id);
+  if (task == 0 || task == CPU::CurrentTask() || task->detached || task->joining) {
+    RestoreInterrupts(eflags);
+    return false;
+  }
+
+  task->joining = true;
+  while (task->state != TaskExited) {
+    // we can't wait in an interrupt handler or before the interrupts are on
+    if (!task->exited.Wait()) {
+      task->joining = false;
+      RestoreInterrupts(eflags);
+      return false;
+    }
+  }
+
+  if (exitCode != 0) {
+    *exitCode = task->exitCode;
+  }
+  Reap(task);
+
+  RestoreInterrupts(eflags);
   return true;
 }
 
+bool TaskManager::Detach(uint32_t id) {
+  uint32_t eflags = SaveInterrupts();
+
+  Task* task = FindTask(id);
+  if (task == 0 || task->detached || task->joining) {
+    RestoreInterrupts(eflags);
+    return false;
+  }
+
+  task->detached = true;
+  // it isn't running anymore, so we can free it right here
+  if (task->state == TaskExited) {
+    Reap(task);
+  }
+
+  RestoreInterrupts(eflags);
+  return true;
+}
+
+void TaskManager::Reap(Task* task) {
+  tasks[task->id & (MaxTasks - 1)] = 0;
+  numTasks--;
+
+  if (fpu != 0) {
+    fpu->Release(task);
+  }
+
+  // the destructor gives the stack back
+  if (task->spawned) {
+    task->~Task();
+    taskCache.Free(task);
+    return;
+  }
+
+  // a Task of kernelMain stays where it is, only its stack goes back
+  if (StackPool::activeStackPool != 0) {
+    StackPool::activeStackPool->Free(task->stack, task->stackSize);
+  }
+  task->stack = 0;
+  task->stackSize = 0;
+  task->cpustate = 0;
+}
+
+void TaskManager::ReapZombies() {
+  while (true) {
+    uint32_t eflags = SaveInterrupts();
+    Task* task = zombies;
+    if (task != 0) {
+      zombies = task->next;
+      Reap(task);
+    }
+    RestoreInterrupts(eflags);
+
+    if (task == 0) {
+      break;
+    }
+  }
+}
+
+void TaskManager::SetTimeslice(uint8_t priority, uint32_t ticks) {
+  if (priority < NumTaskPriorities && ticks > 0) {
+    timeslices[priority] = ticks;
+  }
+}
+
+uint32_t TaskManager::Timeslice(uint8_t priority) {
+  if (priority >= NumTaskPriorities) {
+    return 0;
+  }
+  return timeslices[priority];
+}
+
+uint64_t TaskManager::Ticks() {
+  uint32_t eflags = SaveInterrupts();
+  uint64_t result = ticks;
+  RestoreInterrupts(eflags);
+  return result;
+}
+
+uint32_t TaskManager::MillisecondsToTicks(uint32_t milliseconds) {
+  // an hour is enough, and milliseconds * 1000 still fits into 32 bits
+  if (milliseconds > 3600000) {
+    milliseconds = 3600000;
+  }
+
+  uint32_t result = (milliseconds * 1000 + tickMicroseconds - 1) / tickMicroseconds;
+  return result == 0 ? 1 : result;
+}
+
+void TaskManager::SetTickMicroseconds(uint32_t microseconds) {
+  if (microseconds > 0) {
+    tickMicroseconds = microseconds;
+  }
+}
+
+uint32_t TaskManager::TickMicroseconds() {
+  return tickMicroseconds;
+}
+
+void TaskManager::SetTimer(ProgrammableIntervalTimer* timer) {
+  this->timer = timer;
+  if (timer != 0) {
+    SetTickMicroseconds(timer->TickMicroseconds());
+  }
+}
+
+void TaskManager::SetTickless(bool tickless) {
+  this->tickless = tickless;
+}
+
+void TaskManager::SetFloatingPointUnit(FloatingPointUnit* fpu) {
+  this->fpu = fpu;
+}
+
+RunQueue* TaskManager::Local() {
+  return &runQueues[CPU::CurrentIndex()];
+}
+
+void TaskManager::Enqueue(Task* task, bool front) {
+  RunQueue* queue = &runQueues[task->cpu];
+  uint8_t priority = task->priority;
+
+  if (queue->head[priority] == 0) {
+    task->next = 0;
+    queue->head[priority] = task;
+    queue->tail[priority] = task;
+  }
+  else if (front) {
+    task->next = queue->head[priority];
+    queue->head[priority] = task;
+  }
+  else {
+    task->next = 0;
+    queue->tail[priority]->next = task;
+    queue->tail[priority] = task;
+  }
+
+  queue->readyBitmap |= 1 << priority;
+  queue->numReady++;
+}
+
+Task* TaskManager::Dequeue(RunQueue* queue) {
+  if (queue->readyBitmap == 0) {
+    return 0;
+  }
+
+  // the lowest bit is the most important priority
+  uint8_t priority = __builtin_ctz(queue->readyBitmap);
+
+  Task* task = queue->head[priority];
+  queue->head[priority] = task->next;
+  if (queue->head[priority] == 0) {
+    queue->tail[priority] = 0;
+    queue->readyBitmap &= ~(1 << priority);
+  }
+  queue->numReady--;
+
+  task->next = 0;
+  return task;
+}
+
+Task* TaskManager::Steal(RunQueue* queue) {
+  // the processor that has the most tasks waiting
+  RunQueue* victim = 0;
+  for (uint32_t cpu = 0; cpu < CPU::numOnline; cpu++) {
+    RunQueue* other = &runQueues[cpu];
+    if (other != queue && other->numReady > (victim != 0 ? victim->numReady : 0)) {
+      victim = other;
+    }
+  }
+
+  if (victim == 0) {
+    return 0;
+  }
+
+  // its most important one, that is the one that would run there next
+  Task* task = Dequeue(victim);
+  task->cpu = queue - runQueues;
+  return task;
+}
+
+bool TaskManager::HasWork(RunQueue* queue) {
+  if (queue->readyBitmap != 0) {
+    return true;
+  }
+
+  for (uint32_t cpu = 0; cpu < CPU::numOnline; cpu++) {
+    if (runQueues[cpu].numReady != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskManager::Ready(Task* task) {
+  // from now on it waits for a processor, Account sees how long
+  task->readySince = now_ns();
+  task->statistics.wakeups++;
+
+  // if its processor is busy, a processor in its idle loop takes it
+  RunQueue* queue = &runQueues[task->cpu];
+  if (CPU::cpus[task->cpu].currentTask != 0 || queue->readyBitmap != 0) {
+    for (uint32_t cpu = 0; cpu < CPU::numOnline; cpu++) {
+      if (CPU::cpus[cpu].currentTask == 0 && runQueues[cpu].readyBitmap == 0) {
+        task->cpu = cpu;
+        break;
+      }
+    }
+  }
+
+  Enqueue(task);
+
+  // the processor that we run on looks at its queues after the interrupt anyway
+  if (task->cpu != CPU::CurrentIndex()) {
+    Reschedule(task->cpu);
+  }
+}
+
+void TaskManager::Reschedule(uint32_t cpu) {
+  if (LocalAPIC::activeLocalAPIC != 0) {
+    LocalAPIC::activeLocalAPIC->SendInterrupt(CPU::cpus[cpu].apicId, InterruptManager::RescheduleInterrupt);
+  }
+}
+
+CPUState* TaskManager::Switch(RunQueue* queue) {
+  Task* task = Dequeue(queue);
+
+  // nothing left of our own, so we help the others
+  if (task == 0) {
+    task = Steal(queue);
+  }
+  // Switch only runs for the queue of the processor that we run on
+  if (task != CPU::CurrentTask()) {
+    Account(CPU::CurrentTask(), task);
+    CPU::SetCurrentTask(task);
+    CPU::CountTaskSwitch();
+  }
+
+  if (fpu != 0) {
+    fpu->TaskSwitched(task);
+  }
+
+  // nothing to do, so back to the idle loop until an interrupt wakes somebody up
+  if (task == 0) {
+    return queue->idle;
+  }
+
+  if (task->timeslice == 0) {
+    task->timeslice = timeslices[task->priority];
+  }
+
+  // and then we return the new current task
+  return task->cpustate;
+}
+
+void TaskManager::Account(Task* previous, Task* next) {
+  uint64_t now = now_ns();
+
+  // the TSCs of the processors start at the same time, we hope; if a task
+  // moved to a processor whose TSC is behind we rather count nothing
+  if (previous != 0 && now > previous->runningSince) {
+    previous->statistics.runNanoseconds += now - previous->runningSince;
+  }
+
+  if (next == 0) {
+    return;
+  }
+  next->runningSince = now;
+  next->statistics.switches++;
+
+  // a task that was preempted or yielded was not woken up, so it has no wait
+  if (next->readySince != 0) {
+    uint64_t wait = now > next->readySince ? now - next->readySince : 0;
+    next->readySince = 0;
+
+    if (wait > next->statistics.maxWakeNanoseconds) {
+      next->statistics.maxWakeNanoseconds = wait;
+    }
+    CountLatency(&statistics.wakeLatency, wait);
+    CountLatency(&statistics.priorityWakeLatency[next->priority], wait);
+  }
+}
+
+void TaskManager::CountLatency(LatencyHistogram* histogram, uint64_t nanoseconds) {
+  // the index of the highest set bit, of the 64 bit number
+  uint32_t high = nanoseconds >> 32;
+  uint32_t low = nanoseconds;
+  uint32_t bucket = 0;
+  if (high != 0) {
+    asm("bsr %1, %0" : "=r" (bucket) : "r" (high));
+    bucket += 32;
+  }
+  else if (low != 0) {
+    asm("bsr %1, %0" : "=r" (bucket) : "r" (low));
+  }
+  if (bucket >= LatencyHistogram::NumBuckets) {
+    bucket = LatencyHistogram::NumBuckets - 1;
+  }
+
+  histogram->buckets[bucket]++;
+  histogram->count++;
+  histogram->totalNanoseconds += nanoseconds;
+  if (nanoseconds > histogram->maxNanoseconds) {
+    histogram->maxNanoseconds = nanoseconds;
+  }
+}
+
+bool TaskManager::GetTaskStatistics(uint32_t id, TaskStatistics* taskStatistics) {
+  uint32_t eflags = SaveInterrupts();
+  Task* task = FindTask(id);
+  if (task != 0) {
+    *taskStatistics = task->statistics;
+  }
+  RestoreInterrupts(eflags);
+  return task != 0;
+}
+
+void TaskManager::GetSchedulerStatistics(SchedulerStatistics* schedulerStatistics) {
+  uint32_t eflags = SaveInterrupts();
+  *schedulerStatistics = statistics;
+  RestoreInterrupts(eflags);
+}
+
+void TaskManager::PrintHistogram(LatencyHistogram* histogram) {
+  // count 0x00000010 total 0x00000000:0x00123456 max 0x00000000:0x00004567
+  printf("count 0x");
+  printfHex32(histogram->count);
+  printf(" total 0x");
+  printfHex32(histogram->totalNanoseconds >> 32);
+  printf(":0x");
+  printfHex32(histogram->totalNanoseconds);
+  printf(" max 0x");
+  printfHex32(histogram->maxNanoseconds >> 32);
+  printf(":0x");
+  printfHex32(histogram->maxNanoseconds);
+  printf(" ns\n");
+
+  // only the buckets that have something, 32 don't fit on the screen
+  for (uint32_t bucket = 0; bucket < LatencyHistogram::NumBuckets; bucket++) {
+    if (histogram->buckets[bucket] != 0) {
+      printf("  >= 0x");
+      printfHex32(1 << bucket);
+      printf(" ns: 0x");
+      printfHex32(histogram->buckets[bucket]);
+      printf("\n");
+    }
+  }
+}
+
+void TaskManager::PrintStatistics() {
+  // the histograms would be 5 KiB on the stack, we print them with the lock
+  uint32_t eflags = SaveInterrupts();
+
+  // task 0x00000101 priority 0x10 run 0x00000000:0x0012A3F0 ns switches 0x00000012 max wait 0x00004000 ns
+  for (int slot = 0; slot < MaxTasks; slot++) {
+    Task* task = tasks[slot];
+    if (task == 0) {
+      continue;
+    }
+    printf("task 0x");
+    printfHex32(task->id);
+    printf(" priority 0x");
+    printfHex(task->priority);
+    printf(" run 0x");
+    printfHex32(task->statistics.runNanoseconds >> 32);
+    printf(":0x");
+    printfHex32(task->statistics.runNanoseconds);
+    printf(" ns switches 0x");
+    printfHex32(task->statistics.switches);
+    printf(" max wait 0x");
+    printfHex32(task->statistics.maxWakeNanoseconds);
+    printf(" ns\n");
+  }
+
+  printf("wake latency: ");
+  PrintHistogram(&statistics.wakeLatency);
+  for (int priority = 0; priority < NumTaskPriorities; priority++) {
+    if (statistics.priorityWakeLatency[priority].count != 0) {
+      printf("priority 0x");
+      printfHex(priority);
+      printf(": ");
+      PrintHistogram(&statistics.priorityWakeLatency[priority]);
+    }
+  }
+
+  CPU::PrintStatistics();
+
+  RestoreInterrupts(eflags);
+}
+
+void TaskManager::TimerAdded() {
+  if (idleTicks != 0 && Local() != &runQueues[0]) {
+    Reschedule(0);
+  }
+}
+
+void TaskManager::AddSleeper(Task* task, uint32_t ticks) {
+  // Wake only moves the task into its run queue, that is fast enough
+  // for the timer interrupt and we don't need the timer task for that
+  task->wakeTimer.callback = WakeTimeout;
+  task->wakeTimer.data = task;
+  task->wakeTimer.runInInterrupt = true;
+  timers.Add(&task->wakeTimer, ticks);
+  TimerAdded();
+}
+
+void TaskManager::RemoveSleeper(Task* task) {
+  timers.Cancel(&task->wakeTimer);
+}
+
+void TaskManager::WakeTimeout(void* data) {
+  Task* task = (Task*)data;
+  task->timedOut = task->state == TaskBlocked;
+  activeTaskManager->Wake(task);
+}
+
+void TaskManager::Wake(Task* task) {
+  if (task->state == TaskRunnable) {
+    return;
+  }
+
+  if (task->waitQueue != 0) {
+    task->waitQueue->Remove(task);
+  }
+  RemoveSleeper(task);
+
+  task->state = TaskRunnable;
+  Ready(task);
+}
+
+bool TaskManager::Block(WaitQueue* queue, uint32_t timeoutMilliseconds) {
+  uint32_t eflags = SaveInterrupts();
+
+  uint32_t timeout = 0;
+  if (timeoutMilliseconds != WaitQueue::WaitForever) {
+    timeout = MillisecondsToTicks(timeoutMilliseconds);
+  }
+
+  // kernelMain is no task, so it can't leave the processor to somebody else
+  // it just halts until the next interrupt and looks if that was a Wake
+  Task* task = CPU::CurrentTask();
+  if (task == 0) {
+    uint32_t wakeups = queue->wakeups;
+    uint64_t deadline = ticks + timeout;
+    bool woken = true;
+
+    while (queue->wakeups == wakeups) {
+      if (timeout != 0 && ticks >= deadline) {
+        woken = false;
+        break;
+      }
+      WaitForInterrupt();
+    }
+
+    RestoreInterrupts(eflags);
+    return woken;
+  }
+
+  task->state = TaskBlocked;
+  task->timedOut = false;
+  queue->Append(task);
+  if (timeout != 0) {
+    AddSleeper(task, timeout);
+  }
+
+  // we come back here after the Wake, maybe on another processor
+  asm volatile("int %0" : : "i" (InterruptManager::YieldInterrupt) : "memory");
+
+  bool woken = !task->timedOut;
+  RestoreInterrupts(eflags);
+  return woken;
+}
+
+void TaskManager::Yield() {
+  asm volatile("int %0" : : "i" (InterruptManager::YieldInterrupt) : "memory");
+}
+
+void TaskManager::Sleep(uint32_t milliseconds) {
+  uint32_t eflags = SaveInterrupts();
+  uint32_t timeout = MillisecondsToTicks(milliseconds);
+
+  Task* task = CPU::CurrentTask();
+  if (task == 0) {
+    uint64_t deadline = ticks + timeout;
+    while (ticks < deadline) {
+      WaitForInterrupt();
+    }
+    RestoreInterrupts(eflags);
+    return;
+  }
+
+  task->state = TaskSleeping;
+  AddSleeper(task, timeout);
+  asm volatile("int %0" : : "i" (InterruptManager::YieldInterrupt) : "memory");
+
+  RestoreInterrupts(eflags);
+}
+
+void TaskManager::AdvanceTimers() {
+  // the sleeping tasks whose time is over are ready again right away,
+  // for the other timers we wake up the timer task
+  if (timers.Advance(ticks)) {
+    timerWork.WakeAll();
+  }
+}
+
+void TaskManager::LeaveTickless(bool timerInterrupt) {
+  uint32_t passed = timer->Periodic();
+
+  // the timer interrupt of the one shot comes after all of its ticks,
+  // and Schedule counts the last one itself
+  if (timerInterrupt) {
+    passed = idleTicks - 1;
+  }
+
+  idleTicks = 0;
+  ticks += passed;
+  AdvanceTimers();
+}
+
+void TaskManager::LeaveLocalTickless(RunQueue* queue) {
+  if (queue->timerOneShot && LocalAPIC::activeLocalAPIC != 0) {
+    LocalAPIC::activeLocalAPIC->StartTimer(InterruptManager::LocalTimerInterrupt);
+  }
+  queue->timerOneShot = false;
+}
+
+void TaskManager::Idle() {
+  uint32_t eflags = SaveInterrupts();
+  RunQueue* queue = Local();
+
+  // only the idle loop is the idle task, and only if there is really nothing to do
+  if (CPU::CurrentTask() != 0 || HasWork(queue)) {
+    RestoreInterrupts(eflags);
+    Yield();
+    return;
+  }
+
+  // the PIT only interrupts the first processor
+  if (tickless && timer != 0 && queue == &runQueues[0]) {
+    uint32_t wait = timer->MaxOneShotTicks();
+
+    // until the next timer, a sleeping task or anything else
+    wait = timers.TicksUntilNext(wait);
+
+    // for one tick the periodic timer does the same
+    if (wait > 1) {
+      timer->OneShot(wait);
+      idleTicks = wait;
+    }
+  }
+  // the others have no timers to wait for, a reschedule IPI brings them
+  // new tasks, and once in a while they look for tasks to steal
+  else if (tickless && queue != &runQueues[0] && LocalAPIC::activeLocalAPIC != 0) {
+    LocalAPIC::activeLocalAPIC->OneShotTimer(InterruptManager::LocalTimerInterrupt, ApplicationProcessorIdleTicks);
+    queue->timerOneShot = true;
+  }
+
+  // the next interrupt wakes us up again, Schedule or Preempt count the ticks
+  WaitForInterrupt();
+
+  RestoreInterrupts(eflags);
+}
+
 CPUState* TaskManager::Schedule(CPUState* cpustate) {
+  RunQueue* queue = Local();
+
+  // the ticks and the timers belong to the first processor,
+  // on the others the timer only ends the timeslices
+  if (queue == &runQueues[0]) {
+    if (idleTicks != 0) {
+      LeaveTickless(true);
+    }
+
+    ticks++;
+    AdvanceTimers();
+  }
+  else {
+    LeaveLocalTickless(queue);
+  }
+
   // if we don't have any tasks yet, we just return the old CPU state
-  if (numTasks <= 0) {
+  Task* task = CPU::CurrentTask();
+  if (task == 0 && !HasWork(queue)) {
     return cpustate;
   }
 
   // so if we are already doing the scheduling
   // then we store the old CPUState
-  if (currentTask >= 0) {
+  if (task == 0) {
+    // the idle loop, we come back to it when there is nothing else to do
+    queue->idle = cpustate;
+  }
+  else {
     // store the old value
-    // put the task back and to the list of tasks
-    tasks[currentTask]->cpustate = cpustate;
+    task->cpustate = cpustate;
+
+    if (task->timeslice > 0) {
+      task->timeslice--;
+    }
+
+    // the bits below the priority of the current task are the more important ones
+    bool preempted = (queue->readyBitmap & ((1 << task->priority) - 1)) != 0;
+
+    // nothing more important and time left, so it just goes on
+    if (!preempted && task->timeslice > 0) {
+      return cpustate;
+    }
+
+    // put the task back to the list of tasks
+    // if it was preempted it comes first again with what is left of its timeslice
+    Enqueue(task, preempted && task->timeslice > 0);
   }
 
-  // and here we just do the round-robin
-  // if currentTask exceeds the size of the array
-  // then we start over at the beginning
-  if (++currentTask >= numTasks) {
-    currentTask %= numTasks;
+  return Switch(queue);
+}
+
+CPUState* TaskManager::Yield(CPUState* cpustate) {
+  RunQueue* queue = Local();
+  Task* task = CPU::CurrentTask();
+
+  if (task == 0) {
+    queue->idle = cpustate;
+    return HasWork(queue) ? Switch(queue) : cpustate;
   }
 
-  // and then we return the new currentTask
-  return tasks[currentTask]->cpustate;
+  task->cpustate = cpustate;
+
+  // a task that just yields goes to the end of its queue,
+  // a blocked or sleeping task is somewhere else already
+  if (task->state == TaskRunnable) {
+    task->timeslice = 0;
+    Enqueue(task);
+  }
+
+  return Switch(queue);
 }
 
+CPUState* TaskManager::Preempt(CPUState* cpustate) {
+  RunQueue* queue = Local();
+
+  // another interrupt than the timer ended the Idle
+  if (idleTicks != 0 && queue == &runQueues[0]) {
+    LeaveTickless(false);
+  }
+  else if (queue != &runQueues[0]) {
+    LeaveLocalTickless(queue);
+  }
+
+  Task* task = CPU::CurrentTask();
+  if (task == 0) {
+    if (!HasWork(queue)) {
+      return cpustate;
+    }
+    queue->idle = cpustate;
+    return Switch(queue);
+  }
+
+  if ((queue->readyBitmap & ((1 << task->priority) - 1)) == 0) {
+    return cpustate;
+  }
+
+  task->cpustate = cpustate;
+  Enqueue(task, task->timeslice > 0);
+  return Switch(queue);
+}
+
+TimerWheel* TaskManager::Timers() {
+  return &timers;
+}
+
+void TaskManager::AddTimer(Timer* timer, uint32_t milliseconds) {
+  timers.Add(timer, MillisecondsToTicks(milliseconds));
+  TimerAdded();
+}
+
+void TaskManager::RunTimers() {
+  while (true) {
+    uint32_t eflags = SaveInterrupts();
+    while (!timers.HasExpired()) {
+      timerWork.Wait();
+    }
+    RestoreInterrupts(eflags);
+
+    timers.RunExpired();
+  }
+}
+
+void myos::sleep(uint32_t milliseconds) {
+  if (TaskManager::activeTaskManager != 0) {
+    TaskManager::activeTaskManager->Sleep(milliseconds);
+  }
+}
+
+bool myos::add_timer(Timer* timer, uint32_t milliseconds) {
+  TaskManager* taskManager = TaskManager::activeTaskManager;
+  if (taskManager == 0) {
+    return false;
+  }
+  taskManager->AddTimer(timer, milliseconds);
+  return true;
+}
@@ -1,23 +1,50 @@
 #include <net/arp.h>
+#include <hardwarecommunication/interrupts.h>
 
 using namespace myos;
 using namespace myos::common;
 using namespace myos::net;
 using namespace myos::drivers;
+using namespace myos::hardwarecommunication;
 
 void printf(char*);
 void printfHex(uint8_t);
 
 AddressResolutionProtocol::AddressResolutionProtocol(EtherFrameProvider* backend)
-  : EtherFrameHandler(backend, 0x806) // 0x806 for ARP
+  : EtherFrameHandler(backend, 0x806), // 0x806 for ARP
+    ageTimer(Age, this)
 {
   numCacheEntries = 0;
+  add_timer(&ageTimer, AgeInterval);
 }
 
 AddressResolutionProtocol::~AddressResolutionProtocol() {
 
 }
 
+void AddressResolutionProtocol::Age(void* data) {
+  AddressResolutionProtocol* arp = (AddressResolutionProtocol*)data;
+
+  // the receive tasklet of the network card writes into the cache too
+  uint32_t eflags = SaveInterrupts();
+  for (int i = 0; i < arp->numCacheEntries; ) {
+    if (++arp->cacheAge[i] < MaxCacheAge) {
+      i++;
+      continue;
+    }
+
+    // the last entry takes the place of the expired one
+    arp->numCacheEntries--;
+    arp->IPcache[i] = arp->IPcache[arp->numCacheEntries];
+    arp->MACcache[i] = arp->MACcache[arp->numCacheEntries];
+    arp->cacheAge[i] = arp->cacheAge[arp->numCacheEntries];
+  }
+  RestoreInterrupts(eflags);
+
+  // this runs in the timer task, so we can just start it again
+  add_timer(&arp->ageTimer, AgeInterval);
+}
+
 bool AddressResolutionProtocol::OnEtherFrameReceived(uint8_t* etherframePayload, uint32_t size) {
   printf("ARP RECV:\n");
   // When we reciev such a message, we cast it to the message type first.
@@ -83,11 +110,33 @@ bool AddressResolutionProtocol::OnEtherFrameReceived(uint8_t* etherframePayload,
           // if you do something like communication through SSL, then
           // you need the private key and publick. For now, we have
           // no other choice than to trust this message.
-          if (numCacheEntries < 128) {
-            IPcache[numCacheEntries] = arp->srcIP;
-            MACcache[numCacheEntries] = arp->srcMAC;
-            numCacheEntries++;
+          //
+          // An answer for an IP that we know already updates the entry
+          // and makes it new again.
+          //
+          // The receive tasklet runs with the interrupts on, and on another
+          // processor Age might move the entries around right now, so the
+          // lookup and the insert run with the interrupts off like Age.
+          {
+            uint32_t eflags = SaveInterrupts();
+            int i = 0;
+            while (i < numCacheEntries && IPcache[i] != arp->srcIP) {
+              i++;
+            }
+            if (i < 128) {
+              IPcache[i] = arp->srcIP;
+              MACcache[i] = arp->srcMAC;
+              cacheAge[i] = 0;
+              if (i == numCacheEntries) {
+                numCacheEntries++;
+              }
+            }
+            RestoreInterrupts(eflags);
           }
+
+          // somebody might wait for this answer in Resolve
+          resolved.WakeAll();
+          answered.SignalAll();
           break;
       }
 
@@ -122,13 +171,19 @@ uint64_t AddressResolutionProtocol::GetMACFromCache(uint32_t IP_BE) {
   // In reading something from the cache, we will just iterate through
   // the cacche and return if we find something otherwise we will
   // return 0
+  //
+  // (with the interrupts off, Age and the receive tasklet change it)
+  uint64_t result = 0xFFFFFFFFFFFF; // broadcast address
+  uint32_t eflags = SaveInterrupts();
   for (int i = 0; i < numCacheEntries; i++) {
     if (IPcache[i] == IP_BE) {
-      return MACcache[i];
+      result = MACcache[i];
+      break;
     }
   }
+  RestoreInterrupts(eflags);
 
-  return 0xFFFFFFFFFFFF; // broadcast address
+  return result;
 }
 
 uint64_t AddressResolutionProtocol::Resolve(uint32_t IP_BE) {
@@ -137,20 +192,63 @@ uint64_t AddressResolutionProtocol::Resolve(uint32_t IP_BE) {
   uint64_t result = GetMACFromCache(IP_BE);
 
   // 0xFFFFFFFFFFFF is what we get if the mac isn't in the cache.
-  if (result == 0xFFFFFFFFFFFF) {
+  //
+  // If the machine isn't even connected, then of course you will never get
+  // an answer to this request. So we ask a few times, and every time we wait
+  // a second for the answer. The task blocks while it waits and the receive
+  // tasklet wakes it up when the answer is in the cache (OnEtherFrameReceived).
+  //
+  // If nobody answers we give up and return the broadcast address.
+  for (int attempt = 0; attempt < ResolveAttempts && result == 0xFFFFFFFFFFFF; attempt++) {
     RequestMACAddress(IP_BE);
-  }
 
-  // this isn't really safe because if the machine isn't even
-  // connected, then of course you will never get answer to this
-  // request. You will never get an entry in the cache, then
-  // this loop will never terminate.
-  //
-  // So we should have some way of finding out some time out here
-  // I'll leave it like this for now.
-  while (result == 0xFFFFFFFFFFFF) { // possible infinite loop
-    result = GetMACFromCache(IP_BE);
+    uint32_t eflags = SaveInterrupts();
+    while ((result = GetMACFromCache(IP_BE)) == 0xFFFFFFFFFFFF) {
+      // the timeout is over, or we can't wait at all (in an interrupt handler,
+      // the tasklet that receives the answer, or before the interrupts are
+      // activated), then just ask again
+      if (!resolved.Wait(ResolveTimeout)) {
+        break;
+      }
+    }
+    RestoreInterrupts(eflags);
   }
 
   return result;
 }
+
+ResolveRequest::ResolveRequest(AddressResolutionProtocol* arp, uint32_t IP_BE) {
+  this->arp = arp;
+  this->IP_BE = IP_BE;
+  MAC = 0xFFFFFFFFFFFF;
+  attempt = 0;
+}
+
+ResolveRequest::~ResolveRequest() {
+}
+
+CoroutineStatus ResolveRequest::Resume() {
+  // like Resolve, but instead of blocking a task every wait returns
+  // and the next Resume goes on right after it
+  CO_BEGIN;
+
+  for (attempt = 0; attempt < AddressResolutionProtocol::ResolveAttempts; attempt++) {
+    MAC = arp->GetMACFromCache(IP_BE);
+    if (MAC != 0xFFFFFFFFFFFF) {
+      break;
+    }
+
+    arp->RequestMACAddress(IP_BE);
+    CO_WAIT_UNTIL(&arp->answered, (MAC = arp->GetMACFromCache(IP_BE)) != 0xFFFFFFFFFFFF,
+                  AddressResolutionProtocol::ResolveTimeout);
+    if (!TimedOut()) {
+      break;
+    }
+  }
+
+  CO_END;
+}
+
+uint64_t ResolveRequest::MACAddress() {
+  return MAC;
+}
@@ -29,7 +29,8 @@ void EtherFrameHandler::Send(uint64_t dstMAC_BE, uint8_t* data, uint32_t size) {
 }
 
 EtherFrameProvider::EtherFrameProvider(amd_am79c973* backend)
-  : RawDataHandler(backend)
+  : RawDataHandler(backend),
+    sendArena(2048, MemoryTagNet)
 {
   for (uint32_t i = 0; i < 65535; i++) {
     handlers[i] = 0;
@@ -85,7 +86,14 @@ bool EtherFrameProvider::OnRawDataReceived(uint8_t* buffer, uint32_t size) {
 
 void EtherFrameProvider::Send(uint64_t dstMAC_BE, uint16_t etherType_BE, uint8_t* buffer, uint32_t size) {
   // we get the memory from the header plus the size of the buffer that we want to send
-  uint8_t* buffer2 = (uint8_t*)MemoryManager::activeMemoryManager->malloc(sizeof(EtherFrameHeader) + size);
+  // it comes from the sendArena and is gone again at the Release
+  uint32_t eflags = sendLock.LockSave();
+  size_t mark = sendArena.Mark();
+  uint8_t* buffer2 = (uint8_t*)sendArena.Allocate(sizeof(EtherFrameHeader) + size);
+  if (buffer2 == 0) {
+    sendLock.UnlockRestore(eflags);
+    return;
+  }
   EtherFrameHeader* frame = (EtherFrameHeader*)buffer2;
 
   // impose a header on it again
@@ -103,8 +111,8 @@ void EtherFrameProvider::Send(uint64_t dstMAC_BE, uint16_t etherType_BE, uint8_t
   // pass `dst_buffer` the backend
   backend->Send(buffer2, size + sizeof(EtherFrameHeader));
 
-  // free the buffer
-  MemoryManager::activeMemoryManager->free(buffer2);
+  sendArena.Release(mark);
+  sendLock.UnlockRestore(eflags);
 }
 
 uint32_t EtherFrameProvider::GetIPAddress() {
@@ -31,7 +31,8 @@ void InternetProtocolHandler::Send(uint32_t dstIP_BE, uint8_t* internetprotocolP
 InternetProtocolProvider::InternetProtocolProvider(EtherFrameProvider* backend, 
     AddressResolutionProtocol* arp,
     uint32_t gatewayIP, uint32_t subnetMask)
-: EtherFrameHandler(backend, 0x800) { // 0x800 for IP
+: EtherFrameHandler(backend, 0x800), // 0x800 for IP
+  sendArena(2048, MemoryTagNet) {
   for (int i = 0; i < 255; i++) {
     handlers[i] = 0;
   }
@@ -85,7 +86,28 @@ bool InternetProtocolProvider::OnEtherFrameReceived(uint8_t* etherframePayload,
 }
 
 void InternetProtocolProvider::Send(uint32_t dstIP_BE, uint8_t protocol, uint8_t* data, uint32_t size) {
-  uint8_t* buffer = (uint8_t*)MemoryManager::activeMemoryManager->malloc(sizeof(InternetProtocolV4Message) + size);
+  // By default, we want to send the data to destination.
+  // But if the target is not in our subnet, is outside the local network,
+  // just send the message to the gateway.
+  uint32_t srcIP_BE = backend->GetIPAddress();
+  uint32_t route = dstIP_BE;
+  if ((dstIP_BE & subnetMask) != (srcIP_BE & subnetMask)) {
+    route = gatewayIP;
+  }
+
+  // Resolve can block for seconds, and the sendLock keeps the interrupts off,
+  // so we must not hold a buffer of the arena while we wait.
+  uint64_t dstMAC_BE = arp->Resolve(route);
+
+  // the other processors send at the same time, the lock keeps
+  // the Mark and the Release of everybody in order
+  uint32_t eflags = sendLock.LockSave();
+  size_t mark = sendArena.Mark();
+  uint8_t* buffer = (uint8_t*)sendArena.Allocate(sizeof(InternetProtocolV4Message) + size);
+  if (buffer == 0) {
+    sendLock.UnlockRestore(eflags);
+    return;
+  }
   InternetProtocolV4Message *message = (InternetProtocolV4Message*)buffer;
 
   message->version = 4; // version 4 for ipv4
@@ -103,7 +125,7 @@ void InternetProtocolProvider::Send(uint32_t dstIP_BE, uint8_t protocol, uint8_t
   message->protocol = protocol;
 
   message->dstIP = dstIP_BE;
-  message->srcIP = backend->GetIPAddress();
+  message->srcIP = srcIP_BE;
 
   // We need to initialize checksum to zero, because the checksum also add
   // this value. Checksum will be invalid and packet will be dropped.
@@ -116,17 +138,10 @@ void InternetProtocolProvider::Send(uint32_t dstIP_BE, uint8_t protocol, uint8_t
     databuffer[i] = data[i];
   }
 
-  // By default, we want to send the data to destination.
-  // But if the target is not in our subnet, is outside the local network,
-  // just send the message to the gateway.
-  uint32_t route = dstIP_BE;
-  if ((dstIP_BE & subnetMask) != (message->srcIP & subnetMask)) {
-    route = gatewayIP;
-  }
-
-  backend->Send(arp->Resolve(route), this->etherType_BE, buffer, sizeof(InternetProtocolV4Message) + size);
+  backend->Send(dstMAC_BE, this->etherType_BE, buffer, sizeof(InternetProtocolV4Message) + size);
 
-  MemoryManager::activeMemoryManager->free(buffer);
+  sendArena.Release(mark);
+  sendLock.UnlockRestore(eflags);
 }
 
 uint16_t InternetProtocolProvider::Checksum(uint16_t* data, uint32_t lengthInBytes) {
@@ -0,0 +1,252 @@
+#include <paging.h>
+#include <zeropagepool.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+void printf(char*);
+void printfHex32(uint32_t);
+
+PageTableManager* PageTableManager::activePageTableManager = 0;
+
+// a frame full of zeros, for a table that means all entries are not present
+// the ZeroPagePool has them ready, before it exists we clear them here
+static uint32_t* AllocateZeroedFrame(PhysicalMemoryManager* frames) {
+  if (ZeroPagePool::activeZeroPagePool != 0) {
+    return (uint32_t*)ZeroPagePool::activeZeroPagePool->AllocateFrame(FrameZeroed);
+  }
+
+  uint32_t* frame = (uint32_t*)frames->AllocateFrame();
+  if (frame != 0) {
+    for (int i = 0; i < 1024; i++) {
+      frame[i] = 0;
+    }
+  }
+  return frame;
+}
+
+PageTableManager::PageTableManager(PhysicalMemoryManager* frames) {
+  this->frames = frames;
+
+  // cpuid with eax = 1 tells us in edx which features the processor has
+  //   bit 3: PSE, 4 MiB pages
+  //   bit 13: PGE, global pages
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  largePages = (edx & (1 << 3)) != 0;
+  globalPages = (edx & (1 << 13)) != 0;
+
+  pageDirectory = AllocateZeroedFrame(frames);
+
+  // the direct map: the first 4 MiB (kernel, VGA memory, BIOS) and all the RAM
+  // that the PhysicalMemoryManager manages, so the kernel can reach every frame
+  uint32_t end = frames->HighestAddress();
+  if (end < LargePageSize) {
+    end = LargePageSize;
+  }
+
+  uint32_t flags = PageWritable | (globalPages ? PageGlobal : 0);
+  for (uint32_t address = 0; address < end && address < UserSpaceStart; address += LargePageSize) {
+    MapLargePage(address, address, flags);
+  }
+}
+
+PageTableManager::~PageTableManager() {
+  if (activePageTableManager == this) {
+    activePageTableManager = 0;
+  }
+}
+
+void PageTableManager::Activate() {
+  activePageTableManager = this;
+
+  uint32_t cr4;
+  asm volatile("mov %%cr4, %0" : "=r" (cr4));
+  if (largePages) {
+    cr4 |= 1 << 4; // PSE
+  }
+  if (globalPages) {
+    cr4 |= 1 << 7; // PGE
+  }
+  asm volatile("mov %0, %%cr4" : : "r" (cr4));
+
+  // CR3 holds the physical address of the page directory
+  asm volatile("mov %0, %%cr3" : : "r" (pageDirectory));
+
+  // CR0 bit 31 switches paging on
+  // and with bit 16 (write protect) even the kernel can't write to read only pages
+  uint32_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r" (cr0));
+  cr0 |= (1 << 31) | (1 << 16);
+  asm volatile("mov %0, %%cr0" : : "r" (cr0));
+}
+
+void PageTableManager::Invalidate(uint32_t virtualAddress) {
+  asm volatile("invlpg (%0)" : : "r" (virtualAddress) : "memory");
+}
+
+uint32_t* PageTableManager::PageTable(uint32_t virtualAddress, bool create) {
+  uint32_t& entry = pageDirectory[virtualAddress >> 22];
+
+  // a 4 MiB page has no page table
+  if (entry & PageLarge) {
+    return 0;
+  }
+
+  if (!(entry & PagePresent)) {
+    if (!create) {
+      return 0;
+    }
+
+    uint32_t* table = AllocateZeroedFrame(frames);
+    if (table == 0) {
+      return 0;
+    }
+
+    // the directory entry allows everything, the page table entries decide
+    entry = (uint32_t)table | PagePresent | PageWritable | PageUser;
+  }
+
+  // page tables are in the direct map, so the physical address is also the virtual address
+  return (uint32_t*)(entry & ~0xFFF);
+}
+
+bool PageTableManager::MapPage(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags) {
+  uint32_t* table = PageTable(virtualAddress, true);
+  if (table == 0) {
+    return false;
+  }
+
+  table[(virtualAddress >> 12) & 0x3FF] = (physicalAddress & ~0xFFF) | (flags & 0xFFF) | PagePresent;
+  Invalidate(virtualAddress);
+  return true;
+}
+
+bool PageTableManager::MapLargePage(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags) {
+  // without PSE we have to build a whole page table for the 4 MiB
+  if (!largePages) {
+    for (uint32_t offset = 0; offset < LargePageSize; offset += PageSize) {
+      if (!MapPage(virtualAddress + offset, physicalAddress + offset, flags)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t& entry = pageDirectory[virtualAddress >> 22];
+
+  // replacing a page table would leak its frame
+  if ((entry & PagePresent) && !(entry & PageLarge)) {
+    return false;
+  }
+
+  entry = (physicalAddress & ~(LargePageSize - 1)) | (flags & 0xFFF) | PageLarge | PagePresent;
+  Invalidate(virtualAddress);
+  return true;
+}
+
+uint32_t PageTableManager::UnmapPage(uint32_t virtualAddress) {
+  uint32_t* table = PageTable(virtualAddress, false);
+  if (table == 0) {
+    return 0;
+  }
+
+  uint32_t& entry = table[(virtualAddress >> 12) & 0x3FF];
+  if (!(entry & PagePresent)) {
+    return 0;
+  }
+
+  uint32_t physicalAddress = entry & ~0xFFF;
+  entry = 0;
+  Invalidate(virtualAddress);
+  return physicalAddress;
+}
+
+uint32_t PageTableManager::Translate(uint32_t virtualAddress) {
+  uint32_t entry = pageDirectory[virtualAddress >> 22];
+  if (!(entry & PagePresent)) {
+    return 0;
+  }
+
+  if (entry & PageLarge) {
+    return (entry & ~(LargePageSize - 1)) | (virtualAddress & (LargePageSize - 1));
+  }
+
+  uint32_t* table = (uint32_t*)(entry & ~0xFFF);
+  entry = table[(virtualAddress >> 12) & 0x3FF];
+  if (!(entry & PagePresent)) {
+    return 0;
+  }
+
+  return (entry & ~0xFFF) | (virtualAddress & 0xFFF);
+}
+
+void PageTableManager::MapMemoryMappedIO(uint32_t physicalAddress, size_t size) {
+  // devices must see every read and write, so no caching at all
+  uint32_t end = physicalAddress + size;
+  for (uint32_t address = physicalAddress & ~0xFFF; address < end; address += PageSize) {
+    if (Translate(address) == 0) {
+      MapPage(address, address, PageWritable | PageCacheDisable | PageWriteThrough);
+    }
+  }
+}
+
+bool PageTableManager::HandleDemandFault(uint32_t virtualAddress) {
+  if (virtualAddress < UserSpaceStart || virtualAddress >= UserSpaceEnd) {
+    return false;
+  }
+
+  uint32_t* frame = AllocateZeroedFrame(frames);
+  if (frame == 0) {
+    return false;
+  }
+
+  if (!MapPage(virtualAddress & ~0xFFF, (uint32_t)frame, PageWritable | PageUser)) {
+    frames->FreeFrame(frame);
+    return false;
+  }
+  return true;
+}
+
+PageFaultHandler::PageFaultHandler(InterruptManager* interruptManager, PageTableManager* pageTableManager)
+: InterruptHandler(interruptManager, 0x0E)
+{
+  this->pageTableManager = pageTableManager;
+}
+
+PageFaultHandler::~PageFaultHandler() {
+}
+
+uint32_t PageFaultHandler::HandleInterrupt(uint32_t esp) {
+  // for a page fault the processor pushes an error code (CPUState::error)
+  //   bit 0: 0 = the page was not present, 1 = protection violation
+  //   bit 1: 0 = read, 1 = write
+  //   bit 2: 1 = the access came from user mode
+  // and the address that caused the fault is in CR2
+  CPUState* cpu = (CPUState*)esp;
+
+  uint32_t address;
+  asm volatile("mov %%cr2, %0" : "=r" (address));
+
+  // a page that is not present yet in user space, just give it a frame
+  // then iret executes the instruction again and this time it works
+  if (!(cpu->error & 0x1) && pageTableManager->HandleDemandFault(address)) {
+    return esp;
+  }
+
+  printf("\nPAGE FAULT at 0x");
+  printfHex32(address);
+  printf(" eip 0x");
+  printfHex32(cpu->eip);
+  printf(" error 0x");
+  printfHex32(cpu->error);
+  printf("\n");
+
+  // there is nothing we can do about it, so stop here
+  while (true) {
+    asm volatile("cli\n hlt");
+  }
+
+  return esp;
+}
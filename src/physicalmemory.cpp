@@ -0,0 +1,251 @@
+#include <physicalmemory.h>
+
+using namespace myos;
+using namespace myos::common;
+
+// the linker script puts these symbols around the kernel image (including .bss)
+extern "C" uint8_t kernel_start;
+extern "C" uint8_t kernel_end;
+
+PhysicalMemoryManager* PhysicalMemoryManager::activePhysicalMemoryManager = 0;
+
+uint8_t PhysicalMemoryManager::blockOrder[PhysicalMemoryManager::MaxFrames];
+
+PhysicalMemoryManager::PhysicalMemoryManager(MultibootInformation* multiboot) {
+  activePhysicalMemoryManager = this;
+
+  for (uint32_t order = 0; order <= MaxOrder; order++) {
+    freeLists[order] = 0;
+  }
+  freeBitmap = 0;
+
+  for (uint32_t frame = 0; frame < MaxFrames; frame++) {
+    blockOrder[frame] = NotFree;
+  }
+
+  freeFrames = 0;
+  totalFrames = 0;
+  highestAddress = 0;
+
+  // things that are in available RAM but that we must not hand out:
+  // the kernel itself and the information the boot loader gave us
+  numReserved = 0;
+  reservedStart[numReserved] = (uint32_t)&kernel_start;
+  reservedEnd[numReserved++] = (uint32_t)&kernel_end;
+  reservedStart[numReserved] = (uint32_t)multiboot;
+  reservedEnd[numReserved++] = (uint32_t)multiboot + sizeof(MultibootInformation);
+
+  if (multiboot->flags & MultibootFlagMemoryMap) {
+    reservedStart[numReserved] = multiboot->mmapAddress;
+    reservedEnd[numReserved++] = multiboot->mmapAddress + multiboot->mmapLength;
+
+    // walk through the memory map and give every available region to the buddy system
+    // the entries are not necessarily sorted and there can be holes between them
+    for (uint32_t entry = multiboot->mmapAddress;
+        entry < multiboot->mmapAddress + multiboot->mmapLength;
+        entry += ((MultibootMemoryMapEntry*)entry)->size + 4) {
+      MultibootMemoryMapEntry* mmap = (MultibootMemoryMapEntry*)entry;
+      if (mmap->type == MultibootMemoryAvailable) {
+        AddRange(mmap->baseAddress, mmap->baseAddress + mmap->length);
+      }
+    }
+  }
+  else if (multiboot->flags & MultibootFlagMemory) {
+    // no memory map, so we can only trust memUpper (KiB above 1 MiB)
+    AddRange(1024*1024, 1024*1024 + (uint64_t)multiboot->memUpper * 1024);
+  }
+}
+
+PhysicalMemoryManager::~PhysicalMemoryManager() {
+  if (activePhysicalMemoryManager == this) {
+    activePhysicalMemoryManager = 0;
+  }
+}
+
+void PhysicalMemoryManager::AddRange(uint64_t start, uint64_t end) {
+  // we don't touch the first MiB, there are the BIOS data, the VGA memory and so on
+  // and we don't manage anything above MaxFrames
+  if (start < 1024*1024) {
+    start = 1024*1024;
+  }
+  if (end > (uint64_t)MaxFrames * PageSize) {
+    end = (uint64_t)MaxFrames * PageSize;
+  }
+
+  // only whole frames
+  start = (start + PageSize - 1) & ~(uint64_t)(PageSize - 1);
+  end = end & ~(uint64_t)(PageSize - 1);
+
+  if (start >= end) {
+    return;
+  }
+
+  // cut out the reserved ranges and add what is left on both sides
+  for (uint32_t i = 0; i < numReserved; i++) {
+    if (reservedStart[i] < end && start < reservedEnd[i]) {
+      AddRange(start, reservedStart[i]);
+      AddRange(reservedEnd[i], end);
+      return;
+    }
+  }
+
+  if (end > highestAddress) {
+    highestAddress = end;
+  }
+
+  // put the range into the free lists in blocks that are as large as possible
+  uint32_t frame = start / PageSize;
+  uint32_t lastFrame = end / PageSize;
+  while (frame < lastFrame) {
+    uint32_t order = MaxOrder;
+    while ((frame & ((1 << order) - 1)) != 0 || frame + (1 << order) > lastFrame) {
+      order--;
+    }
+
+    totalFrames += 1 << order;
+    FreeFrames((void*)(frame * PageSize), order);
+
+    frame += 1 << order;
+  }
+}
+
+void PhysicalMemoryManager::Insert(uint32_t frame, uint32_t order) {
+  FreeFrameBlock* block = (FreeFrameBlock*)(frame * PageSize);
+
+  block->prev = 0;
+  block->next = freeLists[order];
+  if (block->next != 0) {
+    block->next->prev = block;
+  }
+  freeLists[order] = block;
+  freeBitmap |= 1 << order;
+
+  blockOrder[frame] = order;
+}
+
+void PhysicalMemoryManager::Remove(uint32_t frame, uint32_t order) {
+  FreeFrameBlock* block = (FreeFrameBlock*)(frame * PageSize);
+
+  if (block->prev != 0) {
+    block->prev->next = block->next;
+  }
+  else {
+    freeLists[order] = block->next;
+  }
+  if (block->next != 0) {
+    block->next->prev = block->prev;
+  }
+
+  if (freeLists[order] == 0) {
+    freeBitmap &= ~(1 << order);
+  }
+
+  blockOrder[frame] = NotFree;
+}
+
+void* PhysicalMemoryManager::AllocateFrames(uint32_t order) {
+  if (order > MaxOrder) {
+    return 0;
+  }
+
+  // the smallest order >= the requested one that has a free block
+  uint32_t available = freeBitmap & ~((1 << order) - 1);
+  if (available == 0) {
+    return 0;
+  }
+  uint32_t current = __builtin_ctz(available);
+
+  uint32_t frame = (uint32_t)freeLists[current] / PageSize;
+  Remove(frame, current);
+
+  // split the block until it has the requested size
+  // and give the upper halves back to the free lists
+  while (current > order) {
+    current--;
+    Insert(frame + (1 << current), current);
+  }
+
+  freeFrames -= 1 << order;
+  return (void*)(frame * PageSize);
+}
+
+void* PhysicalMemoryManager::AllocateFramesBelow(uint32_t order, uint32_t limit) {
+  if (order > MaxOrder) {
+    return 0;
+  }
+
+  // we keep the lowest part when we split a block, so a block is good
+  // if its first 2^order frames are below the limit
+  // this time we have to walk the free lists, but the free lists are short
+  uint32_t lastFrame = limit / PageSize;
+  for (uint32_t current = order; current <= MaxOrder; current++) {
+    for (FreeFrameBlock* block = freeLists[current]; block != 0; block = block->next) {
+      uint32_t frame = (uint32_t)block / PageSize;
+      if (frame + (1 << order) > lastFrame) {
+        continue;
+      }
+
+      Remove(frame, current);
+      while (current > order) {
+        current--;
+        Insert(frame + (1 << current), current);
+      }
+
+      freeFrames -= 1 << order;
+      return (void*)(frame * PageSize);
+    }
+  }
+
+  return 0;
+}
+
+void PhysicalMemoryManager::FreeFrames(void* address, uint32_t order) {
+  uint32_t frame = (uint32_t)address / PageSize;
+  freeFrames += 1 << order;
+
+  // merge with the buddy as long as the buddy is free and has the same order
+  while (order < MaxOrder) {
+    uint32_t buddy = frame ^ (1 << order);
+    if (buddy >= MaxFrames || blockOrder[buddy] != order) {
+      break;
+    }
+
+    Remove(buddy, order);
+
+    // the merged block starts at the lower one of the two
+    if (buddy < frame) {
+      frame = buddy;
+    }
+    order++;
+  }
+
+  Insert(frame, order);
+}
+
+void* PhysicalMemoryManager::AllocateFrame() {
+  return AllocateFrames(0);
+}
+
+void PhysicalMemoryManager::FreeFrame(void* address) {
+  FreeFrames(address, 0);
+}
+
+uint32_t PhysicalMemoryManager::OrderOf(size_t size) {
+  uint32_t order = 0;
+  while (((size_t)PageSize << order) < size) {
+    order++;
+  }
+  return order;
+}
+
+uint32_t PhysicalMemoryManager::FreeFrameCount() {
+  return freeFrames;
+}
+
+uint32_t PhysicalMemoryManager::TotalFrameCount() {
+  return totalFrames;
+}
+
+uint32_t PhysicalMemoryManager::HighestAddress() {
+  return highestAddress;
+}
@@ -0,0 +1,129 @@
+#include <reservepool.h>
+#include <hardwarecommunication/interrupts.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+ReservePool* ReservePool::pools = 0;
+
+ReservePool::ReservePool(size_t blockSize, uint32_t target, MemoryTag tag) {
+  freeList = 0;
+  available = 0;
+  misses = 0;
+
+  // every block must be large enough for the link of the free list
+  if (blockSize < sizeof(ReserveBlock)) {
+    blockSize = sizeof(ReserveBlock);
+  }
+  this->blockSize = blockSize;
+  this->target = target;
+  this->tag = tag;
+
+  uint32_t eflags = SaveInterrupts();
+  nextPool = pools;
+  pools = this;
+  RestoreInterrupts(eflags);
+
+  Refill();
+}
+
+ReservePool::~ReservePool() {
+  uint32_t eflags = SaveInterrupts();
+  for (ReservePool** pool = &pools; *pool != 0; pool = &(*pool)->nextPool) {
+    if (*pool == this) {
+      *pool = nextPool;
+      break;
+    }
+  }
+  RestoreInterrupts(eflags);
+
+  // blocks that are still out are lost, the owner has to give them back first
+  if (MemoryManager::activeMemoryManager == 0) {
+    return;
+  }
+  for (ReserveBlock* block = Pop(); block != 0; block = Pop()) {
+    MemoryManager::activeMemoryManager->free(block);
+  }
+}
+
+void ReservePool::Push(ReserveBlock* block) {
+  uint32_t eflags = SaveInterrupts();
+  block->next = freeList;
+  freeList = block;
+  available++;
+  RestoreInterrupts(eflags);
+}
+
+ReservePool::ReserveBlock* ReservePool::Pop() {
+  uint32_t eflags = SaveInterrupts();
+  ReserveBlock* block = freeList;
+  if (block != 0) {
+    freeList = block->next;
+    available--;
+  }
+  RestoreInterrupts(eflags);
+  return block;
+}
+
+void* ReservePool::Allocate() {
+  ReserveBlock* block = Pop();
+  if (block == 0) {
+    misses++;
+  }
+  return block;
+}
+
+void ReservePool::Free(void* block) {
+  if (block != 0) {
+    Push((ReserveBlock*)block);
+  }
+}
+
+void ReservePool::Refill() {
+  // malloc in an interrupt handler is exactly what we want to avoid
+  if (InterruptManager::InInterrupt() || MemoryManager::activeMemoryManager == 0) {
+    return;
+  }
+
+  // Allocate and Free (the receive path of the network card) change
+  // available behind our back in both directions, so we look at it again
+  // with the interrupts off before we push, and give the block back if the
+  // pool has filled up in the meantime
+  while (available < target) {
+    void* block = MemoryManager::activeMemoryManager->malloc(blockSize, tag);
+    if (block == 0) {
+      break;
+    }
+
+    uint32_t eflags = SaveInterrupts();
+    bool wanted = available < target;
+    if (wanted) {
+      Push((ReserveBlock*)block);
+    }
+    RestoreInterrupts(eflags);
+
+    if (!wanted) {
+      MemoryManager::activeMemoryManager->free(block);
+      break;
+    }
+  }
+}
+
+void ReservePool::RefillAll() {
+  for (ReservePool* pool = pools; pool != 0; pool = pool->nextPool) {
+    pool->Refill();
+  }
+}
+
+size_t ReservePool::BlockSize() {
+  return blockSize;
+}
+
+uint32_t ReservePool::Available() {
+  return available;
+}
+
+uint32_t ReservePool::Misses() {
+  return misses;
+}
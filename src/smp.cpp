@@ -0,0 +1,312 @@
+#include <smp.h>
+#include <fpu.h>
+#include <stackpool.h>
+#include <memorymanagement.h>
+#include <drivers/timer.h>
+#include <hardwarecommunication/interrupts.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::drivers;
+using namespace myos::hardwarecommunication;
+
+void printf(char*);
+void printfHex(uint8_t);
+
+// smpboot.s
+extern "C" uint8_t smp_trampoline_start;
+extern "C" uint8_t smp_trampoline_parameters;
+extern "C" uint8_t smp_trampoline_end;
+
+// what the trampoline needs, at smp_trampoline_parameters
+struct TrampolineParameters {
+  uint32_t cr0;
+  uint32_t cr3;
+  uint32_t cr4;
+  uint32_t stack;
+  uint32_t entry;
+  uint32_t index;
+} __attribute__((packed));
+
+// https://wiki.osdev.org/RSDP
+// the BIOS leaves it somewhere on a 16 byte boundary, it points to the RSDT
+struct RootSystemDescriptionPointer {
+  char signature[8]; // "RSD PTR "
+  uint8_t checksum;
+  char oem[6];
+  uint8_t revision;
+  uint32_t rsdtAddress;
+} __attribute__((packed));
+
+// every ACPI table starts with this, the RSDT is a list of 32 bit addresses of the others
+struct SystemDescriptionHeader {
+  char signature[4];
+  uint32_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem[6];
+  char oemTable[8];
+  uint32_t oemRevision;
+  uint32_t creator;
+  uint32_t creatorRevision;
+} __attribute__((packed));
+
+// https://wiki.osdev.org/MADT
+// "APIC", followed by entries of different types and lengths
+struct MultipleAPICDescriptionTable {
+  SystemDescriptionHeader header;
+  uint32_t localAPICAddress;
+  uint32_t flags;
+} __attribute__((packed));
+
+struct MultipleAPICEntry {
+  uint8_t type;   // 0 for a processor with its local APIC
+  uint8_t length;
+  uint8_t processor;
+  uint8_t apicId;
+  uint32_t flags; // bit 0: enabled
+} __attribute__((packed));
+
+// all the bytes of an ACPI table add up to 0
+static bool Checksum(uint8_t* data, uint32_t size) {
+  uint8_t sum = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    sum += data[i];
+  }
+  return sum == 0;
+}
+
+static bool SameSignature(char* a, char* b, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    if (a[i] != b[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static RootSystemDescriptionPointer* FindRootPointer(uint32_t start, uint32_t end) {
+  for (uint32_t address = start; address + sizeof(RootSystemDescriptionPointer) <= end; address += 16) {
+    RootSystemDescriptionPointer* pointer = (RootSystemDescriptionPointer*)address;
+    if (SameSignature(pointer->signature, "RSD PTR ", 8) && Checksum((uint8_t*)pointer, sizeof(RootSystemDescriptionPointer))) {
+      return pointer;
+    }
+  }
+  return 0;
+}
+
+ProcessorManager* ProcessorManager::activeProcessorManager = 0;
+
+ProcessorManager::ProcessorManager(TaskManager* taskManager, PageTableManager* pageTableManager,
+                                   ProgrammableIntervalTimer* timer) {
+  this->taskManager = taskManager;
+  this->pageTableManager = pageTableManager;
+  this->timer = timer;
+  localAPIC = 0;
+  localAPICBase = LocalAPIC::DefaultBase;
+  numFound = 0;
+  for (uint32_t i = 0; i < CPU::MaxCPUs; i++) {
+    gdts[i] = 0;
+  }
+
+  // we are processor 0
+  CPU::cpus[0].online = true;
+
+  if (activeProcessorManager == 0) {
+    activeProcessorManager = this;
+  }
+}
+
+ProcessorManager::~ProcessorManager() {
+  if (activeProcessorManager == this) {
+    activeProcessorManager = 0;
+  }
+}
+
+void ProcessorManager::MapTable(uint32_t address, uint32_t size) {
+  // usually the tables are at the end of the RAM and in the direct map already
+  pageTableManager->MapMemoryMappedIO(address, size);
+}
+
+bool ProcessorManager::FindProcessors() {
+  // the first KiB of the extended BIOS data area (its segment is at 0x40E),
+  // then the BIOS area from 0xE0000 to 1 MiB
+  uint32_t ebda = (uint32_t)(*(uint16_t*)0x40E) << 4;
+  RootSystemDescriptionPointer* root = FindRootPointer(ebda, ebda + 1024);
+  if (root == 0) {
+    root = FindRootPointer(0xE0000, 0x100000);
+  }
+  if (root == 0) {
+    return false;
+  }
+
+  MapTable(root->rsdtAddress, sizeof(SystemDescriptionHeader));
+  SystemDescriptionHeader* rsdt = (SystemDescriptionHeader*)root->rsdtAddress;
+  MapTable(root->rsdtAddress, rsdt->length);
+  if (!Checksum((uint8_t*)rsdt, rsdt->length)) {
+    return false;
+  }
+
+  uint32_t* tables = (uint32_t*)(rsdt + 1);
+  uint32_t numTables = (rsdt->length - sizeof(SystemDescriptionHeader)) / 4;
+
+  for (uint32_t i = 0; i < numTables; i++) {
+    MapTable(tables[i], sizeof(SystemDescriptionHeader));
+    SystemDescriptionHeader* header = (SystemDescriptionHeader*)tables[i];
+    if (!SameSignature(header->signature, "APIC", 4)) {
+      continue;
+    }
+
+    MapTable(tables[i], header->length);
+    if (!Checksum((uint8_t*)header, header->length)) {
+      return false;
+    }
+
+    MultipleAPICDescriptionTable* madt = (MultipleAPICDescriptionTable*)header;
+    localAPICBase = madt->localAPICAddress;
+
+    uint32_t offset = sizeof(MultipleAPICDescriptionTable);
+    while (offset + 2 <= header->length) {
+      MultipleAPICEntry* entry = (MultipleAPICEntry*)((uint8_t*)header + offset);
+      if (entry->length == 0) {
+        break;
+      }
+
+      if (entry->type == 0 && (entry->flags & 1) != 0 && numFound < CPU::MaxCPUs) {
+        apicIds[numFound++] = entry->apicId;
+      }
+      offset += entry->length;
+    }
+    return numFound > 0;
+  }
+
+  return false;
+}
+
+bool ProcessorManager::Start(uint32_t index, uint8_t apicId) {
+  if (StackPool::activeStackPool == 0) {
+    return false;
+  }
+  uint8_t* stack = (uint8_t*)StackPool::activeStackPool->Allocate(StackSize);
+  if (stack == 0) {
+    return false;
+  }
+  if (gdts[index] == 0) {
+    gdts[index] = (GlobalDescriptorTable*)MemoryManager::activeMemoryManager->malloc(sizeof(GlobalDescriptorTable), MemoryTagKernel);
+    if (gdts[index] == 0) {
+      StackPool::activeStackPool->Free(stack, StackSize);
+      return false;
+    }
+  }
+
+  // the trampoline must be where the startup IPI sends the processor
+  uint8_t* trampoline = (uint8_t*)Trampoline;
+  uint32_t size = &smp_trampoline_end - &smp_trampoline_start;
+  for (uint32_t i = 0; i < size; i++) {
+    trampoline[i] = (&smp_trampoline_start)[i];
+  }
+
+  TrampolineParameters* parameters = (TrampolineParameters*)(trampoline + (&smp_trampoline_parameters - &smp_trampoline_start));
+  asm volatile("mov %%cr0, %0" : "=r" (parameters->cr0));
+  asm volatile("mov %%cr3, %0" : "=r" (parameters->cr3));
+  asm volatile("mov %%cr4, %0" : "=r" (parameters->cr4));
+  parameters->stack = (uint32_t)(stack + StackSize);
+  parameters->entry = (uint32_t)ApplicationProcessorMain;
+  parameters->index = index;
+
+  CPU::Register(index, apicId);
+  CPU::cpus[index].online = false;
+
+  // INIT, 10 ms, and two startup IPIs 200 microseconds apart
+  localAPIC->SendInit(apicId);
+  timer->Wait(11932);
+  for (int i = 0; i < 2 && !CPU::cpus[index].online; i++) {
+    localAPIC->SendStartup(apicId, Trampoline);
+    timer->Wait(239);
+  }
+
+  // it has 100 ms to say that it runs
+  for (int i = 0; i < 10 && !CPU::cpus[index].online; i++) {
+    timer->Wait(11932);
+  }
+
+  if (!CPU::cpus[index].online) {
+    StackPool::activeStackPool->Free(stack, StackSize);
+    return false;
+  }
+  return true;
+}
+
+uint32_t ProcessorManager::StartAll() {
+  if (!LocalAPIC::Present() || !FindProcessors() || numFound < 2) {
+    return CPU::numOnline;
+  }
+
+  pageTableManager->MapMemoryMappedIO(localAPICBase, 4096);
+  localAPIC = new LocalAPIC(localAPICBase);
+  localAPIC->Activate();
+  CPU::Register(0, localAPIC->Id());
+
+  // the other processors use the timer of their local APIC for their ticks
+  localAPIC->CalibrateTimer(timer, taskManager->TickMicroseconds());
+
+  // the interrupts must be on, see KernelLock: from now on whoever
+  // switches them off takes the lock, so we take it for us as well
+  uint32_t eflags = SaveInterrupts();
+  if ((eflags & 0x200) == 0) {
+    RestoreInterrupts(eflags);
+    return CPU::numOnline;
+  }
+  KernelLock::enabled = true;
+  KernelLock::Lock();
+
+  for (uint32_t i = 0; i < numFound && CPU::numOnline < CPU::MaxCPUs; i++) {
+    if (apicIds[i] == CPU::cpus[0].apicId) {
+      continue;
+    }
+
+    // the processors are numbered in the order in which they start,
+    // so 0 to numOnline - 1 always run
+    if (Start(CPU::numOnline, apicIds[i])) {
+      CPU::numOnline = CPU::numOnline + 1;
+    }
+  }
+
+  // the others wait for the lock, now they can go
+  RestoreInterrupts(eflags);
+
+  printf("processors: 0x");
+  printfHex(CPU::numOnline);
+  printf("\n");
+  return CPU::numOnline;
+}
+
+void ProcessorManager::ApplicationProcessorMain(uint32_t index) {
+  ProcessorManager* processorManager = activeProcessorManager;
+
+  // the GDT of the trampoline has no GS for us yet, until here
+  // nothing may ask CPU who we are
+  new (processorManager->gdts[index]) GlobalDescriptorTable(&CPU::cpus[index]);
+  InterruptManager::LoadInterruptDescriptorTable();
+  LocalAPIC::activeLocalAPIC->Activate();
+
+  // the first processor waits for this, it holds the lock until all of us run
+  CPU::cpus[index].online = true;
+  KernelLock::Lock();
+
+  // the registers of the FPU belong to nobody yet, so the first use traps
+  if (FloatingPointUnit::activeFloatingPointUnit != 0) {
+    FloatingPointUnit::activeFloatingPointUnit->TaskSwitched(0);
+  }
+
+  LocalAPIC::activeLocalAPIC->StartTimer(InterruptManager::LocalTimerInterrupt);
+
+  // interrupts on, without the lock
+  KernelLock::Unlock();
+  asm volatile("sti");
+
+  // our idle loop, the TaskManager switches from here to the tasks
+  while (true) {
+    processorManager->taskManager->Idle();
+  }
+}
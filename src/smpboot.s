@@ -0,0 +1,97 @@
+# The code that the other processors (application processors) start with.
+#
+# After the startup IPI a processor starts in real mode at vector << 12,
+# so ProcessorManager::Start copies everything from smp_trampoline_start to
+# smp_trampoline_end to TRAMPOLINE (below 1 MiB, the PhysicalMemoryManager
+# never hands out that memory) and fills in the parameters at the end.
+# The code runs at that address and not where the linker put it, so every
+# address in here is TRAMPOLINE + (label - smp_trampoline_start).
+#
+# From there we do what grub did for the first processor: a GDT, protected
+# mode, and then what the first processor did in kernelMain: the same CR4
+# (4 MiB pages, SSE), the same page directory and the same CR0 (paging).
+
+.set TRAMPOLINE, 0x8000
+
+.section .text
+
+.global smp_trampoline_start
+.global smp_trampoline_parameters
+.global smp_trampoline_end
+
+.code16
+smp_trampoline_start:
+  cli
+  cld
+
+  # CS is TRAMPOLINE >> 4, the data segment starts at 0
+  xorw %ax, %ax
+  movw %ax, %ds
+
+  lgdtl TRAMPOLINE + (trampoline_gdt_pointer - smp_trampoline_start)
+
+  # PE: protected mode
+  movl %cr0, %eax
+  orl $1, %eax
+  movl %eax, %cr0
+
+  # the far jump loads the code segment of the GDT
+  ljmpl $0x10, $(TRAMPOLINE + (trampoline_protected - smp_trampoline_start))
+
+.code32
+trampoline_protected:
+  movw $0x18, %ax
+  movw %ax, %ds
+  movw %ax, %es
+  movw %ax, %fs
+  movw %ax, %gs
+  movw %ax, %ss
+
+  movl $(TRAMPOLINE + (smp_trampoline_parameters - smp_trampoline_start)), %ebx
+
+  # CR4 first, the page directory has 4 MiB pages
+  movl 8(%ebx), %eax
+  movl %eax, %cr4
+  movl 4(%ebx), %eax
+  movl %eax, %cr3
+  movl 0(%ebx), %eax
+  movl %eax, %cr0
+
+  # the stack of this processor, and entry(index)
+  movl 12(%ebx), %esp
+  pushl 20(%ebx)
+  movl 16(%ebx), %eax
+  call *%eax
+
+stop:
+  cli
+  hlt
+  jmp stop
+
+# the same selectors as the GlobalDescriptorTable of the kernel (null, unused,
+# code, data), so nothing changes when the processor loads that one later
+.align 8
+trampoline_gdt:
+  .quad 0
+  .quad 0
+  .quad 0x00CF9A000000FFFF # code, 4 GiB
+  .quad 0x00CF92000000FFFF # data, 4 GiB
+
+trampoline_gdt_pointer:
+  .word 4 * 8 - 1
+  .long TRAMPOLINE + (trampoline_gdt - smp_trampoline_start)
+
+# struct TrampolineParameters in smp.cpp
+.align 4
+smp_trampoline_parameters:
+  .long 0 # cr0
+  .long 0 # cr3
+  .long 0 # cr4
+  .long 0 # stack
+  .long 0 # entry
+  .long 0 # index
+
+smp_trampoline_end:
+
+# no executable stack, the linker warns about it otherwise
+.section .note.GNU-stack,"",@progbits
@@ -0,0 +1,95 @@
+#include <stackpool.h>
+#include <hardwarecommunication/interrupts.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+StackPool* StackPool::activeStackPool = 0;
+
+StackPool::StackPool(PhysicalMemoryManager* frames) {
+  this->frames = frames;
+  for (uint32_t i = 0; i < NumSizes; i++) {
+    freeStacks[i] = 0;
+    numFree[i] = 0;
+  }
+  hits = 0;
+  misses = 0;
+
+  if (activeStackPool == 0) {
+    activeStackPool = this;
+  }
+}
+
+StackPool::~StackPool() {
+  if (activeStackPool == this) {
+    activeStackPool = 0;
+  }
+
+  for (uint32_t i = 0; i < NumSizes; i++) {
+    while (freeStacks[i] != 0) {
+      FreeStack* stack = freeStacks[i];
+      freeStacks[i] = stack->next;
+      frames->FreeFrames(stack, i);
+    }
+    numFree[i] = 0;
+  }
+}
+
+uint32_t StackPool::RoundUp(uint32_t size) {
+  return MinStackSize << PhysicalMemoryManager::OrderOf(size);
+}
+
+void* StackPool::Allocate(uint32_t size) {
+  if (size > MaxStackSize) {
+    return 0;
+  }
+  uint32_t order = PhysicalMemoryManager::OrderOf(size);
+
+  // tasks are created from other tasks, and the frames are shared with
+  // the page fault handler, so nobody may switch away in the middle
+  uint32_t eflags = SaveInterrupts();
+
+  void* result = freeStacks[order];
+  if (result != 0) {
+    freeStacks[order] = freeStacks[order]->next;
+    numFree[order]--;
+    hits++;
+  }
+  else {
+    result = frames->AllocateFrames(order);
+    misses++;
+  }
+
+  RestoreInterrupts(eflags);
+  return result;
+}
+
+void StackPool::Free(void* stack, uint32_t size) {
+  if (stack == 0) {
+    return;
+  }
+  uint32_t order = PhysicalMemoryManager::OrderOf(size);
+
+  uint32_t eflags = SaveInterrupts();
+
+  if (numFree[order] < MaxCached) {
+    FreeStack* free = (FreeStack*)stack;
+    free->next = freeStacks[order];
+    freeStacks[order] = free;
+    numFree[order]++;
+  }
+  else {
+    frames->FreeFrames(stack, order);
+  }
+
+  RestoreInterrupts(eflags);
+}
+
+uint32_t StackPool::Hits() {
+  return hits;
+}
+
+uint32_t StackPool::Misses() {
+  return misses;
+}
@@ -0,0 +1,256 @@
+#include <synchronization.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+void printf(char*);
+void printfHex32(uint32_t);
+
+#ifdef LOCKSTATISTICS
+// start is the rdtsc when we found the lock taken, 0 if we got it right away
+static void Acquired(LockStatistics* statistics, uint64_t start) {
+  statistics->acquisitions++;
+  if (start != 0) {
+    statistics->contentions++;
+    statistics->waitCycles += rdtsc() - start;
+  }
+}
+
+static void Clear(LockStatistics* statistics) {
+  statistics->acquisitions = 0;
+  statistics->contentions = 0;
+  statistics->waitCycles = 0;
+}
+#endif
+
+static Task* CurrentTask() {
+  return TaskManager::activeTaskManager != 0 ? TaskManager::activeTaskManager->CurrentTask() : 0;
+}
+
+Mutex::Mutex() {
+  locked = false;
+  owner = 0;
+#ifdef LOCKSTATISTICS
+  Clear(&statistics);
+#endif
+}
+
+Mutex::~Mutex() {
+}
+
+void Mutex::Lock() {
+  // the check and the Wait with the interrupts off, see WaitQueue
+  uint32_t eflags = SaveInterrupts();
+#ifdef LOCKSTATISTICS
+  uint64_t start = locked ? rdtsc() : 0;
+#endif
+
+  while (locked) {
+    waiters.Wait();
+  }
+  locked = true;
+  owner = CurrentTask();
+
+#ifdef LOCKSTATISTICS
+  Acquired(&statistics, start);
+#endif
+  RestoreInterrupts(eflags);
+}
+
+bool Mutex::TryLock() {
+  uint32_t eflags = SaveInterrupts();
+  bool result = !locked;
+  if (result) {
+    locked = true;
+    owner = CurrentTask();
+#ifdef LOCKSTATISTICS
+    Acquired(&statistics, 0);
+#endif
+  }
+  RestoreInterrupts(eflags);
+  return result;
+}
+
+void Mutex::Unlock() {
+  uint32_t eflags = SaveInterrupts();
+  locked = false;
+  owner = 0;
+  // the next one looks again, somebody who comes before it might be faster
+  waiters.WakeOne();
+  RestoreInterrupts(eflags);
+}
+
+bool Mutex::Locked() {
+  return locked;
+}
+
+Task* Mutex::Owner() {
+  return owner;
+}
+
+LockStatistics* Mutex::Statistics() {
+#ifdef LOCKSTATISTICS
+  return &statistics;
+#else
+  return 0;
+#endif
+}
+
+Semaphore::Semaphore(uint32_t count) {
+  this->count = count;
+#ifdef LOCKSTATISTICS
+  Clear(&statistics);
+#endif
+}
+
+Semaphore::~Semaphore() {
+}
+
+bool Semaphore::Down(uint32_t timeoutMilliseconds) {
+  uint32_t eflags = SaveInterrupts();
+#ifdef LOCKSTATISTICS
+  uint64_t start = count == 0 ? rdtsc() : 0;
+#endif
+
+  while (count == 0) {
+    // every Wait gets the whole timeout again, good enough for a timeout
+    if (!waiters.Wait(timeoutMilliseconds)) {
+      RestoreInterrupts(eflags);
+      return false;
+    }
+  }
+  count--;
+
+#ifdef LOCKSTATISTICS
+  Acquired(&statistics, start);
+#endif
+  RestoreInterrupts(eflags);
+  return true;
+}
+
+bool Semaphore::TryDown() {
+  uint32_t eflags = SaveInterrupts();
+  bool result = count > 0;
+  if (result) {
+    count--;
+#ifdef LOCKSTATISTICS
+    Acquired(&statistics, 0);
+#endif
+  }
+  RestoreInterrupts(eflags);
+  return result;
+}
+
+void Semaphore::Up() {
+  uint32_t eflags = SaveInterrupts();
+  count++;
+  waiters.WakeOne();
+  RestoreInterrupts(eflags);
+}
+
+uint32_t Semaphore::Count() {
+  return count;
+}
+
+LockStatistics* Semaphore::Statistics() {
+#ifdef LOCKSTATISTICS
+  return &statistics;
+#else
+  return 0;
+#endif
+}
+
+ReadWriteLock::ReadWriteLock() {
+  readers = 0;
+  writer = false;
+  waitingWriters = 0;
+#ifdef LOCKSTATISTICS
+  Clear(&statistics);
+#endif
+}
+
+ReadWriteLock::~ReadWriteLock() {
+}
+
+void ReadWriteLock::LockRead() {
+  uint32_t eflags = SaveInterrupts();
+#ifdef LOCKSTATISTICS
+  uint64_t start = (writer || waitingWriters != 0) ? rdtsc() : 0;
+#endif
+
+  while (writer || waitingWriters != 0) {
+    readQueue.Wait();
+  }
+  readers++;
+
+#ifdef LOCKSTATISTICS
+  Acquired(&statistics, start);
+#endif
+  RestoreInterrupts(eflags);
+}
+
+void ReadWriteLock::UnlockRead() {
+  uint32_t eflags = SaveInterrupts();
+  readers--;
+  if (readers == 0 && waitingWriters != 0) {
+    writeQueue.WakeOne();
+  }
+  RestoreInterrupts(eflags);
+}
+
+void ReadWriteLock::LockWrite() {
+  uint32_t eflags = SaveInterrupts();
+#ifdef LOCKSTATISTICS
+  uint64_t start = (writer || readers != 0) ? rdtsc() : 0;
+#endif
+
+  waitingWriters++;
+  while (writer || readers != 0) {
+    writeQueue.Wait();
+  }
+  waitingWriters--;
+  writer = true;
+
+#ifdef LOCKSTATISTICS
+  Acquired(&statistics, start);
+#endif
+  RestoreInterrupts(eflags);
+}
+
+void ReadWriteLock::UnlockWrite() {
+  uint32_t eflags = SaveInterrupts();
+  writer = false;
+  // the writers first, the readers wait for them anyway
+  if (waitingWriters != 0) {
+    writeQueue.WakeOne();
+  }
+  else {
+    readQueue.WakeAll();
+  }
+  RestoreInterrupts(eflags);
+}
+
+LockStatistics* ReadWriteLock::Statistics() {
+#ifdef LOCKSTATISTICS
+  return &statistics;
+#else
+  return 0;
+#endif
+}
+
+void myos::PrintLockStatistics(char* name, LockStatistics* statistics) {
+  if (statistics == 0) {
+    return;
+  }
+
+  // heap: locks 0x00001000 contended 0x00000010 wait cycles 0x00004000
+  printf(name);
+  printf(": locks 0x");
+  printfHex32(statistics->acquisitions);
+  printf(" contended 0x");
+  printfHex32(statistics->contentions);
+  printf(" wait cycles 0x");
+  printfHex32((uint32_t)statistics->waitCycles);
+  printf("\n");
+}
@@ -1,4 +1,8 @@
 #include <syscalls.h>
+#include <memorymanagement.h>
+#include <clock.h>
+#include <workqueue.h>
+#include <coroutine.h>
 
 using namespace myos;
 using namespace myos::common;
@@ -22,6 +26,68 @@ uint32_t SyscallHandler::HandleInterrupt(uint32_t esp) {
     case 4:
       printf((char*)cpu->ebx);
       break;
+
+    case SyscallHeapStatistics:
+      // copy the counters to the caller, eax = 0 if there is a heap
+      if (MemoryManager::activeMemoryManager == 0) {
+        cpu->eax = -1;
+        break;
+      }
+      if (cpu->ebx != 0) {
+        *(MemoryStatistics*)cpu->ebx = MemoryManager::activeMemoryManager->GetStatistics();
+      }
+      if (cpu->ecx != 0) {
+        MemoryManager::activeMemoryManager->GetFragmentation((MemoryFragmentation*)cpu->ecx);
+      }
+      cpu->eax = 0;
+      break;
+
+    case SyscallHeapDump:
+      if (MemoryManager::activeMemoryManager != 0) {
+        MemoryManager::activeMemoryManager->PrintStatistics();
+      }
+      break;
+
+    case SyscallClock:
+      // the monotonic time in nanoseconds, eax = 0 if there is a clock
+      if (Clock::activeClock == 0 || cpu->ebx == 0) {
+        cpu->eax = -1;
+        break;
+      }
+      *(uint64_t*)cpu->ebx = now_ns();
+      cpu->eax = 0;
+      break;
+
+    case SyscallTaskStatistics:
+      // the accounting of a task, eax = 0 if there is such a task
+      {
+        TaskManager* taskManager = TaskManager::activeTaskManager;
+        uint32_t id = cpu->ebx;
+        if (id == 0 && taskManager != 0 && taskManager->CurrentTask() != 0) {
+          id = taskManager->CurrentTask()->Id();
+        }
+        if (taskManager == 0 || cpu->ecx == 0 || !taskManager->GetTaskStatistics(id, (TaskStatistics*)cpu->ecx)) {
+          cpu->eax = -1;
+          break;
+        }
+        cpu->eax = 0;
+      }
+      break;
+
+    case SyscallSchedulerDump:
+      if (TaskManager::activeTaskManager != 0) {
+        TaskManager::activeTaskManager->PrintStatistics();
+      }
+      if (WorkQueue::activeTasklets != 0) {
+        WorkQueue::activeTasklets->PrintStatistics();
+      }
+      if (WorkQueue::activeWorkers != 0) {
+        WorkQueue::activeWorkers->PrintStatistics();
+      }
+      if (CoroutineExecutor::activeCoroutineExecutor != 0) {
+        CoroutineExecutor::activeCoroutineExecutor->PrintStatistics();
+      }
+      break;
   }
 
   return esp;
@@ -0,0 +1,245 @@
+#include <timerwheel.h>
+#include <hardwarecommunication/interrupts.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+Timer::Timer(void (*callback)(void* data), void* data) {
+  wheel = 0;
+  list = 0;
+  next = 0;
+  prev = 0;
+  expires = 0;
+
+  this->callback = callback;
+  this->data = data;
+  runInInterrupt = false;
+}
+
+Timer::~Timer() {
+  // the wheel must not call us anymore after we are gone
+  if (wheel != 0) {
+    wheel->Cancel(this);
+  }
+}
+
+bool Timer::Pending() {
+  return list != 0;
+}
+
+uint64_t Timer::Expires() {
+  return expires;
+}
+
+TimerWheel* TimerWheel::activeTimerWheel = 0;
+
+TimerWheel::TimerWheel() {
+  for (uint32_t level = 0; level < NumLevels; level++) {
+    for (uint32_t slot = 0; slot < SlotsPerLevel; slot++) {
+      slots[level][slot] = 0;
+    }
+  }
+
+  expiredHead = 0;
+  expiredTail = 0;
+
+  // the first timer interrupt counts tick 1
+  current = 1;
+  pending = 0;
+
+  if (activeTimerWheel == 0) {
+    activeTimerWheel = this;
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  if (activeTimerWheel == this) {
+    activeTimerWheel = 0;
+  }
+}
+
+void TimerWheel::Insert(Timer* timer) {
+  // timers further away than level 3 reaches expire at its end
+  if (timer->expires - current > MaxTicks) {
+    timer->expires = current + MaxTicks;
+  }
+  uint32_t delta = timer->expires - current;
+
+  // the first level that reaches that far, and there the slot
+  // from the bits of the expiry tick for that level
+  uint32_t level = 0;
+  while (level < NumLevels - 1 && delta >= (uint32_t)1 << (LevelBits * (level + 1))) {
+    level++;
+  }
+  uint32_t slot = (timer->expires >> (LevelBits * level)) & (SlotsPerLevel - 1);
+
+  Timer** list = &slots[level][slot];
+  timer->wheel = this;
+  timer->list = list;
+  timer->prev = 0;
+  timer->next = *list;
+  if (*list != 0) {
+    (*list)->prev = timer;
+  }
+  *list = timer;
+  pending++;
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+  if (timer->prev != 0) {
+    timer->prev->next = timer->next;
+  }
+  else {
+    *timer->list = timer->next;
+  }
+  if (timer->next != 0) {
+    timer->next->prev = timer->prev;
+  }
+
+  if (timer->list == &expiredHead) {
+    if (expiredTail == timer) {
+      expiredTail = timer->prev;
+    }
+  }
+  else {
+    pending--;
+  }
+
+  timer->list = 0;
+  timer->next = 0;
+  timer->prev = 0;
+}
+
+void TimerWheel::Cascade(uint32_t level) {
+  // all of these expire in the next 64 ticks of the level below,
+  // Insert spreads them over that level (or level 0)
+  uint32_t slot = (current >> (LevelBits * level)) & (SlotsPerLevel - 1);
+  Timer* timer = slots[level][slot];
+  slots[level][slot] = 0;
+
+  while (timer != 0) {
+    Timer* next = timer->next;
+    pending--;
+    Insert(timer);
+    timer = next;
+  }
+}
+
+void TimerWheel::Add(Timer* timer, uint32_t ticks) {
+  uint32_t eflags = SaveInterrupts();
+
+  if (timer->list != 0) {
+    timer->wheel->Unlink(timer);
+  }
+  if (ticks == 0) {
+    ticks = 1;
+  }
+  timer->expires = current + ticks - 1;
+  Insert(timer);
+
+  RestoreInterrupts(eflags);
+}
+
+bool TimerWheel::Cancel(Timer* timer) {
+  uint32_t eflags = SaveInterrupts();
+
+  bool wasPending = timer->list != 0;
+  if (wasPending) {
+    Unlink(timer);
+  }
+
+  RestoreInterrupts(eflags);
+  return wasPending;
+}
+
+bool TimerWheel::Advance(uint64_t now) {
+  uint32_t eflags = SaveInterrupts();
+
+  while (current <= now) {
+    uint32_t slot = current & (SlotsPerLevel - 1);
+
+    // at the start of every 64 ticks the next slot of level 1 comes down,
+    // and if that was slot 0 of level 1 the next slot of level 2, and so on
+    if (slot == 0) {
+      for (uint32_t level = 1; level < NumLevels; level++) {
+        Cascade(level);
+        if (((current >> (LevelBits * level)) & (SlotsPerLevel - 1)) != 0) {
+          break;
+        }
+      }
+    }
+
+    while (slots[0][slot] != 0) {
+      Timer* timer = slots[0][slot];
+      Unlink(timer);
+
+      if (timer->runInInterrupt) {
+        timer->callback(timer->data);
+        continue;
+      }
+
+      // the others go to the end of the expired list for RunExpired
+      timer->list = &expiredHead;
+      timer->prev = expiredTail;
+      timer->next = 0;
+      if (expiredTail != 0) {
+        expiredTail->next = timer;
+      }
+      else {
+        expiredHead = timer;
+      }
+      expiredTail = timer;
+    }
+
+    current++;
+  }
+
+  bool expired = expiredHead != 0;
+  RestoreInterrupts(eflags);
+  return expired;
+}
+
+uint32_t TimerWheel::TicksUntilNext(uint32_t limit) {
+  uint32_t eflags = SaveInterrupts();
+
+  uint32_t result = limit;
+  if (pending != 0) {
+    // only level 0 until its end, at the end the next cascade might bring
+    // timers down from above, so we can't sleep longer than that
+    uint32_t slot = current & (SlotsPerLevel - 1);
+    uint32_t ticks = 1;
+    while (ticks < result && slots[0][slot] == 0 && slot < SlotsPerLevel - 1) {
+      slot++;
+      ticks++;
+    }
+    result = ticks;
+  }
+
+  RestoreInterrupts(eflags);
+  return result;
+}
+
+bool TimerWheel::HasExpired() {
+  return expiredHead != 0;
+}
+
+void TimerWheel::RunExpired() {
+  while (true) {
+    uint32_t eflags = SaveInterrupts();
+    Timer* timer = expiredHead;
+    if (timer != 0) {
+      Unlink(timer);
+    }
+    RestoreInterrupts(eflags);
+
+    if (timer == 0) {
+      break;
+    }
+
+    // with the interrupts on, the callback may Add the timer again
+    if (timer->callback != 0) {
+      timer->callback(timer->data);
+    }
+  }
+}
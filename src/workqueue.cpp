@@ -0,0 +1,177 @@
+#include <workqueue.h>
+#include <hardwarecommunication/interrupts.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+void printf(char*);
+void printfHex(uint8_t);
+void printfHex32(uint32_t);
+
+WorkItem::WorkItem(void (*function)(void* data), void* data) {
+  next = 0;
+  queued = false;
+  this->function = function;
+  this->data = data;
+}
+
+WorkItem::~WorkItem() {
+}
+
+bool WorkItem::Queued() {
+  return queued;
+}
+
+WorkQueue* WorkQueue::activeTasklets = 0;
+WorkQueue* WorkQueue::activeWorkers = 0;
+
+WorkQueue::WorkQueue(TaskManager* taskManager, uint8_t priority, uint32_t numWorkers) {
+  head = 0;
+  tail = 0;
+  this->taskManager = taskManager;
+  this->priority = priority;
+  this->numWorkers = 0;
+  numQueued = 0;
+  numRun = 0;
+  pending = 0;
+  maxPending = 0;
+
+  if (numWorkers > MaxWorkers) {
+    numWorkers = MaxWorkers;
+  }
+  for (uint32_t i = 0; i < numWorkers; i++) {
+    uint32_t id = taskManager->Spawn(Worker, this, priority);
+    if (id == 0) {
+      break;
+    }
+    workers[this->numWorkers++] = id;
+  }
+
+  // without a worker the items would never run, then tasklet_schedule
+  // and schedule_work rather run them right away
+  if (this->numWorkers == 0) {
+    return;
+  }
+  if (priority == TaskPrioritySoftInterrupt) {
+    if (activeTasklets == 0) {
+      activeTasklets = this;
+    }
+  }
+  else if (activeWorkers == 0) {
+    activeWorkers = this;
+  }
+}
+
+WorkQueue::~WorkQueue() {
+  if (activeTasklets == this) {
+    activeTasklets = 0;
+  }
+  if (activeWorkers == this) {
+    activeWorkers = 0;
+  }
+}
+
+bool WorkQueue::Queue(WorkItem* item) {
+  uint32_t eflags = SaveInterrupts();
+
+  if (item->queued) {
+    RestoreInterrupts(eflags);
+    return false;
+  }
+
+  item->queued = true;
+  item->next = 0;
+  if (tail == 0) {
+    head = item;
+  }
+  else {
+    tail->next = item;
+  }
+  tail = item;
+
+  numQueued++;
+  pending++;
+  if (pending > maxPending) {
+    maxPending = pending;
+  }
+
+  work.WakeOne();
+
+  RestoreInterrupts(eflags);
+  return true;
+}
+
+WorkItem* WorkQueue::Take() {
+  uint32_t eflags = SaveInterrupts();
+
+  while (head == 0) {
+    work.Wait();
+  }
+
+  WorkItem* item = head;
+  head = item->next;
+  if (head == 0) {
+    tail = 0;
+  }
+  pending--;
+  numRun++;
+
+  // from here on the item can be queued again, even while it runs,
+  // so nothing that comes in while the function runs is lost
+  item->queued = false;
+
+  RestoreInterrupts(eflags);
+  return item;
+}
+
+void WorkQueue::Worker(void* queue) {
+  WorkQueue* workQueue = (WorkQueue*)queue;
+  Task* task = workQueue->taskManager->CurrentTask();
+  while (true) {
+    WorkItem* item = workQueue->Take();
+
+    // the tasklets run one after another on this worker, one that waits
+    // would hold up all the others (see Task::SetNonBlocking)
+    task->SetNonBlocking(workQueue->priority == TaskPrioritySoftInterrupt);
+    item->function(item->data);
+    task->SetNonBlocking(false);
+  }
+}
+
+uint32_t WorkQueue::NumWorkers() {
+  return numWorkers;
+}
+
+void WorkQueue::PrintStatistics() {
+  // work: priority 0x01 workers 0x01 queued 0x00000123 run 0x00000123 pending 0x00000000 max 0x00000004
+  printf("work: priority 0x");
+  printfHex(priority);
+  printf(" workers 0x");
+  printfHex(numWorkers);
+  printf(" queued 0x");
+  printfHex32(numQueued);
+  printf(" run 0x");
+  printfHex32(numRun);
+  printf(" pending 0x");
+  printfHex32(pending);
+  printf(" max 0x");
+  printfHex32(maxPending);
+  printf("\n");
+}
+
+bool myos::tasklet_schedule(WorkItem* item) {
+  if (WorkQueue::activeTasklets == 0) {
+    item->function(item->data);
+    return true;
+  }
+  return WorkQueue::activeTasklets->Queue(item);
+}
+
+bool myos::schedule_work(WorkItem* item) {
+  if (WorkQueue::activeWorkers == 0) {
+    item->function(item->data);
+    return true;
+  }
+  return WorkQueue::activeWorkers->Queue(item);
+}
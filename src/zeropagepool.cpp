@@ -0,0 +1,140 @@
+#include <zeropagepool.h>
+#include <hardwarecommunication/interrupts.h>
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::hardwarecommunication;
+
+ZeroPagePool* ZeroPagePool::activeZeroPagePool = 0;
+
+static void Clear(void* page) {
+  uint32_t* words = (uint32_t*)page;
+  for (uint32_t i = 0; i < PhysicalMemoryManager::PageSize / 4; i++) {
+    words[i] = 0;
+  }
+}
+
+// The buddy allocator has no lock of its own. The StackPool, the heap and
+// the page fault handler call it with the interrupts off (and so with the
+// KernelLock), and we do the same. Only Clear runs with the interrupts on.
+static void* TakeFrame(PhysicalMemoryManager* frames) {
+  uint32_t eflags = SaveInterrupts();
+  void* page = frames->AllocateFrame();
+  RestoreInterrupts(eflags);
+  return page;
+}
+
+static void ReturnFrame(PhysicalMemoryManager* frames, void* page) {
+  uint32_t eflags = SaveInterrupts();
+  frames->FreeFrame(page);
+  RestoreInterrupts(eflags);
+}
+
+ZeroPagePool::ZeroPagePool(PhysicalMemoryManager* frames, uint32_t target) {
+  this->frames = frames;
+  this->target = target < MaxPages ? target : MaxPages;
+  numPages = 0;
+  hits = 0;
+  misses = 0;
+
+  if (activeZeroPagePool == 0) {
+    activeZeroPagePool = this;
+  }
+}
+
+ZeroPagePool::~ZeroPagePool() {
+  if (activeZeroPagePool == this) {
+    activeZeroPagePool = 0;
+  }
+
+  for (void* page = Pop(); page != 0; page = Pop()) {
+    ReturnFrame(frames, page);
+  }
+}
+
+// the pool is shared by the idle loop and every task that page faults,
+// so the few instructions on the array run with the interrupts off
+bool ZeroPagePool::Push(void* page) {
+  bool pushed = false;
+  uint32_t eflags = SaveInterrupts();
+  if (numPages < target) {
+    pages[numPages++] = page;
+    pushed = true;
+  }
+  RestoreInterrupts(eflags);
+  return pushed;
+}
+
+void* ZeroPagePool::Pop() {
+  void* page = 0;
+  uint32_t eflags = SaveInterrupts();
+  if (numPages > 0) {
+    page = pages[--numPages];
+  }
+  RestoreInterrupts(eflags);
+  return page;
+}
+
+void* ZeroPagePool::AllocateFrame(uint32_t flags) {
+  if (!(flags & FrameZeroed)) {
+    void* page = TakeFrame(frames);
+    // the pool is memory too, if it's all that is left then use it
+    return page != 0 ? page : Pop();
+  }
+
+  void* page = Pop();
+  if (page != 0) {
+    hits++;
+    return page;
+  }
+
+  misses++;
+  page = TakeFrame(frames);
+  if (page != 0) {
+    Clear(page);
+  }
+  return page;
+}
+
+void ZeroPagePool::FreeFrame(void* page) {
+  ReturnFrame(frames, page);
+}
+
+bool ZeroPagePool::Fill() {
+  if (numPages >= target) {
+    return false;
+  }
+
+  // only keep frames that nobody else is waiting for
+  uint32_t eflags = SaveInterrupts();
+  void* page = 0;
+  if (frames->FreeFrameCount() > target) {
+    page = frames->AllocateFrame();
+  }
+  RestoreInterrupts(eflags);
+  if (page == 0) {
+    return false;
+  }
+
+  // the slow part runs with the interrupts on
+  Clear(page);
+
+  // someone else might have filled the pool in the meantime
+  if (!Push(page)) {
+    ReturnFrame(frames, page);
+    return false;
+  }
+  return true;
+}
+
+uint32_t ZeroPagePool::Available() {
+  return numPages;
+}
+
+uint32_t ZeroPagePool::Hits() {
+  return hits;
+}
+
+uint32_t ZeroPagePool::Misses() {
+  return misses;
+}
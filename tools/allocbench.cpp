@@ -0,0 +1,217 @@
+#include "hostlib.h"
+#include <physicalmemory.h>
+#include <memorymanagement.h>
+
+// allocbench replays synthetic workloads against the kernel heap
+//
+//   make bench                      all workloads
+//   obj/tools/allocbench mixed      only the workloads whose name starts with "mixed"
+//
+// The MemoryManager gets its frames from a PhysicalMemoryManager exactly like
+// in kernelMain. We give the PhysicalMemoryManager a made up multiboot memory
+// map with one available region: an anonymous mapping at ArenaStart.
+//
+// For every workload we print
+//   ns/op      wall clock time per malloc or free
+//   peak       high water mark of the bytes handed out
+//   footprint  frames that the heap took from the PhysicalMemoryManager
+//   frag       free bytes outside of the largest free chunk of their region / free bytes, before the teardown
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::tools;
+
+static const uint32_t ArenaStart = 0x10000000;
+static const size_t ArenaSize = 64 * 1024 * 1024;
+
+// the same sequence on every run, so the results can be compared
+class Random {
+  protected:
+    uint32_t state;
+
+  public:
+    Random(uint32_t seed) {
+      state = seed;
+    }
+
+    uint32_t Next() {
+      // xorshift32
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      return state;
+    }
+
+    // lo <= result <= hi
+    uint32_t Range(uint32_t lo, uint32_t hi) {
+      return lo + Next() % (hi - lo + 1);
+    }
+};
+
+// a place to keep a pointer for a while
+struct Slot {
+  void* ptr;
+  uint32_t size;
+};
+
+static uint32_t operations;
+
+static void Replace(MemoryManager* heap, Slot* slot, uint32_t size, MemoryTag tag) {
+  if (slot->ptr != 0) {
+    heap->free(slot->ptr);
+    operations++;
+  }
+
+  slot->ptr = heap->malloc(size, tag);
+  slot->size = size;
+  operations++;
+
+  // touch the memory, like a real user would
+  if (slot->ptr != 0) {
+    ((uint8_t*)slot->ptr)[0] = 1;
+    ((uint8_t*)slot->ptr)[size - 1] = 1;
+  }
+}
+
+static void Release(MemoryManager* heap, Slot* slots, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (slots[i].ptr != 0) {
+      heap->free(slots[i].ptr);
+      slots[i].ptr = 0;
+    }
+  }
+}
+
+static void Clear(Slot* slots, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    slots[i].ptr = 0;
+    slots[i].size = 0;
+  }
+}
+
+// an ethernet frame: header, ip header and up to 1500 bytes of payload
+static uint32_t PacketSize(Random* random) {
+  return 14 + 20 + random->Range(0, 1500);
+}
+
+static const uint32_t NumPackets = 64;
+static const uint32_t NumObjects = 4096;
+static const uint32_t NumLarge = 8;
+
+static Slot packets[NumPackets];
+static Slot objects[NumObjects];
+static Slot large[NumLarge];
+
+// the network stack: every Send mallocs a buffer and frees it again soon
+// a few of them are in flight at the same time
+static void PacketChurn(MemoryManager* heap, Random* random) {
+  for (uint32_t i = 0; i < 1000000; i++) {
+    Replace(heap, &packets[random->Range(0, NumPackets - 1)], PacketSize(random), MemoryTagNet);
+  }
+}
+
+// drivers allocate their objects once and keep them, while temporary buffers
+// come and go in between, and now and then a driver object is replaced
+static void DriverObjects(MemoryManager* heap, Random* random) {
+  for (uint32_t i = 0; i < NumObjects; i++) {
+    Replace(heap, &objects[i], random->Range(64, 8192), MemoryTagDrivers);
+    Replace(heap, &packets[i % NumPackets], random->Range(256, 2048), MemoryTagKernel);
+  }
+
+  for (uint32_t i = 0; i < 500000; i++) {
+    if (random->Range(0, 15) == 0) {
+      Replace(heap, &objects[random->Range(0, NumObjects - 1)], random->Range(64, 8192), MemoryTagDrivers);
+    }
+    else {
+      Replace(heap, &packets[random->Range(0, NumPackets - 1)], random->Range(256, 2048), MemoryTagKernel);
+    }
+  }
+}
+
+// the desktop with windows and widgets that live long,
+// network traffic that lives short and a few large blocks like a framebuffer
+static void Mixed(MemoryManager* heap, Random* random) {
+  for (uint32_t i = 0; i < 1000000; i++) {
+    uint32_t kind = random->Range(0, 99);
+    if (kind < 60) {
+      Replace(heap, &packets[random->Range(0, NumPackets - 1)], PacketSize(random), MemoryTagNet);
+    }
+    else if (kind < 99) {
+      Replace(heap, &objects[random->Range(0, 1023)], random->Range(32, 512), MemoryTagGui);
+    }
+    else {
+      Replace(heap, &large[random->Range(0, NumLarge - 1)], random->Range(4096, 320 * 200), MemoryTagGui);
+    }
+  }
+}
+
+struct Workload {
+  char* name;
+  void (*run)(MemoryManager* heap, Random* random);
+};
+
+static Workload workloads[] = {
+  { "packet-churn", PacketChurn },
+  { "driver-objects", DriverObjects },
+  { "mixed", Mixed },
+};
+
+static bool StartsWith(char* str, char* prefix) {
+  for (uint32_t i = 0; prefix[i] != '\0'; i++) {
+    if (str[i] != prefix[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void Run(Workload* workload, void* arena) {
+  PhysicalMemoryManager frames(ArenaMultiboot(arena, ArenaSize));
+  MemoryManager heap(&frames);
+  uint32_t totalFrames = frames.TotalFrameCount();
+
+  Clear(packets, NumPackets);
+  Clear(objects, NumObjects);
+  Clear(large, NumLarge);
+  Random random(0x2545F491);
+  operations = 0;
+
+  uint64_t start = NowNanoseconds();
+  workload->run(&heap, &random);
+  uint64_t elapsed = NowNanoseconds() - start;
+
+  MemoryStatistics statistics = heap.GetStatistics();
+  uint32_t frag = FragmentationPercent(&heap);
+
+  PrintPadded(workload->name, 16);
+
+  PrintDecimal(operations, 9);
+  PrintDecimal(Divide(elapsed, operations), 8);
+  PrintDecimal(statistics.peakBytesInUse / 1024, 10);
+  PrintDecimal((totalFrames - frames.FreeFrameCount()) * 4, 12);
+  PrintDecimal(frag, 6);
+  PrintDecimal(statistics.failedAllocations, 8);
+  printf("\n");
+
+  Release(&heap, packets, NumPackets);
+  Release(&heap, objects, NumObjects);
+  Release(&heap, large, NumLarge);
+}
+
+int ToolMain() {
+  void* arena = MapFixed(ArenaStart, ArenaSize);
+  if (arena == 0) {
+    printf("allocbench: can't map the arena\n");
+    return 1;
+  }
+
+  printf("workload              ops   ns/op  peak KiB  footprint KiB frag%  failed\n");
+  for (uint32_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+    if (argc > 1 && !StartsWith(workloads[i].name, argv[1])) {
+      continue;
+    }
+    Run(&workloads[i], arena);
+  }
+
+  return 0;
+}
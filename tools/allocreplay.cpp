@@ -0,0 +1,235 @@
+#include "hostlib.h"
+#include <physicalmemory.h>
+#include <memorymanagement.h>
+#include <memorytrace.h>
+#include <clock.h>
+
+// allocreplay replays an allocation trace of the kernel against the heap
+// with every MemoryPolicy and compares them
+//
+//   make run with MEMORYTRACE defined in kernel.cpp and COM1 going into a file
+//   (qemu: -serial file:trace.bin, VirtualBox: serial port in raw file mode)
+//
+//   obj/tools/allocreplay trace.bin
+//
+// The pointers in the trace are addresses of the kernel heap. While we replay
+// we remember which pointer of our heap belongs to which pointer of the trace,
+// so that a free in the trace frees the right block here.
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::tools;
+
+static const uint32_t ArenaStart = 0x10000000;
+static const size_t ArenaSize = 64 * 1024 * 1024;
+
+// the file is read into this mapping, that is up to 2 Mi records
+static const uint32_t TraceStart = 0x20000000;
+static const size_t TraceSize = 64 * 1024 * 1024;
+
+// traced pointer -> replayed pointer, open addressing with linear probing
+// a deleted entry keeps its key as a tombstone with a value of 0
+static const uint32_t NumEntries = 1 << 20;
+static uint32_t keys[NumEntries];
+static uint32_t values[NumEntries];
+
+static uint32_t Hash(uint32_t key) {
+  // the heap pointers are 16 byte aligned, so mix the upper bits down
+  key ^= key >> 16;
+  key *= 0x45D9F3B;
+  key ^= key >> 16;
+  return key & (NumEntries - 1);
+}
+
+static void Insert(uint32_t key, uint32_t value) {
+  uint32_t i = Hash(key);
+  while (keys[i] != 0 && keys[i] != key && values[i] != 0) {
+    i = (i + 1) & (NumEntries - 1);
+  }
+  keys[i] = key;
+  values[i] = value;
+}
+
+// returns the value and deletes the entry, or 0
+static uint32_t Remove(uint32_t key) {
+  for (uint32_t i = Hash(key); keys[i] != 0; i = (i + 1) & (NumEntries - 1)) {
+    if (keys[i] == key && values[i] != 0) {
+      uint32_t value = values[i];
+      values[i] = 0;
+      return value;
+    }
+  }
+  return 0;
+}
+
+static void ClearMap() {
+  for (uint32_t i = 0; i < NumEntries; i++) {
+    keys[i] = 0;
+    values[i] = 0;
+  }
+}
+
+struct Policy {
+  char* name;
+  uint32_t flags;
+};
+
+static Policy policies[] = {
+  { "bins+first-fit", MemoryPolicyBins },
+  { "first-fit", 0 },
+  { "bins+best-fit", MemoryPolicyBins | MemoryPolicyBestFit },
+  { "best-fit", MemoryPolicyBestFit },
+};
+
+static void Replay(Policy* policy, void* arena, MemoryTraceRecord* records, uint32_t numRecords) {
+  PhysicalMemoryManager frames(ArenaMultiboot(arena, ArenaSize));
+  MemoryManager heap(&frames);
+  heap.SetPolicy(policy->flags);
+  uint32_t totalFrames = frames.TotalFrameCount();
+
+  ClearMap();
+
+  uint64_t worst = 0;
+  uint32_t operations = 0;
+  uint32_t unknownFrees = 0;
+
+  uint64_t start = NowNanoseconds();
+  for (uint32_t i = 0; i < numRecords; i++) {
+    MemoryTraceRecord* record = &records[i];
+
+    uint64_t before = rdtsc();
+    switch (record->operation) {
+      case MemoryTraceMalloc:
+      case MemoryTraceMallocAligned: {
+        void* ptr;
+        if (record->operation == MemoryTraceMalloc) {
+          ptr = heap.malloc(record->size, (MemoryTag)record->tag);
+        }
+        else {
+          ptr = heap.malloc_aligned(record->size, record->align, (MemoryTag)record->tag);
+        }
+
+        // if the kernel got nothing it never frees it either
+        if (ptr != 0 && record->address != 0) {
+          Insert(record->address, (uint32_t)ptr);
+        }
+        break;
+      }
+
+      case MemoryTraceFree: {
+        // the malloc might have been lost in a gap of the trace
+        uint32_t ptr = Remove(record->address);
+        if (ptr == 0) {
+          unknownFrees++;
+          continue;
+        }
+        heap.free((void*)ptr);
+        break;
+      }
+
+      default:
+        continue;
+    }
+
+    uint64_t cycles = rdtsc() - before;
+    if (cycles > worst) {
+      worst = cycles;
+    }
+    operations++;
+  }
+  uint64_t elapsed = NowNanoseconds() - start;
+
+  MemoryStatistics statistics = heap.GetStatistics();
+
+  PrintPadded(policy->name, 16);
+  PrintDecimal(operations, 9);
+  PrintDecimal(Divide(elapsed, operations == 0 ? 1 : operations), 8);
+  PrintDecimal(worst, 11);
+  PrintDecimal(statistics.peakBytesInUse / 1024, 10);
+  PrintDecimal((totalFrames - frames.FreeFrameCount()) * 4, 12);
+  PrintDecimal(FragmentationPercent(&heap), 6);
+  PrintDecimal(statistics.failedAllocations, 8);
+  PrintDecimal(unknownFrees, 8);
+  printf("\n");
+}
+
+// copy the records out of the stream into an array, in place
+// the stream can start in the middle of a record and can have garbage in it
+// so we look for the magic, and the sequence numbers tell us about lost records
+static uint32_t Parse(uint8_t* data, uint32_t size, uint32_t* lost) {
+  MemoryTraceRecord* records = (MemoryTraceRecord*)data;
+  uint32_t numRecords = 0;
+  *lost = 0;
+
+  uint32_t offset = 0;
+  while (offset + sizeof(MemoryTraceRecord) <= size) {
+    MemoryTraceRecord* record = (MemoryTraceRecord*)(data + offset);
+    if (record->magic != MemoryTrace::Magic || record->operation > MemoryTraceFree) {
+      offset++;
+      continue;
+    }
+
+    if (numRecords > 0 && record->sequence != records[numRecords - 1].sequence + 1) {
+      *lost += record->sequence - records[numRecords - 1].sequence - 1;
+    }
+
+    // records[numRecords] is never behind the record we read, so memmove semantics are fine
+    MemoryTraceRecord copy = *record;
+    records[numRecords++] = copy;
+    offset += sizeof(MemoryTraceRecord);
+  }
+
+  return numRecords;
+}
+
+int ToolMain() {
+  if (argc < 2) {
+    printf("usage: allocreplay trace.bin\n");
+    return 1;
+  }
+
+  void* arena = MapFixed(ArenaStart, ArenaSize);
+  uint8_t* data = (uint8_t*)MapFixed(TraceStart, TraceSize);
+  if (arena == 0 || data == 0) {
+    printf("allocreplay: can't map the arena\n");
+    return 1;
+  }
+
+  int32_t file = Syscall(SysOpen, (uint32_t)argv[1], 0 /* O_RDONLY */);
+  if (file < 0) {
+    printf("allocreplay: can't open ");
+    printf(argv[1]);
+    printf("\n");
+    return 1;
+  }
+
+  uint32_t size = 0;
+  while (size < TraceSize) {
+    int32_t result = Syscall(SysRead, file, (uint32_t)data + size, TraceSize - size);
+    if (result <= 0) {
+      break;
+    }
+    size += result;
+  }
+  Syscall(SysClose, file);
+
+  uint32_t lost;
+  uint32_t numRecords = Parse(data, size, &lost);
+
+  printf("records ");
+  PrintDecimal(numRecords);
+  printf(", lost ");
+  PrintDecimal(lost);
+  if (numRecords > 0) {
+    printf(", cycles ");
+    PrintDecimal(((MemoryTraceRecord*)data)[numRecords - 1].timestamp - ((MemoryTraceRecord*)data)[0].timestamp);
+  }
+  printf("\n");
+
+  printf("policy                ops   ns/op  worst cyc  peak KiB  footprint KiB frag%  failed unknown\n");
+  for (uint32_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    Replay(&policies[i], arena, (MemoryTraceRecord*)data, numRecords);
+  }
+
+  return 0;
+}
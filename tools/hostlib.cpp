@@ -0,0 +1,172 @@
+#include "hostlib.h"
+
+using namespace myos;
+using namespace myos::common;
+using namespace myos::tools;
+
+// the symbols of the linker script, the PhysicalMemoryManager reserves them
+extern "C" uint8_t kernel_start;
+extern "C" uint8_t kernel_end;
+uint8_t kernel_start;
+uint8_t kernel_end;
+
+uint32_t myos::tools::argc = 0;
+char** myos::tools::argv = 0;
+
+int32_t myos::tools::Syscall(uint32_t number, uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e, uint32_t f) {
+  // the sixth argument goes into ebp, which the compiler might use itself
+  // so we save it around the int 0x80
+  int32_t result;
+  asm volatile(
+      "push %%ebp\n"
+      "mov %7, %%ebp\n"
+      "int $0x80\n"
+      "pop %%ebp"
+      : "=a" (result)
+      : "a" (number), "b" (a), "c" (b), "d" (c), "S" (d), "D" (e), "m" (f)
+      : "memory");
+  return result;
+}
+
+void myos::tools::Exit(int32_t status) {
+  while (true) {
+    Syscall(SysExit, status);
+  }
+}
+
+void* myos::tools::MapFixed(uint32_t address, size_t size) {
+  // PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE
+  // so we never throw away something that is already mapped there
+  int32_t result = Syscall(SysMmap2, address, size, 0x3, 0x22 | 0x100000, (uint32_t)-1, 0);
+  if ((uint32_t)result != address) {
+    return 0;
+  }
+  return (void*)result;
+}
+
+uint64_t myos::tools::NowNanoseconds() {
+  // struct timespec of i386: two 32 bit longs
+  int32_t timespec[2];
+  Syscall(SysClockGetTime, 1 /* CLOCK_MONOTONIC */, (uint32_t)timespec);
+  return (uint64_t)timespec[0] * 1000000000 + (uint32_t)timespec[1];
+}
+
+uint64_t myos::tools::Divide(uint64_t dividend, uint64_t divisor) {
+  if (divisor == 0) {
+    return 0;
+  }
+
+  uint64_t quotient = 0;
+  uint64_t remainder = 0;
+  for (int bit = 63; bit >= 0; bit--) {
+    remainder = (remainder << 1) | ((dividend >> bit) & 1);
+    if (remainder >= divisor) {
+      remainder -= divisor;
+      quotient |= (uint64_t)1 << bit;
+    }
+  }
+  return quotient;
+}
+
+void myos::tools::PrintDecimal(uint64_t value, uint32_t width) {
+  char digits[21];
+  int i = 20;
+  digits[i] = '\0';
+  do {
+    uint64_t next = Divide(value, 10);
+    digits[--i] = '0' + (char)(value - next * 10);
+    value = next;
+  } while (value != 0);
+
+  for (uint32_t length = 20 - i; length < width; length++) {
+    printf(" ");
+  }
+  printf(&digits[i]);
+}
+
+MultibootInformation* myos::tools::ArenaMultiboot(void* arena, size_t size) {
+  static MultibootMemoryMapEntry entry;
+  entry.size = sizeof(MultibootMemoryMapEntry) - 4;
+  entry.baseAddress = (uint32_t)arena;
+  entry.length = size;
+  entry.type = MultibootMemoryAvailable;
+
+  static MultibootInformation multiboot;
+  multiboot.flags = MultibootFlagMemoryMap;
+  multiboot.mmapAddress = (uint32_t)&entry;
+  multiboot.mmapLength = sizeof(entry);
+  return &multiboot;
+}
+
+uint32_t myos::tools::FragmentationPercent(MemoryManager* heap) {
+  MemoryFragmentation fragmentation;
+  heap->GetFragmentation(&fragmentation);
+
+  // the binned chunks are free too, but not for a request of another size class
+  uint32_t freeBytes = fragmentation.freeBytes + fragmentation.binnedBytes;
+  if (freeBytes == 0) {
+    return 0;
+  }
+
+  // every region counts on its own: the free bytes outside of its largest
+  // free chunk are the fragmented ones, a heap of many regions that are
+  // each in one piece is not fragmented
+  uint32_t fragmentedBytes = freeBytes - fragmentation.largestFreeBlocks;
+  return (uint32_t)Divide((uint64_t)fragmentedBytes * 100, freeBytes);
+}
+
+void myos::tools::PrintPadded(char* str, uint32_t width) {
+  printf(str);
+  uint32_t length = 0;
+  while (str[length] != '\0') {
+    length++;
+  }
+  for (; length < width; length++) {
+    printf(" ");
+  }
+}
+
+void printf(char* str) {
+  uint32_t length = 0;
+  while (str[length] != '\0') {
+    length++;
+  }
+  Syscall(SysWrite, 1, (uint32_t)str, length);
+}
+
+void printfHex(uint8_t key) {
+  char foo[3];
+  char* hex = "0123456789ABCDEF";
+  foo[0] = hex[(key >> 4) & 0xF];
+  foo[1] = hex[key & 0xF];
+  foo[2] = '\0';
+  printf(foo);
+}
+
+void printfHex16(uint16_t key) {
+  printfHex((key >> 8) & 0xFF);
+  printfHex( key & 0xFF);
+}
+
+void printfHex32(uint32_t key) {
+  printfHex((key >> 24) & 0xFF);
+  printfHex((key >> 16) & 0xFF);
+  printfHex((key >> 8) & 0xFF);
+  printfHex( key & 0xFF);
+}
+
+// linux starts us here with argc, argv[0], argv[1], ... on the stack
+extern "C" void ToolStart(uint32_t* stack) {
+  argc = stack[0];
+  argv = (char**)&stack[1];
+  Exit(ToolMain());
+}
+
+asm(
+    ".globl _start\n"
+    "_start:\n"
+    "  mov %esp, %eax\n"
+    "  and $0xFFFFFFF0, %esp\n"
+    "  sub $12, %esp\n"
+    "  push %eax\n"
+    "  call ToolStart\n");
@@ -0,0 +1,75 @@
+
+#ifndef __MYOS__TOOLS__HOSTLIB_H
+#define __MYOS__TOOLS__HOSTLIB_H
+
+#include <common/types.h>
+#include <multiboot.h>
+#include <memorymanagement.h>
+
+// The tools in this directory run as 32 bit linux programs on the build machine.
+//
+// They are linked with the very same objects as the kernel (obj/memorymanagement.o
+// and so on), which are built with -nostdlib -fno-builtin, so there is no libc
+// and we can't include its headers for -m32 on every machine either.
+// Instead we talk to linux with int 0x80 ourselves, like a program on myos would,
+// and provide the printf functions that the kernel objects expect.
+
+namespace myos {
+  namespace tools {
+
+    // i386 linux system call numbers
+    const common::uint32_t SysExit         = 1;
+    const common::uint32_t SysRead         = 3;
+    const common::uint32_t SysWrite        = 4;
+    const common::uint32_t SysOpen         = 5;
+    const common::uint32_t SysClose        = 6;
+    const common::uint32_t SysMmap2        = 192;
+    const common::uint32_t SysClockGetTime = 265;
+
+    common::int32_t Syscall(common::uint32_t number,
+        common::uint32_t a = 0, common::uint32_t b = 0, common::uint32_t c = 0,
+        common::uint32_t d = 0, common::uint32_t e = 0, common::uint32_t f = 0);
+
+    void Exit(common::int32_t status);
+
+    // anonymous memory at exactly this address, or 0
+    void* MapFixed(common::uint32_t address, common::size_t size);
+
+    // CLOCK_MONOTONIC in nanoseconds
+    common::uint64_t NowNanoseconds();
+
+    // there is no 32 bit libgcc on the build machine for __udivdi3
+    // so 64 bit divisions go through this (binary long division)
+    common::uint64_t Divide(common::uint64_t dividend, common::uint64_t divisor);
+
+    // print an unsigned number in decimal, padded with spaces to width
+    void PrintDecimal(common::uint64_t value, common::uint32_t width = 0);
+
+    // a multiboot structure whose memory map has only one available region
+    // the arena, for a PhysicalMemoryManager like the one in kernelMain
+    // the buddy system only manages the first GiB, so the arena must be below that
+    MultibootInformation* ArenaMultiboot(void* arena, common::size_t size);
+
+    // the free bytes outside of the largest free chunk of their region in
+    // percent of all the free bytes, the binned chunks count as free
+    common::uint32_t FragmentationPercent(MemoryManager* heap);
+
+    // print str and spaces up to width
+    void PrintPadded(char* str, common::uint32_t width);
+
+    // the command line of the program, from the stack that linux gives _start
+    extern common::uint32_t argc;
+    extern char** argv;
+  }
+}
+
+// what the kernel objects call, they go to stdout here
+void printf(char* str);
+void printfHex(myos::common::uint8_t key);
+void printfHex16(myos::common::uint16_t key);
+void printfHex32(myos::common::uint32_t key);
+
+// every tool implements this instead of main
+int ToolMain();
+
+#endif